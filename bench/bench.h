@@ -0,0 +1,190 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Minimal benchmark harness shared by the host (native) and target builds.
+// Each case is timed over enough iterations to fill BENCH_TARGET_MS, the
+// best of BENCH_REPEATS runs is kept, and results are printed as JSON.
+//
+// Timing source: cycle counter on the ESP32-S3, std::chrono on host, plus
+// Linux perf counters (cycles, instructions) when built with BENCH_PERF.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(BENCH_PERF) && defined(__linux__) && !defined(ARDUINO)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef BENCH_TARGET_MS
+#define BENCH_TARGET_MS 200
+#endif
+
+#ifndef BENCH_REPEATS
+#define BENCH_REPEATS 5
+#endif
+
+struct BenchResult {
+    const char* name;
+    uint32_t iterations;
+    double nsPerIter;
+    double bytesPerIter;     // 0 when throughput doesn't apply
+    double cyclesPerIter;    // 0 when no cycle source
+    double instrPerIter;     // 0 unless perf counters are available
+};
+
+class BenchTimer {
+public:
+#ifdef ARDUINO
+    void start() { startCycles = ESP.getCycleCount(); }
+    void stop() { cycles = ESP.getCycleCount() - startCycles; }
+    double elapsedNs() const { return cycles * 1000.0 / getCpuFrequencyMhz(); }
+    double elapsedCycles() const { return cycles; }
+    double elapsedInstructions() const { return 0; }
+
+private:
+    uint32_t startCycles = 0;
+    uint32_t cycles = 0;  // Wraps after ~17 s at 240 MHz; runs are far shorter
+#else
+    BenchTimer() { openPerf(); }
+    ~BenchTimer() { closePerf(); }
+
+    void start() {
+        resetPerf();
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    void stop() {
+        auto end = std::chrono::steady_clock::now();
+        ns = std::chrono::duration<double, std::nano>(end - startTime).count();
+        readPerf();
+    }
+
+    double elapsedNs() const { return ns; }
+    double elapsedCycles() const { return cycles; }
+    double elapsedInstructions() const { return instructions; }
+
+private:
+    std::chrono::steady_clock::time_point startTime;
+    double ns = 0;
+    double cycles = 0;
+    double instructions = 0;
+
+#if defined(BENCH_PERF) && defined(__linux__)
+    int cycleFd = -1;
+    int instrFd = -1;
+
+    static int openCounter(uint64_t config) {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    void openPerf() {
+        cycleFd = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+        instrFd = openCounter(PERF_COUNT_HW_INSTRUCTIONS);
+    }
+
+    void closePerf() {
+        if (cycleFd >= 0) close(cycleFd);
+        if (instrFd >= 0) close(instrFd);
+    }
+
+    void resetPerf() {
+        for (int fd : {cycleFd, instrFd}) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    void readPerf() {
+        uint64_t value = 0;
+        if (cycleFd >= 0 && read(cycleFd, &value, sizeof(value)) == sizeof(value)) cycles = (double)value;
+        if (instrFd >= 0 && read(instrFd, &value, sizeof(value)) == sizeof(value)) instructions = (double)value;
+    }
+#else
+    void openPerf() {}
+    void closePerf() {}
+    void resetPerf() {}
+    void readPerf() {}
+#endif
+#endif
+};
+
+class BenchRunner {
+public:
+    const char* filter = nullptr;  // Only run cases whose name contains this
+
+    // fn runs one iteration; bytesPerIter > 0 adds MB/s to the report
+    template <typename Fn>
+    void run(const char* name, double bytesPerIter, Fn fn) {
+        if (filter && !strstr(name, filter)) return;
+        BenchTimer timer;
+
+        // Warm up and find an iteration count that fills the target time
+        uint32_t iterations = 1;
+        while (true) {
+            timer.start();
+            for (uint32_t i = 0; i < iterations; i++) fn();
+            timer.stop();
+            if (timer.elapsedNs() >= BENCH_TARGET_MS * 1e6 / 4 || iterations >= (1u << 28)) break;
+            iterations *= 2;
+        }
+        iterations = (uint32_t)(iterations * (BENCH_TARGET_MS * 1e6 / std::max(timer.elapsedNs(), 1.0)));
+        if (iterations == 0) iterations = 1;
+
+        BenchResult best = {name, iterations, 1e300, bytesPerIter, 0, 0};
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            timer.start();
+            for (uint32_t i = 0; i < iterations; i++) fn();
+            timer.stop();
+            double ns = timer.elapsedNs() / iterations;
+            if (ns < best.nsPerIter) {
+                best.nsPerIter = ns;
+                best.cyclesPerIter = timer.elapsedCycles() / iterations;
+                best.instrPerIter = timer.elapsedInstructions() / iterations;
+            }
+        }
+        results.push_back(best);
+    }
+
+    void printJson(const char* platform) const {
+        Serial.printf("{\n  \"platform\": \"%s\",\n  \"results\": [\n", platform);
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult& r = results[i];
+            Serial.printf("    {\"name\": \"%s\", \"iterations\": %u, \"ns_per_iter\": %.1f",
+                          r.name, (unsigned)r.iterations, r.nsPerIter);
+            if (r.bytesPerIter > 0) {
+                Serial.printf(", \"mb_per_s\": %.2f", r.bytesPerIter / r.nsPerIter * 1e3);
+            }
+            if (r.cyclesPerIter > 0) {
+                Serial.printf(", \"cycles_per_iter\": %.1f", r.cyclesPerIter);
+            }
+            if (r.instrPerIter > 0) {
+                Serial.printf(", \"instructions_per_iter\": %.1f", r.instrPerIter);
+            }
+            Serial.printf("}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        Serial.printf("  ]\n}\n");
+    }
+
+private:
+    std::vector<BenchResult> results;
+};
+
+// Keeps the optimizer from discarding a benchmarked result
+template <typename T>
+inline void benchKeep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
@@ -0,0 +1,558 @@
+// Benchmarks for the WAV loader, sample browser, waveform thumbnails,
+// loop slicing and time-stretch, sequencer, display and audio mixing.
+//
+// Host:   pio run -e native && .pio/build/native/program [filter]
+// Target: pio run -e bench -t upload && pio device monitor
+//
+// Both print JSON; compare against a stored baseline with
+// tools/bench_compare.py.
+
+#include <M5Cardputer.h>
+#include "bench.h"
+#include "sequencer.h"
+#include "audio.h"
+#include "display.h"
+#include "browser.h"
+#include "waveform.h"
+#include "recorder.h"
+#include "slicer.h"
+#include "stretch.h"
+#include "drum_synth.h"
+#include "prefetch.h"
+#include "pan.h"
+#include "wav_fixtures.h"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t BENCH_SAMPLE_RATE = 22050;
+constexpr size_t BENCH_SAMPLE_FRAMES = BENCH_SAMPLE_RATE;  // 1 second
+constexpr size_t MIX_BLOCK_FRAMES = 256;
+
+// Sample memory per voice that cold attacks are picked from at random,
+// far larger than the data cache (32 KB on target, the LLC on host)
+#ifdef ARDUINO
+constexpr size_t ATTACK_POOL_FRAMES = 256 * 1024;
+#else
+constexpr size_t ATTACK_POOL_FRAMES = 8 * 1024 * 1024;
+#endif
+
+Sequencer<Engine> sequencer;
+AudioManager<Engine> audio;
+DisplayManager<Engine> display;
+
+float testSignal(size_t frame, uint16_t channel) {
+    float t = (float)frame / BENCH_SAMPLE_RATE;
+    return sinf(2.0f * 3.14159265f * (220.0f + 110.0f * channel) * t) * expf(-4.0f * t);
+}
+
+// Builds a WAV file holding a decaying sine (a second tone on the right)
+std::vector<uint8_t> makeWav(uint16_t format, uint16_t bitsPerSample, uint16_t channels,
+                             size_t frames) {
+    std::vector<uint8_t> data;
+    uint16_t blockAlign = channels * bitsPerSample / 8;
+    uint16_t samplesPerBlock = 0;
+
+    if (format == WAV_FORMAT_IMA_ADPCM) {
+        blockAlign = 512 * channels;
+        samplesPerBlock = (blockAlign - 4 * channels) * 2 / channels + 1;
+        std::vector<int16_t> pcm(frames * channels);
+        for (size_t i = 0; i < pcm.size(); i++) {
+            pcm[i] = (int16_t)(testSignal(i / channels, i % channels) * 32767);
+        }
+        encodeIma(data, pcm, channels, blockAlign, samplesPerBlock);
+    } else {
+        for (size_t i = 0; i < frames * channels; i++) {
+            float v = testSignal(i / channels, i % channels);
+            int32_t s32 = (int32_t)(v * 2147483647.0f);
+            switch (bitsPerSample) {
+                case 8:  data.push_back((uint8_t)(128 + (int)(v * 127))); break;
+                case 16: put16(data, (uint16_t)(s32 >> 16)); break;
+                case 24: data.push_back(s32 >> 8); put16(data, (uint16_t)(s32 >> 16)); break;
+                case 32:
+                    if (format == WAV_FORMAT_FLOAT) {
+                        uint32_t bits;
+                        memcpy(&bits, &v, 4);
+                        put32(data, bits);
+                    } else {
+                        put32(data, (uint32_t)s32);
+                    }
+                    break;
+            }
+        }
+    }
+
+    return wavFile(format, bitsPerSample, channels, BENCH_SAMPLE_RATE, blockAlign, samplesPerBlock,
+                   data);
+}
+
+void installFile(const char* path, const std::vector<uint8_t>& contents) {
+#ifdef ARDUINO
+    File file = SD.open(path, FILE_WRITE);
+    if (file) {
+        file.write(contents.data(), contents.size());
+        file.close();
+    }
+#else
+    SD.addFile(path, contents);
+#endif
+}
+
+// Reference model of the per-block mix the speaker task performs for our
+// four channels: sum with per-channel volume, saturate to 16 bits.
+struct MixVoice {
+    const int16_t* data;
+    size_t length;
+    size_t pos;
+    uint8_t volume;
+};
+
+void mixBlock(MixVoice* voices, size_t voiceCount, int16_t* out, size_t frames) {
+    int32_t acc[MIX_BLOCK_FRAMES] = {0};
+    for (size_t v = 0; v < voiceCount; v++) {
+        MixVoice& voice = voices[v];
+        size_t n = std::min(frames, voice.length - voice.pos);
+        const int16_t* src = voice.data + voice.pos;
+        for (size_t i = 0; i < n; i++) {
+            acc[i] += src[i] * voice.volume;
+        }
+        voice.pos += n;
+        if (voice.pos >= voice.length) voice.pos = 0;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        int32_t s = acc[i] >> 8;
+        out[i] = (int16_t)(s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+    }
+}
+
+// The same mix on a stereo output (STEREO_OUTPUT builds): every voice is
+// an interleaved render with its track's pan (pan.h), length and pos in
+// frames.
+void mixBlockStereo(MixVoice* voices, size_t voiceCount, int16_t* out, size_t frames) {
+    int32_t acc[2 * MIX_BLOCK_FRAMES] = {0};
+    for (size_t v = 0; v < voiceCount; v++) {
+        MixVoice& voice = voices[v];
+        size_t n = std::min(frames, voice.length - voice.pos);
+        const int16_t* src = voice.data + 2 * voice.pos;
+        for (size_t i = 0; i < 2 * n; i++) {
+            acc[i] += src[i] * voice.volume;
+        }
+        voice.pos += n;
+        if (voice.pos >= voice.length) voice.pos = 0;
+    }
+    for (size_t i = 0; i < 2 * frames; i++) {
+        int32_t s = acc[i] >> 8;
+        out[i] = (int16_t)(s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+    }
+}
+
+#ifndef ARDUINO
+
+constexpr uint32_t BROWSER_BENCH_FILES = 10000;
+constexpr uint32_t BROWSER_BENCH_FOLDERS = 100;
+
+// 10k-file libraries: one flat folder and 100 folders of 100. Only names
+// matter, so the files are empty.
+void installBrowserTrees() {
+    static const char* kinds[] = {"kick", "snare", "hat", "clap", "tom", "perc", "ride", "crash"};
+    char path[64];
+    for (uint32_t i = 0; i < BROWSER_BENCH_FILES; i++) {
+        const char* kind = kinds[i % 8];
+        if (i + 1 == BROWSER_BENCH_FILES) kind = "zap";
+        snprintf(path, sizeof(path), "/flat/%s_%05u.wav", kind, (unsigned)i);
+        SD.addFile(path, {});
+        snprintf(path, sizeof(path), "/tree/bank%03u/%s_%05u.wav",
+                 (unsigned)(i % BROWSER_BENCH_FOLDERS), kind, (unsigned)i);
+        SD.addFile(path, {});
+    }
+}
+
+// The listing the browser replaced: every path as a String in a vector,
+// then sorted
+size_t legacyScan(const char* dirPath) {
+    std::vector<String> files;
+    File root = SD.open(dirPath);
+    while (true) {
+        File entry = root.openNextFile();
+        if (!entry) break;
+        if (!entry.isDirectory()) files.push_back(entry.name());
+        entry.close();
+    }
+    std::sort(files.begin(), files.end());
+    return files.size();
+}
+
+#endif
+
+void runAll(BenchRunner& runner) {
+    std::vector<uint8_t> wav16 = makeWav(WAV_FORMAT_PCM, 16, 1, BENCH_SAMPLE_FRAMES);
+    std::vector<uint8_t> wav8 = makeWav(WAV_FORMAT_PCM, 8, 1, BENCH_SAMPLE_FRAMES);
+    installFile("/bench16.wav", wav16);
+    installFile("/bench8.wav", wav8);
+
+    // loadSample(): header parse, chunk scan, allocation and conversion
+    runner.run("wav_load_16bit_mono", wav16.size(), [] {
+        audio.loadSample(0, "/bench16.wav");
+    });
+    runner.run("wav_load_8bit_mono", wav8.size(), [] {
+        audio.loadSample(0, "/bench8.wav");
+    });
+
+    // Startup kit of mixed formats over a simulated card (fixed command
+    // latency per read, 1 bit per SPI clock): one file at a time through
+    // loadSample() versus the pipelined loadKit()
+    static const char* kitFiles[4] = {"/kit1.wav", "/kit2.wav", "/kit3.wav", "/kit4.wav"};
+    installFile(kitFiles[0], makeWav(WAV_FORMAT_PCM, 16, 2, BENCH_SAMPLE_FRAMES));
+    installFile(kitFiles[1], makeWav(WAV_FORMAT_PCM, 24, 1, BENCH_SAMPLE_FRAMES));
+    installFile(kitFiles[2], makeWav(WAV_FORMAT_PCM, 8, 1, BENCH_SAMPLE_FRAMES));
+    installFile(kitFiles[3], makeWav(WAV_FORMAT_IMA_ADPCM, 4, 2, BENCH_SAMPLE_FRAMES));
+    double kitBytes = 0;
+    for (const char* path : kitFiles) {
+        File f = SD.open(path, FILE_READ);
+        kitBytes += f.size();
+    }
+#ifndef ARDUINO
+    SD.setSimulatedLatency(200);
+    audio.probeSpiFrequency(kitFiles[0]);
+#endif
+    runner.run("kit_load_sequential", kitBytes, [] {
+        for (uint8_t i = 0; i < 4; i++) audio.loadSample(i, kitFiles[i]);
+    });
+    runner.run("kit_load_pipelined", kitBytes, [] {
+        bool loaded[4];
+        audio.loadKit(kitFiles, 4, loaded);
+    });
+#ifndef ARDUINO
+    SD.setSimulatedLatency(0);
+#endif
+
+#ifndef ARDUINO
+    // Sample browser over 10k-file trees (host only: writing 20k files to
+    // a real card takes too long)
+    installBrowserTrees();
+    static SampleBrowser browser;
+    runner.run("browser_legacy_scan_flat10k", 0, [] {
+        benchKeep(legacyScan("/flat"));
+    });
+    runner.run("browser_first_page_flat10k", 0, [] {
+        browser.open("/flat");
+        for (uint32_t i = 0; i < BROWSER_ROWS; i++) benchKeep(browser.entry(i));
+    });
+    runner.run("browser_walk_flat10k", 0, [] {
+        browser.open("/flat");
+        for (uint32_t i = 0; browser.entry(i); i++) {
+        }
+    });
+    runner.run("browser_search_flat10k", 0, [] {
+        // Type "za": the only match is the last file
+        browser.open("/flat");
+        browser.typeChar('z');
+        browser.typeChar('a');
+        benchKeep(browser.selected);
+    });
+    runner.run("browser_walk_tree10k", 0, [] {
+        browser.open("/tree");
+        for (uint32_t folder = 0; folder < BROWSER_BENCH_FOLDERS; folder++) {
+            browser.selected = folder;
+            browser.enterSelected();
+            for (uint32_t i = 0; browser.entry(i); i++) {
+            }
+            browser.up();
+        }
+    });
+#endif
+
+    // WavDecoder per format from memory; MB/s is of encoded input
+    struct DecodeCase {
+        const char* name;
+        uint16_t format;
+        uint16_t bits;
+        uint16_t channels;
+    };
+    static const DecodeCase decodeCases[] = {
+        {"wav_decode_u8_mono", WAV_FORMAT_PCM, 8, 1},
+        {"wav_decode_u8_stereo", WAV_FORMAT_PCM, 8, 2},
+        {"wav_decode_s16_mono", WAV_FORMAT_PCM, 16, 1},
+        {"wav_decode_s16_stereo", WAV_FORMAT_PCM, 16, 2},
+        {"wav_decode_s24_mono", WAV_FORMAT_PCM, 24, 1},
+        {"wav_decode_s24_stereo", WAV_FORMAT_PCM, 24, 2},
+        {"wav_decode_s32_stereo", WAV_FORMAT_PCM, 32, 2},
+        {"wav_decode_f32_mono", WAV_FORMAT_FLOAT, 32, 1},
+        {"wav_decode_f32_stereo", WAV_FORMAT_FLOAT, 32, 2},
+        {"wav_decode_ima_mono", WAV_FORMAT_IMA_ADPCM, 4, 1},
+        {"wav_decode_ima_stereo", WAV_FORMAT_IMA_ADPCM, 4, 2},
+    };
+    static WavDecoder decoder;
+    static std::vector<int16_t> decoded(BENCH_SAMPLE_FRAMES + 1024);
+    for (const DecodeCase& c : decodeCases) {
+        static std::vector<uint8_t> file;
+        static WavInfo info;
+        file = makeWav(c.format, c.bits, c.channels, BENCH_SAMPLE_FRAMES);
+        MemorySource src = {&file};
+        decoder.readInfo(src, info);
+        runner.run(c.name, info.dataSize, [] {
+            MemorySource src = {&file};
+            benchKeep(decoder.decode(src, info, decoded.data(), decoded.size()));
+        });
+    }
+
+    // Sequencer::update() plus trigger scheduling. "step" advances time by
+    // a full interval every call so each call fires a step; "idle" is the
+    // common case of polling between steps.
+    sequencer.init();
+    sequencer.pattern.steps[0] = 0x11;
+    sequencer.pattern.steps[1] = 0x44;
+    sequencer.pattern.steps[2] = 0xFF;
+    sequencer.playback.isPlaying = true;
+    static uint32_t now = 0;
+    runner.run("sequencer_update_step", 0, [] {
+        now += sequencer.playback.stepIntervalUs;
+        if (sequencer.update(now)) {
+            sequencer.scheduleStep();
+            sequencer.triggers.fireDue(now, [](uint8_t track, uint8_t step) {
+                benchKeep(track + step);
+            });
+        }
+    });
+    runner.run("sequencer_update_idle", 0, [] {
+        now += 1;
+        benchKeep(sequencer.update(now));
+    });
+
+    // Thumbnail pyramid build over a 1 s sample, and drawing it at track
+    // row and browser sizes from the pyramid versus straight from samples
+    static std::vector<int16_t> waveSamples(BENCH_SAMPLE_FRAMES);
+    for (size_t i = 0; i < waveSamples.size(); i++) {
+        waveSamples[i] = (int16_t)(testSignal(i, 0) * 30000);
+    }
+    static WaveformPyramid wave;
+    runner.run("wave_build_1s", waveSamples.size() * sizeof(int16_t), [] {
+        wave.build(waveSamples.data(), waveSamples.size());
+        benchKeep(wave.rms[0]);
+    });
+    display.init();
+    runner.run("wave_draw_track_row", 0, [] {
+        display.drawWaveform(wave, 2, 37, DisplayManager<Engine>::Layout::ORIGIN_X - 6, 16, COLOR_WAVE_PEAK, COLOR_WAVE_RMS);
+    });
+    runner.run("wave_draw_browser", 0, [] {
+        display.drawWaveform(wave, BROWSER_PREVIEW_X, 1, 240 - BROWSER_PREVIEW_X - 2, 20,
+                             COLOR_GRID, COLOR_TEXT_DIM);
+    });
+    runner.run("wave_draw_track_row_from_samples", 0, [] {
+        // O(samples) reference: min/max of every sample under each pixel
+        const int16_t w = DisplayManager<Engine>::Layout::ORIGIN_X - 6, h = 16, mid = 37 + h / 2;
+        for (int16_t px = 0; px < w; px++) {
+            size_t start = waveSamples.size() * px / w, end = waveSamples.size() * (px + 1) / w;
+            int16_t lo = 32767, hi = -32768;
+            for (size_t i = start; i < end; i++) {
+                lo = std::min(lo, waveSamples[i]);
+                hi = std::max(hi, waveSamples[i]);
+            }
+            int16_t top = mid - hi * (h / 2) / 32768, bottom = mid - lo * (h / 2) / 32768;
+            display.canvas.drawFastVLine(2 + px, top, bottom - top + 1, COLOR_WAVE_PEAK);
+        }
+    });
+
+    // Loop analysis at load time (onsets and slice table) and a full WSOLA
+    // render of the same 2 s loop from 120 to 100 BPM; the per-step cost of
+    // slice mode is the table lookup
+    static const LoopSpec breakSpec = {"break_120", 120, 16, 0.0f, true, 0.0f, 0.0f, 11};
+    static SynthLoop breakLoop = synthLoop(breakSpec, BENCH_SAMPLE_RATE);
+    static Slicer slicer;
+    static SliceTable slices;
+    runner.run("slice_analyze_2s", breakLoop.samples.size() * sizeof(int16_t), [] {
+        benchKeep(slicer.analyze(breakLoop.samples.data(), breakLoop.samples.size(),
+                                 BENCH_SAMPLE_RATE, slices));
+    });
+    static uint32_t sliceStep = 0;
+    runner.run("slice_lookup", 0, [] {
+        benchKeep(slices.sliceAt(sliceStep++));
+    });
+    static WsolaStretcher stretcher;
+    static std::vector<int16_t> stretched(
+        WsolaStretcher::stretchedLength(breakLoop.samples.size(), 120.0f, 100.0f));
+    runner.run("wsola_stretch_2s", breakLoop.samples.size() * sizeof(int16_t), [] {
+        stretcher.begin(breakLoop.samples.data(), breakLoop.samples.size(), stretched.data(),
+                        stretched.size(), BENCH_SAMPLE_RATE);
+        while (!stretcher.process(4096)) {
+        }
+        benchKeep(stretched[stretched.size() / 2]);
+    });
+
+    // Recording a pad hit: position, quantize, write step and micro lane.
+    // Hits sweep across the step so every rounding path is taken.
+    static Recorder recorder;
+    recorder.armed = true;
+    recorder.strength = 75;
+    recorder.latencyUs = 40000;
+    static uint32_t hitUs = 0;
+    runner.run("record_hit_quantize", 0, [] {
+        hitUs += 7919;
+        benchKeep(recorder.recordHit(sequencer, hitUs & 3, sequencer.playback.stepStartUs + hitUs % 250000));
+    });
+
+    // Full-frame redraw of the grid, thumbnails of the loaded kit included
+    for (uint8_t i = 0; i < Engine::tracks; i++) display.setSampleWave(i, &audio.samples[i].wave);
+    runner.run("display_draw_all", 0, [] {
+        display.drawAll(sequencer.pattern, sequencer.cursor, sequencer.playback);
+    });
+
+    // The same redraw for the larger engine configurations, every third
+    // step set and the kit's thumbnails repeated down the tracks
+    static Sequencer<Engine8x16> seq8x16;
+    static DisplayManager<Engine8x16> display8x16;
+    static Sequencer<Engine16x32> seq16x32;
+    static DisplayManager<Engine16x32> display16x32;
+    for (uint8_t t = 0; t < Engine16x32::tracks; t++) {
+        if (t < Engine8x16::tracks) display8x16.setSampleWave(t, &audio.samples[t % Engine::tracks].wave);
+        display16x32.setSampleWave(t, &audio.samples[t % Engine::tracks].wave);
+        for (uint8_t s = 0; s < Engine16x32::steps; s++) {
+            if (t < Engine8x16::tracks && s < Engine8x16::steps) seq8x16.pattern.setStep(t, s, (t + s) % 3 == 0);
+            seq16x32.pattern.setStep(t, s, (t + s) % 3 == 0);
+        }
+    }
+    seq8x16.setPatternLength(Engine8x16::steps);
+    seq16x32.setPatternLength(Engine16x32::steps);
+    runner.run("display_draw_all_8x16", 0, [] {
+        display8x16.drawAll(seq8x16.pattern, seq8x16.cursor, seq8x16.playback);
+    });
+    runner.run("display_draw_all_16x32", 0, [] {
+        display16x32.drawAll(seq16x32.pattern, seq16x32.cursor, seq16x32.playback);
+    });
+
+    // Four voices mixed into one output block
+    static std::vector<int16_t> voiceData(BENCH_SAMPLE_FRAMES);
+    for (size_t i = 0; i < voiceData.size(); i++) {
+        voiceData[i] = (int16_t)(sinf(i * 0.0627f) * 20000);
+    }
+    constexpr uint8_t MIX_VOICES = 4;
+    static MixVoice voices[MIX_VOICES];
+    for (uint8_t v = 0; v < MIX_VOICES; v++) {
+        voices[v] = {voiceData.data(), voiceData.size(), v * 997u, 200};
+    }
+    static int16_t block[MIX_BLOCK_FRAMES];
+    runner.run("audio_mix_block_4voice", MIX_BLOCK_FRAMES * sizeof(int16_t), [] {
+        mixBlock(voices, MIX_VOICES, block, MIX_BLOCK_FRAMES);
+        benchKeep(block[0]);
+    });
+
+    // Mono against stereo at four and eight voices: what a stereo output
+    // costs the speaker task per block, so how many voices it leaves room for
+    constexpr uint8_t MIX_VOICES_MAX = 8;
+    static MixVoice monoVoices[MIX_VOICES_MAX];
+    static MixVoice stereoVoices[MIX_VOICES_MAX];
+    static std::vector<int16_t> stereoData(2 * BENCH_SAMPLE_FRAMES);
+    panMono(voiceData.data(), stereoData.data(), BENCH_SAMPLE_FRAMES, panGains(-3));
+    for (uint8_t v = 0; v < MIX_VOICES_MAX; v++) {
+        monoVoices[v] = {voiceData.data(), voiceData.size(), v * 997u, 200};
+        stereoVoices[v] = {stereoData.data(), BENCH_SAMPLE_FRAMES, v * 997u, 200};
+    }
+    static int16_t stereoBlock[2 * MIX_BLOCK_FRAMES];
+    runner.run("audio_mix_block_8voice", MIX_BLOCK_FRAMES * sizeof(int16_t), [] {
+        mixBlock(monoVoices, MIX_VOICES_MAX, block, MIX_BLOCK_FRAMES);
+        benchKeep(block[0]);
+    });
+    runner.run("audio_mix_block_4voice_stereo", 2 * MIX_BLOCK_FRAMES * sizeof(int16_t), [] {
+        mixBlockStereo(stereoVoices, MIX_VOICES, stereoBlock, MIX_BLOCK_FRAMES);
+        benchKeep(stereoBlock[0]);
+    });
+    runner.run("audio_mix_block_8voice_stereo", 2 * MIX_BLOCK_FRAMES * sizeof(int16_t), [] {
+        mixBlockStereo(stereoVoices, MIX_VOICES_MAX, stereoBlock, MIX_BLOCK_FRAMES);
+        benchKeep(stereoBlock[0]);
+    });
+
+    // Pan renders of one second: a mono sample through the pan law and a
+    // stereo one from mid and side, as on load or a pan change
+    static std::vector<int16_t> sideData(BENCH_SAMPLE_FRAMES);
+    for (size_t i = 0; i < sideData.size(); i++) sideData[i] = (int16_t)(voiceData[i] / 4);
+    runner.run("pan_render_1s_mono", BENCH_SAMPLE_FRAMES * sizeof(int16_t), [] {
+        panMono(voiceData.data(), stereoData.data(), BENCH_SAMPLE_FRAMES, panGains(5));
+        benchKeep(stereoData[1]);
+    });
+    runner.run("pan_render_1s_mid_side", 2 * BENCH_SAMPLE_FRAMES * sizeof(int16_t), [] {
+        panMidSide(voiceData.data(), sideData.data(), stereoData.data(), BENCH_SAMPLE_FRAMES,
+                   panBalance(5));
+        benchKeep(stereoData[1]);
+    });
+
+    // First block of four hits on one step, starting at random places in
+    // sample memory too large to stay cached, against the same hits with
+    // their attacks prefetched into internal RAM. The difference is the
+    // PSRAM stall per block that prefetch takes off the mixer.
+    static int16_t* hitPool[MIX_VOICES];
+    static AttackCache<MIX_VOICES> attacks;
+    static const AttackLine* hitLines[MIX_VOICES];
+    static MixVoice hitVoices[MIX_VOICES];
+    static SynthRng hitRng(7);
+    attacks.begin();
+    bool pooled = true;
+    for (uint8_t v = 0; v < MIX_VOICES; v++) {
+        hitPool[v] = (int16_t*)ps_malloc(ATTACK_POOL_FRAMES * sizeof(int16_t));
+        if (!hitPool[v]) {
+            pooled = false;
+            break;
+        }
+        for (size_t i = 0; i < ATTACK_POOL_FRAMES; i++) hitPool[v][i] = voiceData[i % voiceData.size()];
+        attacks.prefetch(v, hitPool[v], ATTACK_POOL_FRAMES);
+        hitLines[v] = attacks.take(v, hitPool[v]);
+    }
+    if (pooled && hitLines[0]) {
+        runner.run("audio_attack_block_4voice_psram", MIX_BLOCK_FRAMES * sizeof(int16_t), [] {
+            for (uint8_t v = 0; v < MIX_VOICES; v++) {
+                size_t start = hitRng.next() % (ATTACK_POOL_FRAMES / MIX_BLOCK_FRAMES) * MIX_BLOCK_FRAMES;
+                hitVoices[v] = {hitPool[v] + start, MIX_BLOCK_FRAMES, 0, 200};
+            }
+            mixBlock(hitVoices, MIX_VOICES, block, MIX_BLOCK_FRAMES);
+            benchKeep(block[0]);
+        });
+        runner.run("audio_attack_block_4voice_prefetched", MIX_BLOCK_FRAMES * sizeof(int16_t), [] {
+            for (uint8_t v = 0; v < MIX_VOICES; v++) {
+                size_t start = hitRng.next() % (ATTACK_FRAMES / MIX_BLOCK_FRAMES) * MIX_BLOCK_FRAMES;
+                hitVoices[v] = {hitLines[v]->data + start, MIX_BLOCK_FRAMES, 0, 200};
+            }
+            mixBlock(hitVoices, MIX_VOICES, block, MIX_BLOCK_FRAMES);
+            benchKeep(block[0]);
+        });
+    }
+}
+
+}  // namespace
+
+#ifdef ARDUINO
+
+void setup() {
+    Serial.begin(115200);
+    auto cfg = M5.config();
+    M5Cardputer.begin(cfg, true);
+    M5Cardputer.Display.setRotation(1);
+    delay(2000);  // Give the host time to open the port
+
+    if (!audio.init()) {
+        Serial.println("SD card required for WAV benchmarks");
+        return;
+    }
+
+    BenchRunner runner;
+    runAll(runner);
+    runner.printJson("esp32s3");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#else
+
+int main(int argc, char** argv) {
+    audio.init();
+
+    BenchRunner runner;
+    if (argc > 1) runner.filter = argv[1];
+    runAll(runner);
+    runner.printJson("host");
+    return 0;
+}
+
+#endif
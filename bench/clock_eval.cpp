@@ -0,0 +1,229 @@
+// Host check of MIDI clock sync (midi.h) on synthetic clock streams with
+// known tick times. Each tick reaches the firmware late by however long
+// the loop takes to poll Serial, modelled as a random delay. Reports as
+// JSON, per stream, over the ticks after the first bar:
+//
+//   raw       tick times as they arrive: mean lateness, its standard
+//             deviation (jitter) and the worst deviation from the mean
+//   filtered  the same for MidiClockSync::getFilteredTickUs(), which step
+//             starts are stamped with once the sync has locked
+//   steps     standard deviation of step lengths (6 ticks) from either,
+//             against the true ones
+//   bpm       tempo the sync settled on against the true one
+//
+// The clock we send is measured the same way: the sequencer runs on its
+// internal clock, MidiClockOut ticks are sent as the main loop does, and
+// the loop wakes for each deadline late by a random delay, sometimes held
+// up by a redraw. For each tempo:
+//
+//   sent      lateness of the ticks we send against the sequencer's grid
+//             divided evenly into 6 ticks per step: mean, jitter, worst
+//   intervals standard deviation of the gaps between sent ticks against
+//             the even gap, and the largest difference in mean gap between
+//             two tick positions within a step (systematic unevenness)
+//
+// Exits non-zero if the filtered times are not steadier than the raw ones
+// on any stream, or any tick position within a step is sent systematically
+// early or late by more than the loop's delay and measurement noise explain.
+//
+//   pio run -e clock_eval && .pio/build/clock_eval/program
+
+#include <Arduino.h>
+#include <cmath>
+#include <cstdio>
+#include "drum_synth.h"
+#include "midi.h"
+#include "sequencer.h"
+
+constexpr double EVAL_SECONDS = 60.0;
+constexpr uint32_t SETTLE_TICKS = 4 * MIDI_PPQN;  // Ticks left out while locking on
+constexpr uint32_t EVAL_START_US = 0xFFFFFFFFu - 20000000u;  // micros() wraps mid-stream
+
+struct ClockStream {
+    const char* name;
+    float bpm;
+    float endBpm;      // Tempo ramps linearly to this over the stream
+    float driftPpm;    // Sender's crystal against ours
+    uint32_t pollUs;   // Delay up to this on every tick
+    float blockShare;  // Share of ticks that wait on a long loop pass
+    uint32_t blockUs;  // ... of up to this (a full redraw)
+    uint32_t seed;
+};
+
+const ClockStream STREAMS[] = {
+    {"steady_120_poll1ms", 120, 120, 0, 1000, 0.0f, 0, 1},
+    {"steady_120_poll5ms", 120, 120, 0, 5000, 0.0f, 0, 2},
+    {"steady_174_poll2ms", 174, 174, 0, 2000, 0.0f, 0, 3},
+    {"redraws_90", 90, 90, 0, 1000, 0.25f, 13000, 4},
+    {"drift_120_1000ppm", 120, 120, 1000, 1000, 0.0f, 0, 5},
+    {"ramp_100_140", 100, 140, 0, 1000, 0.0f, 0, 6},
+};
+
+struct Spread {
+    double sum = 0, sumSq = 0, lo = 1e30, hi = -1e30;
+    uint32_t count = 0;
+
+    void add(double x) {
+        sum += x;
+        sumSq += x * x;
+        lo = x < lo ? x : lo;
+        hi = x > hi ? x : hi;
+        count++;
+    }
+    double mean() const { return count ? sum / count : 0; }
+    double stdDev() const {
+        if (count < 2) return 0;
+        const double m = mean();
+        return sqrt(fmax(0.0, sumSq / count - m * m));
+    }
+    double worst() const { return fmax(hi - mean(), mean() - lo); }
+};
+
+bool evalStream(const ClockStream& s, bool first) {
+    SynthRng rng(s.seed);
+    MidiClockSync sync;
+    Spread raw, filtered, rawSteps, filteredSteps;
+    double trueUs = 0;  // Since the stream started
+    uint32_t tick = 0;
+    uint32_t lastIdealStep = 0, lastRawStep = 0, lastFilteredStep = 0;
+    bool haveStep = false;
+    float bpm = s.bpm;
+
+    while (trueUs < EVAL_SECONDS * 1e6) {
+        bpm = s.bpm + (s.endBpm - s.bpm) * (float)(trueUs / (EVAL_SECONDS * 1e6));
+        trueUs += 60e6 / (bpm * MIDI_PPQN) * (1.0 + s.driftPpm * 1e-6);
+
+        double delay = rng.unit() * s.pollUs;
+        if (s.blockShare > 0 && rng.unit() < s.blockShare) delay += rng.unit() * s.blockUs;
+        const uint32_t idealUs = EVAL_START_US + (uint32_t)llround(trueUs);
+        const uint32_t arrivalUs = idealUs + (uint32_t)llround(delay);
+
+        sync.onTick(arrivalUs);
+        tick++;
+        if (tick <= SETTLE_TICKS || !sync.isLocked()) continue;
+
+        const uint32_t filteredUs = sync.getFilteredTickUs();
+        raw.add((int32_t)(arrivalUs - idealUs));
+        filtered.add((int32_t)(filteredUs - idealUs));
+
+        if (tick % MidiClockOut::TICKS_PER_STEP == 0) {
+            if (haveStep) {
+                const int32_t idealStep = (int32_t)(idealUs - lastIdealStep);
+                rawSteps.add((int32_t)(arrivalUs - lastRawStep) - idealStep);
+                filteredSteps.add((int32_t)(filteredUs - lastFilteredStep) - idealStep);
+            }
+            lastIdealStep = idealUs;
+            lastRawStep = arrivalUs;
+            lastFilteredStep = filteredUs;
+            haveStep = true;
+        }
+    }
+
+    printf("%s    {\"stream\": \"%s\", \"ticks\": %u, "
+           "\"raw_mean_us\": %.1f, \"raw_jitter_us\": %.1f, \"raw_worst_us\": %.1f, "
+           "\"filtered_mean_us\": %.1f, \"filtered_jitter_us\": %.1f, \"filtered_worst_us\": %.1f, "
+           "\"raw_step_jitter_us\": %.1f, \"filtered_step_jitter_us\": %.1f, "
+           "\"bpm\": %.2f, \"expected_bpm\": %.2f}",
+           first ? "" : ",\n", s.name, raw.count, raw.mean(), raw.stdDev(), raw.worst(),
+           filtered.mean(), filtered.stdDev(), filtered.worst(), rawSteps.stdDev(),
+           filteredSteps.stdDev(), sync.getBPM(), bpm / (1.0 + s.driftPpm * 1e-6));
+
+    return filtered.stdDev() < raw.stdDev() && filteredSteps.stdDev() < rawSteps.stdDev();
+}
+
+struct SendStream {
+    const char* name;
+    uint16_t bpm;
+    uint32_t wakeUs;   // The loop wakes up to this late for each deadline
+    float blockShare;  // Share of wakeups held up by a redraw
+    uint32_t blockUs;  // ... of up to this
+    uint32_t seed;
+};
+
+const SendStream SEND_STREAMS[] = {
+    {"send_120", 120, 200, 0.0f, 0, 11},
+    {"send_133", 133, 200, 0.0f, 0, 12},
+    {"send_174", 174, 200, 0.0f, 0, 13},
+    {"send_133_redraws", 133, 200, 0.05f, 5000, 14},
+};
+
+bool evalSend(const SendStream& s, bool first) {
+    SynthRng rng(s.seed);
+    Sequencer<Engine> seq;
+    MidiClockOut clockOut;
+    seq.setBPM(s.bpm);
+    seq.playback.isPlaying = true;
+    seq.playback.stepStartUs = EVAL_START_US;
+    clockOut.onStep(seq.playback.stepStartUs);
+
+    const uint32_t stepUs = seq.playback.stepIntervalUs;
+    const double tickUs = stepUs / (double)MidiClockOut::TICKS_PER_STEP;
+    Spread sent, intervals, position[MidiClockOut::TICKS_PER_STEP];
+    uint32_t nowUs = EVAL_START_US;
+    uint32_t ticks = 0, lastSentUs = 0;
+
+    while (ticks < EVAL_SECONDS * 1e6 / tickUs) {
+        if (seq.update(nowUs)) clockOut.onStep(seq.playback.stepStartUs);
+        while (clockOut.poll(nowUs, stepUs)) {
+            // Ideal: the tick's share of the steps since the start
+            const double idealUs = ticks * tickUs;
+            const double atUs = (double)(nowUs - EVAL_START_US);
+            sent.add(atUs - idealUs);
+            if (ticks > 0) {
+                const double gap = (double)(nowUs - lastSentUs) - tickUs;
+                intervals.add(gap);
+                position[ticks % MidiClockOut::TICKS_PER_STEP].add(gap);
+            }
+            lastSentUs = nowUs;
+            ticks++;
+        }
+
+        // Sleep to the next deadline, as PowerManager would, and wake late
+        uint32_t dueUs = 0, tickDueUs;
+        seq.nextStepDueUs(dueUs);
+        if (clockOut.nextDueUs(stepUs, tickDueUs) && (int32_t)(tickDueUs - dueUs) < 0) dueUs = tickDueUs;
+        uint32_t delay = (uint32_t)(rng.unit() * s.wakeUs);
+        if (s.blockShare > 0 && rng.unit() < s.blockShare) delay += (uint32_t)(rng.unit() * s.blockUs);
+        nowUs = dueUs + delay;
+    }
+
+    double lo = 1e30, hi = -1e30;
+    for (const Spread& p : position) {
+        lo = fmin(lo, p.mean());
+        hi = fmax(hi, p.mean());
+    }
+    printf("%s    {\"stream\": \"%s\", \"ticks\": %u, \"step_us\": %u, "
+           "\"sent_mean_us\": %.1f, \"sent_jitter_us\": %.1f, \"sent_worst_us\": %.1f, "
+           "\"interval_jitter_us\": %.1f, \"position_spread_us\": %.1f}",
+           first ? "" : ",\n", s.name, ticks, (unsigned)stepUs, sent.mean(), sent.stdDev(), sent.worst(),
+           intervals.stdDev(), hi - lo);
+
+    // Evenly spaced: no tick position's mean gap stands out by more than
+    // the wakeup delay and the noise in that mean can account for
+    const double noise = 4 * intervals.stdDev() / sqrt(ticks / (double)MidiClockOut::TICKS_PER_STEP);
+    return hi - lo < s.wakeUs / 2.0 + noise;
+}
+
+int main() {
+    printf("{\n  \"platform\": \"host-eval\",\n  \"clock\": [\n");
+    bool ok = true;
+    bool first = true;
+    for (const ClockStream& s : STREAMS) {
+        if (!evalStream(s, first)) {
+            fprintf(stderr, "%s: filtered ticks no steadier than raw ones\n", s.name);
+            ok = false;
+        }
+        first = false;
+    }
+    printf("\n  ],\n  \"clock_out\": [\n");
+    first = true;
+    for (const SendStream& s : SEND_STREAMS) {
+        if (!evalSend(s, first)) {
+            fprintf(stderr, "%s: sent ticks unevenly spaced within steps\n", s.name);
+            ok = false;
+        }
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+#ifndef DRUM_SYNTH_H
+#define DRUM_SYNTH_H
+
+// Synthetic drum loops with known onsets, for testing and benchmarking
+// onset detection and time-stretch on host. A breakbeat-style pattern of
+// synthesized kick, snare and hat hits, with per-hit velocity, optional
+// swing, ghost notes, a sustained chord underneath and a noise floor.
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct LoopSpec {
+    const char* name;
+    float bpm;
+    uint8_t steps;      // 16th notes in the loop
+    float swing;        // Delay of odd steps, as a fraction of a step
+    bool ghosts;        // Quiet extra snare hits
+    float pad;          // Level of a sustained chord under the drums
+    float noise;        // Level of a white noise floor
+    uint32_t seed;
+};
+
+struct SynthLoop {
+    std::vector<int16_t> samples;
+    std::vector<uint32_t> onsets;    // Frame of every distinct hit time
+    std::vector<uint8_t> onsetSteps; // Loop step of each onset
+    uint32_t sampleRate = 22050;
+};
+
+struct SynthRng {
+    uint32_t state;
+    explicit SynthRng(uint32_t seed) : state(seed ? seed : 1) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    float unit() { return (next() >> 8) / 16777216.0f; }      // 0 to 1
+    float signedUnit() { return unit() * 2.0f - 1.0f; }       // -1 to 1
+};
+
+enum class DrumVoice : uint8_t { Kick, Snare, Hat };
+
+inline void synthHit(std::vector<float>& mix, uint32_t at, DrumVoice voice, float velocity,
+                     uint32_t sampleRate, SynthRng& rng) {
+    const float dt = 1.0f / sampleRate;
+    // Hits fade out over their last 50 ms rather than stop with a click
+    const uint32_t length = (uint32_t)(sampleRate * (voice == DrumVoice::Kick ? 0.6f : 0.4f));
+    const uint32_t fade = sampleRate / 20;
+    float phase = 0, lastNoise = 0;
+    for (uint32_t i = 0; i < length && at + i < mix.size(); i++) {
+        const float t = i * dt;
+        const float gain = i + fade > length ? (float)(length - i) / fade : 1.0f;
+        float v = 0;
+        switch (voice) {
+            case DrumVoice::Kick:
+                phase += 2.0f * (float)M_PI * (50.0f + 110.0f * expf(-t / 0.03f)) * dt;
+                v = sinf(phase) * expf(-t / 0.22f);
+                break;
+            case DrumVoice::Snare:
+                phase += 2.0f * (float)M_PI * 190.0f * dt;
+                v = 0.5f * sinf(phase) * expf(-t / 0.07f) + 0.6f * rng.signedUnit() * expf(-t / 0.11f);
+                break;
+            case DrumVoice::Hat: {
+                const float noise = rng.signedUnit();
+                v = 0.45f * (noise - lastNoise) * expf(-t / 0.025f);  // Differenced: high-passed
+                lastNoise = noise;
+                break;
+            }
+        }
+        mix[at + i] += gain * velocity * v;
+    }
+}
+
+inline SynthLoop synthLoop(const LoopSpec& spec, uint32_t sampleRate) {
+    // Breakbeat: kick and snare parts per bar of 16, hats on 8ths
+    static const char KICK[] = "x.x.......xx....";
+    static const char SNARE[] = "....x.......x...";
+    static const char GHOST[] = ".......x.x.....x";
+
+    SynthLoop loop;
+    loop.sampleRate = sampleRate;
+    const double stepFrames = 15.0 * sampleRate / spec.bpm;
+    const size_t frames = (size_t)(stepFrames * spec.steps + 0.5);
+    std::vector<float> mix(frames, 0.0f);
+    SynthRng rng(spec.seed);
+
+    for (uint8_t s = 0; s < spec.steps; s++) {
+        const uint8_t p = s % 16;
+        const double offset = (s % 2) ? spec.swing * stepFrames : 0.0;
+        const uint32_t at = (uint32_t)(s * stepFrames + offset + 0.5);
+        bool hit = false;
+        if (KICK[p] == 'x') {
+            synthHit(mix, at, DrumVoice::Kick, 0.75f + 0.25f * rng.unit(), sampleRate, rng);
+            hit = true;
+        }
+        if (SNARE[p] == 'x') {
+            synthHit(mix, at, DrumVoice::Snare, 0.75f + 0.25f * rng.unit(), sampleRate, rng);
+            hit = true;
+        }
+        if (spec.ghosts && GHOST[p] == 'x') {
+            synthHit(mix, at, DrumVoice::Snare, 0.25f + 0.1f * rng.unit(), sampleRate, rng);
+            hit = true;
+        }
+        if (s % 2 == 0) {
+            synthHit(mix, at, DrumVoice::Hat, 0.4f + 0.3f * rng.unit(), sampleRate, rng);
+            hit = true;
+        }
+        if (hit) {
+            loop.onsets.push_back(at);
+            loop.onsetSteps.push_back(s);
+        }
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        const float t = (float)i / sampleRate;
+        if (spec.pad > 0) {
+            mix[i] += spec.pad * (sinf(2.0f * (float)M_PI * 220.0f * t) +
+                                  sinf(2.0f * (float)M_PI * 277.2f * t) +
+                                  sinf(2.0f * (float)M_PI * 329.6f * t)) / 3.0f;
+        }
+        if (spec.noise > 0) mix[i] += spec.noise * rng.signedUnit();
+    }
+
+    float peak = 1e-6f;
+    for (float v : mix) peak = fabsf(v) > peak ? fabsf(v) : peak;
+    loop.samples.resize(frames);
+    for (size_t i = 0; i < frames; i++) {
+        loop.samples[i] = (int16_t)(mix[i] / peak * 26000.0f);
+    }
+    return loop;
+}
+
+#endif
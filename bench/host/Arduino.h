@@ -0,0 +1,147 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Minimal Arduino core for host builds of the benchmarks. Only what the
+// headers in src/ actually use is provided.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+
+// Virtual time for deterministic replays (bench/replay.cpp): every read
+// of the clock moves it on by stepUs, and delays jump it forward instead
+// of sleeping. A delay ends early at wakeUs, standing in for the interrupt
+// that would wake the device then. Off by default: real time.
+struct HostClock {
+    bool enabled = false;
+    uint32_t nowUs = 0;
+    uint32_t stepUs = 1;
+    bool wakePending = false;
+    uint32_t wakeUs = 0;
+};
+
+inline HostClock hostClock;
+
+inline uint32_t micros() {
+    if (hostClock.enabled) return hostClock.nowUs += hostClock.stepUs;
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+inline uint32_t millis() { return micros() / 1000; }
+
+inline void delayMicroseconds(uint32_t us) {
+    if (!hostClock.enabled) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+        return;
+    }
+    uint32_t until = hostClock.nowUs + us;
+    if (hostClock.wakePending && (int32_t)(hostClock.wakeUs - hostClock.nowUs) >= 0 &&
+        (int32_t)(until - hostClock.wakeUs) > 0) {
+        until = hostClock.wakeUs;
+    }
+    hostClock.nowUs = until;
+}
+
+// Only replays wait; the benchmarks skip setup delays
+inline void delay(uint32_t ms) {
+    if (hostClock.enabled) delayMicroseconds(ms * 1000);
+}
+
+inline float temperatureRead() { return 40.0f; }
+
+inline void* ps_malloc(size_t size) { return malloc(size); }
+
+class String {
+public:
+    String() {}
+    String(const char* s) : str(s ? s : "") {}
+    String(const std::string& s) : str(s) {}
+    explicit String(int value) : str(std::to_string(value)) {}
+
+    const char* c_str() const { return str.c_str(); }
+    unsigned int length() const { return (unsigned int)str.size(); }
+
+    int lastIndexOf(char c) const {
+        size_t pos = str.rfind(c);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+
+    String substring(unsigned int from) const {
+        return from >= str.size() ? String() : String(str.substr(from));
+    }
+
+    String substring(unsigned int from, unsigned int to) const {
+        if (from >= str.size() || to <= from) return String();
+        return String(str.substr(from, to - from));
+    }
+
+    bool startsWith(const String& prefix) const {
+        return str.compare(0, prefix.str.size(), prefix.str) == 0;
+    }
+
+    bool endsWith(const String& suffix) const {
+        return str.size() >= suffix.str.size() &&
+               str.compare(str.size() - suffix.str.size(), suffix.str.size(), suffix.str) == 0;
+    }
+
+    String operator+(const String& other) const { return String(str + other.str); }
+    friend String operator+(const char* a, const String& b) { return String(a) + b; }
+    bool operator<(const String& other) const { return str < other.str; }
+    bool operator==(const String& other) const { return str == other.str; }
+
+private:
+    std::string str;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        for (size_t i = 0; i < size; i++) write(buffer[i]);
+        return size;
+    }
+};
+
+// Serial goes to stdout so benchmark JSON and logs read the same on host.
+// Input is whatever a replay feeds in; no USB host is ever connected.
+class HostSerial : public Print {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t byte) override { return fputc(byte, stdout) == EOF ? 0 : 1; }
+    using Print::write;
+    explicit operator bool() const { return false; }
+    void feed(uint8_t byte) { input.push_back(byte); }
+    int available() { return (int)input.size(); }
+    int read() {
+        if (input.empty()) return -1;
+        uint8_t byte = input.front();
+        input.pop_front();
+        return byte;
+    }
+    void println(const char* s = "") { printf("%s\n", s); }
+
+    int printf(const char* fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vprintf(fmt, args);
+        va_end(args);
+        return n;
+    }
+
+private:
+    std::deque<uint8_t> input;
+};
+
+inline HostSerial Serial;
+
+#endif
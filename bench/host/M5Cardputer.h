@@ -0,0 +1,365 @@
+#ifndef HOST_M5CARDPUTER_H
+#define HOST_M5CARDPUTER_H
+
+// Host stand-in for M5Cardputer. The canvas renders into a real RGB565
+// framebuffer so drawing benchmarks do comparable per-pixel work; text is
+// drawn as solid 6x8 cells since glyph shapes don't matter for timing.
+// For replays, the display hashes every frame pushed to it, the keyboard
+// takes its state from the session, and the speaker can mix what it is
+// given the way the M5 mixer would (one voice per channel, one more
+// queued behind it) and hash the result.
+
+#include <Arduino.h>
+#include <vector>
+
+enum textdatum_t : uint8_t {
+    TL_DATUM = 0,
+    ML_DATUM = 4,
+    MC_DATUM = 5,
+    MR_DATUM = 6
+};
+
+constexpr uint16_t TFT_BLACK = 0x0000;
+constexpr uint16_t TFT_WHITE = 0xFFFF;
+constexpr uint16_t TFT_RED = 0xF800;
+
+class M5Canvas;
+
+constexpr uint64_t HOST_HASH_SEED = 0xCBF29CE484222325ull;  // FNV-1a
+
+inline uint64_t hostHash(uint64_t hash, const void* data, size_t bytes) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < bytes; i++) hash = (hash ^ p[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+class HostDisplay {
+public:
+    uint32_t pushCount = 0;
+    uint64_t frameHash = HOST_HASH_SEED;  // Of every frame pushed, in order
+
+    // Boot messages are written straight to the panel and not kept
+    void setRotation(uint8_t rotation) { (void)rotation; }
+    void setBrightness(uint8_t brightness) { (void)brightness; }
+    void fillScreen(uint16_t color) { (void)color; }
+    void setTextSize(float size) { (void)size; }
+    void setTextColor(uint16_t color) { (void)color; }
+    void setCursor(int32_t x, int32_t y) { (void)x; (void)y; }
+    void println(const char* text) { (void)text; }
+    int printf(const char* fmt, ...) { (void)fmt; return 0; }
+};
+
+class M5Canvas {
+public:
+    void setColorDepth(int bits) { (void)bits; }
+    void setPsram(bool enabled) { (void)enabled; }
+    size_t bufferLength() const { return pixels.size() * sizeof(uint16_t); }
+
+    bool createSprite(int16_t w, int16_t h) {
+        width = w;
+        height = h;
+        pixels.assign((size_t)w * h, 0);
+        return true;
+    }
+
+    void setTextDatum(uint8_t datum) { textDatum = datum; }
+    void setTextColor(uint16_t color) { textColor = color; }
+    void setTextSize(float size) { (void)size; }
+
+    void fillSprite(uint16_t color) { std::fill(pixels.begin(), pixels.end(), color); }
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+        int32_t x0 = std::max<int32_t>(x, 0), y0 = std::max<int32_t>(y, 0);
+        int32_t x1 = std::min<int32_t>(x + w, width), y1 = std::min<int32_t>(y + h, height);
+        for (int32_t py = y0; py < y1; py++) {
+            std::fill(&pixels[(size_t)py * width + x0], &pixels[(size_t)py * width + x1], color);
+        }
+    }
+
+    void fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color) {
+        (void)r;
+        fillRect(x, y, w, h, color);
+    }
+
+    void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+        fillRect(x, y, w, 1, color);
+        fillRect(x, y + h - 1, w, 1, color);
+        fillRect(x, y, 1, h, color);
+        fillRect(x + w - 1, y, 1, h, color);
+    }
+
+    void drawRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color) {
+        (void)r;
+        drawRect(x, y, w, h, color);
+    }
+
+    void drawFastHLine(int32_t x, int32_t y, int32_t w, uint16_t color) { fillRect(x, y, w, 1, color); }
+    void drawFastVLine(int32_t x, int32_t y, int32_t h, uint16_t color) { fillRect(x, y, 1, h, color); }
+
+    void drawPixel(int32_t x, int32_t y, uint16_t color) {
+        if (x >= 0 && y >= 0 && x < width && y < height) pixels[(size_t)y * width + x] = color;
+    }
+
+    void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                      int32_t x2, int32_t y2, uint16_t color) {
+        int32_t minX = std::min({x0, x1, x2}), maxX = std::max({x0, x1, x2});
+        int32_t minY = std::min({y0, y1, y2}), maxY = std::max({y0, y1, y2});
+        for (int32_t y = minY; y <= maxY; y++) {
+            for (int32_t x = minX; x <= maxX; x++) {
+                int32_t e0 = (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+                int32_t e1 = (x2 - x1) * (y - y1) - (y2 - y1) * (x - x1);
+                int32_t e2 = (x0 - x2) * (y - y2) - (y0 - y2) * (x - x2);
+                if ((e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0)) {
+                    drawPixel(x, y, color);
+                }
+            }
+        }
+    }
+
+    void drawString(const char* text, int32_t x, int32_t y) {
+        int32_t w = (int32_t)strlen(text) * 6;
+        int32_t left = x, top = y;
+        if (textDatum == MC_DATUM) { left -= w / 2; top -= 4; }
+        else if (textDatum == ML_DATUM) { top -= 4; }
+        else if (textDatum == MR_DATUM) { left -= w; top -= 4; }
+        fillRect(left, top, w, 8, textColor);
+    }
+
+    void drawString(const String& text, int32_t x, int32_t y) { drawString(text.c_str(), x, y); }
+
+    void pushSprite(HostDisplay* display, int32_t x, int32_t y) {
+        (void)x; (void)y;
+        display->pushCount++;
+        display->frameHash = hostHash(display->frameHash, pixels.data(), pixels.size() * sizeof(uint16_t));
+    }
+
+    const uint16_t* getBuffer() const { return pixels.data(); }
+
+private:
+    std::vector<uint16_t> pixels;
+    int32_t width = 0;
+    int32_t height = 0;
+    uint8_t textDatum = TL_DATUM;
+    uint16_t textColor = TFT_WHITE;
+};
+
+struct HostSpeakerConfig {
+    uint32_t sample_rate = 48000;
+    size_t dma_buf_len = 256;
+    size_t dma_buf_count = 8;
+    bool stereo = false;
+    int pin_bck = -1;
+    int pin_ws = -1;
+    int pin_data_out = -1;
+};
+
+constexpr uint8_t HOST_SPEAKER_CHANNELS = 8;
+
+class HostSpeaker {
+public:
+    uint32_t playCount = 0;
+
+    // Mixer model, off unless a replay turns it on
+    bool mixing = false;
+    uint64_t mixedFrames = 0;
+    uint64_t mixHash = HOST_HASH_SEED;  // Of every output frame, in order
+    uint64_t mixNs = 0;                 // Host time spent mixing
+
+    HostSpeakerConfig config() const { return cfg; }
+    void config(const HostSpeakerConfig& c) { cfg = c; }
+
+    bool begin() { return true; }
+    void setVolume(uint8_t volume) { (void)volume; }
+
+    void stop() {
+        for (uint8_t ch = 0; ch < HOST_SPEAKER_CHANNELS; ch++) stop(ch);
+    }
+
+    void stop(uint8_t channel) {
+        mixUntil(micros());
+        if (channel < HOST_SPEAKER_CHANNELS) channels[channel].queued = 0;
+    }
+
+    bool isPlaying() {
+        mixUntil(micros());
+        for (const Channel& c : channels) {
+            if (c.queued) return true;
+        }
+        return false;
+    }
+
+    // 0 idle, 1 playing with room to queue, 2 playing with a sound queued
+    size_t isPlaying(uint8_t channel) {
+        mixUntil(micros());
+        return channel < HOST_SPEAKER_CHANNELS ? channels[channel].queued : 0;
+    }
+
+    bool tone(float frequency, uint32_t durationMs) { (void)frequency; (void)durationMs; return true; }
+
+    bool playRaw(const int16_t* data, size_t length, uint32_t sampleRate, bool stereo = false,
+                 uint32_t repeat = 1, int channel = -1, bool stopCurrent = false) {
+        (void)repeat;
+        playCount++;
+        if (!mixing || channel < 0 || channel >= HOST_SPEAKER_CHANNELS || length == 0) return true;
+        mixUntil(micros());
+        Channel& c = channels[channel];
+        if (stopCurrent) c.queued = 0;
+        if (c.queued == 2) return false;
+        Voice& v = c.voices[c.queued++];
+        v.data = data;
+        v.length = stereo ? length / 2 : length;
+        v.stereo = stereo;
+        v.step = ((uint64_t)sampleRate << 32) / cfg.sample_rate;
+        if (c.queued == 1) c.position = 0;
+        return true;
+    }
+
+    // Mixes every output frame due by nowUs
+    void mixUntil(uint32_t nowUs) {
+        if (!mixing) return;
+        if (!started) {
+            started = true;
+            lastUs = nowUs;
+            return;
+        }
+        const uint32_t elapsedUs = nowUs - lastUs;
+        lastUs = nowUs;
+        const uint32_t rate = cfg.sample_rate;
+        owedUs += (uint64_t)elapsedUs * rate;
+        uint64_t frames = owedUs / 1000000;
+        owedUs -= frames * 1000000;
+
+        auto start = std::chrono::steady_clock::now();
+        for (; frames > 0; frames--) {
+            int32_t sum = 0, right = 0;  // sum is the left side on a stereo output
+            for (Channel& c : channels) {
+                if (c.queued == 0) continue;
+                const Voice& v = c.voices[0];
+                const size_t i = c.position >> 32;
+                if (!v.stereo) {
+                    sum += v.data[i];
+                    right += v.data[i];
+                } else if (cfg.stereo) {
+                    sum += v.data[2 * i];
+                    right += v.data[2 * i + 1];
+                } else {
+                    sum += (v.data[2 * i] + v.data[2 * i + 1]) / 2;
+                }
+                c.position += v.step;
+                if ((c.position >> 32) >= v.length) {
+                    c.voices[0] = c.voices[1];
+                    c.queued--;
+                    c.position = 0;
+                }
+            }
+            const int16_t out = (int16_t)(sum > 32767 ? 32767 : (sum < -32768 ? -32768 : sum));
+            mixHash = hostHash(mixHash, &out, sizeof(out));
+            if (cfg.stereo) {
+                const int16_t outR = (int16_t)(right > 32767 ? 32767 : (right < -32768 ? -32768 : right));
+                mixHash = hostHash(mixHash, &outR, sizeof(outR));
+            }
+            mixedFrames++;
+        }
+        mixNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    struct Voice {
+        const int16_t* data = nullptr;
+        size_t length = 0;  // Frames
+        bool stereo = false;  // Interleaved
+        uint64_t step = 0;  // Source frames per output frame, 32.32
+    };
+
+    struct Channel {
+        Voice voices[2];      // Playing, then queued
+        uint8_t queued = 0;
+        uint64_t position = 0;  // In the playing voice, 32.32
+    };
+
+    HostSpeakerConfig cfg;
+    Channel channels[HOST_SPEAKER_CHANNELS];
+    bool started = false;
+    uint32_t lastUs = 0;
+    uint64_t owedUs = 0;  // Microsecond-frames not yet mixed
+};
+
+struct Point2D_t {
+    int x;
+    int y;
+};
+
+// Keyboard state is set by a replay and takes effect at the next update(),
+// as a scan of the matrix would
+class Keyboard_Class {
+public:
+    struct KeysState {
+        std::vector<char> word;
+        bool enter = false;
+        bool del = false;
+    };
+
+    void setKeys(const std::vector<char>& held, const KeysState& state) {
+        pendingKeys = held;
+        pendingState = state;
+        pending = true;
+    }
+
+    void update() {
+        changed = pending;
+        if (pending) {
+            keys = pendingKeys;
+            current = pendingState;
+            pending = false;
+        }
+    }
+
+    bool isChange() const { return changed; }
+    bool isPressed() const { return !keys.empty(); }
+
+    bool isKeyPressed(char c) const {
+        return std::find(keys.begin(), keys.end(), c) != keys.end();
+    }
+
+    KeysState keysState() const { return current; }
+
+    std::vector<Point2D_t> keyList() const {
+        std::vector<Point2D_t> list;
+        for (size_t i = 0; i < keys.size(); i++) list.push_back({(int)i, 0});
+        return list;
+    }
+
+    char getKey(Point2D_t pos) const { return keys[pos.x]; }
+
+private:
+    std::vector<char> keys;
+    KeysState current;
+    std::vector<char> pendingKeys;
+    KeysState pendingState;
+    bool pending = false;
+    bool changed = false;
+};
+
+struct HostM5Config {
+    bool internal_spk = false;
+};
+
+struct HostM5 {
+    HostM5Config config() const { return HostM5Config(); }
+};
+
+inline HostM5 M5;
+
+struct HostCardputer {
+    HostDisplay Display;
+    HostSpeaker Speaker;
+    Keyboard_Class Keyboard;
+
+    void begin(const HostM5Config& cfg, bool enableKeyboard) { (void)cfg; (void)enableKeyboard; }
+    void update() { Keyboard.update(); }
+};
+
+inline HostCardputer M5Cardputer;
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef HOST_SD_H
+#define HOST_SD_H
+
+// In-memory SD card for host builds. Benchmarks register file contents with
+// SD.addFile(); directories are implied by the paths. Like FAT, opening a
+// directory is cheap and openNextFile() walks it one entry at a time.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+class File {
+public:
+    File() {}
+
+    File(const std::string& path, std::shared_ptr<const std::vector<uint8_t>> data)
+        : path(path), data(std::move(data)), valid(true) {}
+
+    // Directory whose entries are the keys starting with prefix
+    File(const std::string& path, const std::string& prefix)
+        : path(path), prefix(prefix), directory(true), valid(true) {}
+
+    // New file that is stored when closed
+    explicit File(const std::string& path)
+        : path(path), written(std::make_shared<std::vector<uint8_t>>()), valid(true) {}
+
+    explicit operator bool() const { return valid; }
+
+    size_t write(const uint8_t* buffer, size_t size) {
+        if (!written) return 0;
+        written->insert(written->end(), buffer, buffer + size);
+        return size;
+    }
+
+    size_t read(uint8_t* buffer, size_t size) {
+        if (!data || pos >= data->size()) return 0;
+        size_t n = std::min(size, data->size() - pos);
+        simulateLatency(n);
+        memcpy(buffer, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+
+    bool seek(uint32_t newPos) {
+        if (!data || newPos > data->size()) return false;
+        pos = newPos;
+        return true;
+    }
+
+    size_t position() const { return pos; }
+    size_t size() const { return data ? data->size() : 0; }
+    int available() const { return data ? (int)(data->size() - pos) : 0; }
+    bool isDirectory() const { return directory; }
+    const char* name() const { return path.c_str(); }
+    void close();
+
+    File openNextFile();
+    void rewindDirectory() { lastChild.clear(); }
+
+private:
+    void simulateLatency(size_t bytes);
+
+    std::string path;
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    std::shared_ptr<std::vector<uint8_t>> written;
+    std::string prefix;
+    std::string lastChild;
+    size_t pos = 0;
+    bool directory = false;
+    bool valid = false;
+};
+
+class SDClass {
+public:
+    bool begin(uint8_t cs, SPIClass& spi, uint32_t frequency) {
+        (void)cs; (void)spi;
+        this->frequency = frequency;
+        return true;
+    }
+
+    void end() {}
+
+    // Simulated card timing for read(): fixed command latency per call
+    // plus transfer time at bitsPerClock bits per SPI clock. Zero disables.
+    void setSimulatedLatency(uint32_t perReadUs, float bitsPerClock = 1.0f) {
+        readLatencyUs = perReadUs;
+        this->bitsPerClock = bitsPerClock;
+    }
+
+    void addFile(const std::string& path, std::vector<uint8_t> contents) {
+        files[path] = std::make_shared<const std::vector<uint8_t>>(std::move(contents));
+    }
+
+    void clear() { files.clear(); }
+
+    File open(const char* path, const char* mode = FILE_READ) {
+        std::string p = path;
+        if (p.empty() || p[0] != '/') p = "/" + p;
+        if (strcmp(mode, FILE_WRITE) == 0) return File(p);
+        if (strcmp(mode, FILE_APPEND) == 0) {
+            File file(p);
+            auto it = files.find(p);
+            if (it != files.end()) file.write(it->second->data(), it->second->size());
+            return file;
+        }
+
+        auto it = files.find(p);
+        if (it != files.end()) return File(p, it->second);
+
+        // Directory: exists if anything lives under it
+        std::string prefix = (p == "/") ? "/" : p + "/";
+        auto child = files.lower_bound(prefix);
+        bool empty = child == files.end() || child->first.compare(0, prefix.size(), prefix) != 0;
+        if (empty && p != "/") return File();
+        return File(p, prefix);
+    }
+
+    bool exists(const char* path) { return (bool)open(path); }
+    bool mkdir(const char* path) { (void)path; return true; }  // Directories are implied
+
+private:
+    friend class File;
+    uint32_t frequency = 0;
+    uint32_t readLatencyUs = 0;
+    float bitsPerClock = 1.0f;
+    std::map<std::string, std::shared_ptr<const std::vector<uint8_t>>> files;
+};
+
+inline SDClass SD;
+
+inline void File::simulateLatency(size_t bytes) {
+    if (SD.readLatencyUs == 0) return;
+    double transferUs = bytes * 8.0 / SD.bitsPerClock / (SD.frequency / 1e6);
+    std::this_thread::sleep_for(std::chrono::microseconds(
+        SD.readLatencyUs + (uint64_t)transferUs));
+}
+
+inline void File::close() {
+    if (valid && written) SD.addFile(path, std::move(*written));
+    written.reset();
+    valid = false;
+}
+
+inline File File::openNextFile() {
+    if (!directory) return File();
+
+    // First key past the previous child and everything under it
+    auto it = lastChild.empty() ? SD.files.lower_bound(prefix) : SD.files.upper_bound(lastChild);
+    if (it != SD.files.end() && !lastChild.empty() &&
+        it->first.compare(0, lastChild.size() + 1, lastChild + "/") == 0) {
+        it = SD.files.lower_bound(lastChild + "0");  // '0' follows '/'
+    }
+    if (it == SD.files.end() || it->first.compare(0, prefix.size(), prefix) != 0) return File();
+
+    size_t slash = it->first.find('/', prefix.size());
+    lastChild = it->first.substr(0, slash);
+    return SD.open(lastChild.c_str());
+}
+
+#endif
@@ -0,0 +1,309 @@
+// Host simulation of the event-driven main loop. Runs the real Sequencer,
+// MidiClockOut and PowerManager against a virtual microsecond clock and a
+// cost model of the loop's work, and reports how late hard deadlines
+// (steps, micro-timed triggers, MIDI clock out) are reached and how much of
+// the time the CPU could idle, per scenario and scheduling policy:
+//
+//   busy_poll   the old loop: no blocking, redraw whenever due
+//   block       block until the next deadline, redraw whenever due
+//   block_defer block, and hold a redraw back if it would overrun a deadline
+//
+// Costs are estimates for the Cardputer, not measurements: the CPU part
+// scales with the clock, SPI and I2C transfers don't.
+//
+//   pio run -e power_sim && .pio/build/power_sim/program
+
+#include <Arduino.h>
+#include <cmath>
+#include <cstdio>
+#include "midi.h"
+#include "power.h"
+#include "sequencer.h"
+
+constexpr uint32_t LOOP_BASE_US = 60;      // Keyboard read over I2C, polling
+constexpr uint32_t TRIGGER_CPU_US = 25;    // playRaw() per triggered sample
+constexpr uint32_t PREFETCH_CPU_US = 8;    // Copying a 1 KB attack out of PSRAM
+constexpr uint32_t PREFETCH_AHEAD_US = 5333;  // One 256-frame mixer block at 48 kHz
+constexpr uint32_t KEY_CPU_US = 100;       // Handling one key event
+constexpr uint32_t DRAW_CPU_US = 2500;     // Rendering the canvas at 240 MHz
+constexpr uint32_t DRAW_PUSH_US = 13000;   // 64.8 KB to the LCD over 40 MHz SPI
+constexpr uint32_t TIMER_JITTER_MIN_US = 15;   // esp_timer dispatch to task running
+constexpr uint32_t TIMER_JITTER_MAX_US = 60;
+constexpr uint32_t SLEEP_WAKE_MIN_US = 300;    // Light-sleep exit
+constexpr uint32_t SLEEP_WAKE_MAX_US = 1000;
+constexpr uint32_t SLEEP_MIN_US = 2000;        // Shorter waits don't enter light sleep
+constexpr uint32_t DISPLAY_UPDATE_US = 50000;
+constexpr uint32_t DISPLAY_MAX_DEFER_US = 200000;
+
+enum class Policy : uint8_t { BusyPoll, Block, BlockDefer };
+const char* const POLICY_NAMES[] = {"busy_poll", "block", "block_defer"};
+
+struct Scenario {
+    const char* name;
+    uint16_t bpm;
+    bool playing;
+    bool microTiming;    // Swing and flams off the grid
+    bool midiOut;        // Sending 24 PPQN clock
+    float keysPerSec;
+    float celsius;       // Chip temperature (thermal cap above the limit)
+    uint32_t seconds;
+};
+
+const Scenario SCENARIOS[] = {
+    {"play_120", 120, true, false, false, 2.0f, 45.0f, 20},
+    {"play_240_micro", 240, true, true, false, 2.0f, 45.0f, 20},
+    {"play_120_midi_out", 120, true, true, true, 1.0f, 45.0f, 20},
+    {"play_240_midi_out", 240, true, true, true, 1.0f, 45.0f, 20},
+    {"play_240_hot", 240, true, true, false, 2.0f, 80.0f, 20},
+    {"stopped_editing", 120, false, false, false, 3.0f, 45.0f, 20},
+    {"stopped_idle", 120, false, false, false, 0.0f, 45.0f, 60},
+};
+
+struct Rng {
+    uint32_t state = 2463534242u;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    uint32_t range(uint32_t lo, uint32_t hi) { return lo + next() % (hi - lo + 1); }
+    float unit() { return (next() >> 8) / 16777216.0f; }
+};
+
+struct SimResult {
+    uint32_t hardEvents = 0;
+    uint32_t lateMaxUs = 0;
+    uint64_t lateSumUs = 0;
+    uint32_t lateCount = 0;
+    uint32_t keyLatencyMaxUs = 0;
+    uint32_t draws = 0;
+    uint32_t triggers = 0;
+    uint32_t prefetched = 0;  // Triggers whose attack was copied ahead
+    uint64_t blockedUs = 0;
+    uint64_t spinUs = 0;
+    uint32_t wakeups = 0;
+    uint64_t stateUs[POWER_STATE_COUNT] = {0};
+};
+
+class Simulation {
+public:
+    Simulation(const Scenario& scenario, Policy policy) : sc(scenario), policy(policy) {}
+
+    SimResult run() {
+        seq.init();
+        seq.setBPM(sc.bpm);
+        for (uint8_t i = 0; i < Engine::steps; i++) {
+            seq.pattern.setStep(0, i, i % 4 == 0);
+            seq.pattern.setStep(1, i, i % 4 == 2);
+            seq.pattern.setStep(2, i, true);
+            if (sc.microTiming) {
+                seq.pattern.setMicro(2, i, i % 2 ? 24 : 0);  // Swung hats
+                if (i % 4 == 2) {
+                    seq.pattern.setStep(3, i, true);
+                    seq.pattern.setMicro(3, i, -8);          // Flam ahead of the snare
+                }
+            }
+        }
+        drawCostUs = cpu(DRAW_CPU_US) + DRAW_PUSH_US;
+        if (sc.playing) {
+            seq.playback.isPlaying = true;
+            seq.playback.stepStartUs = t;
+            if (sc.midiOut) clockOut.onStep(t);
+            fireStep();
+        }
+        power.updateThermal(sc.celsius);
+        if (sc.keysPerSec > 0) nextKeyUs = nextKeyAfter(t);
+
+        const uint64_t endUs = (uint64_t)sc.seconds * 1000000;
+        while (elapsed < endUs) cycle();
+
+        for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+            result.blockedUs += power.stats[i].blockedUs;
+            result.spinUs += power.stats[i].spinUs;
+            result.wakeups += power.stats[i].wakeups;
+        }
+        return result;
+    }
+
+private:
+    const Scenario& sc;
+    Policy policy;
+    Sequencer<Engine> seq;
+    MidiClockOut clockOut;
+    PowerManager power;
+    Rng rng;
+    SimResult result;
+    uint32_t t = 1000;        // Virtual micros(), not starting at zero
+    uint64_t elapsed = 0;
+    uint32_t nextKeyUs = 0;
+    uint32_t lastActivityUs = 0;
+    uint32_t lastDrawUs = 0;
+    uint32_t drawCostUs = 0;  // Set by the redraw at boot, before playback starts
+    uint32_t prefetchedStep[Engine::tracks] = {0};  // Step number + 1 of each track's copy
+    bool needsRedraw = true;
+
+    uint32_t cpu(uint32_t us240) const { return us240 * 240 / power.activeMhz; }
+
+    void advance(uint32_t us) {
+        t += us;
+        elapsed += us;
+        result.stateUs[(uint8_t)power.state()] += us;
+    }
+
+    uint32_t nextKeyAfter(uint32_t from) {
+        float gap = -logf(1.0f - rng.unit()) / sc.keysPerSec;
+        return from + (uint32_t)(gap * 1e6f);
+    }
+
+    void late(uint32_t dueUs) {
+        uint32_t lateUs = (int32_t)(t - dueUs) > 0 ? t - dueUs : 0;
+        result.hardEvents++;
+        result.lateSumUs += lateUs;
+        if (lateUs > result.lateMaxUs) result.lateMaxUs = lateUs;
+        if (lateUs > POWER_LATE_US) result.lateCount++;
+    }
+
+    void fireTriggers() {
+        uint32_t dueUs;
+        while (seq.triggers.nextDueUs(dueUs) && (int32_t)(t - dueUs) >= 0) {
+            late(dueUs);
+            seq.triggers.fireDue(dueUs, [this](uint8_t track, uint8_t step) {
+                result.triggers++;
+                if (prefetchedStep[track] == seq.stepNumber(step) + 1) result.prefetched++;
+                advance(cpu(TRIGGER_CPU_US));
+            });
+        }
+    }
+
+    void fireStep() {
+        seq.scheduleStep();
+        fireTriggers();
+        needsRedraw = true;
+    }
+
+    // One pass of loop(), in the order main.cpp does it
+    void cycle() {
+        advance(LOOP_BASE_US);
+
+        if (sc.keysPerSec > 0 && (int32_t)(t - nextKeyUs) >= 0) {
+            uint32_t latency = t - nextKeyUs;
+            if (latency > result.keyLatencyMaxUs) result.keyLatencyMaxUs = latency;
+            advance(cpu(KEY_CPU_US));
+            nextKeyUs = nextKeyAfter(t);
+            lastActivityUs = t;
+            needsRedraw = true;
+        }
+
+        uint32_t dueUs;
+        if (seq.nextStepDueUs(dueUs) && seq.update(t)) {
+            late(dueUs);
+            if (sc.midiOut) clockOut.onStep(seq.playback.stepStartUs);
+            fireStep();
+        }
+        fireTriggers();
+        while (clockOut.nextDueUs(seq.playback.stepIntervalUs, dueUs) && (int32_t)(t - dueUs) >= 0) {
+            late(dueUs);
+            clockOut.poll(t, seq.playback.stepIntervalUs);
+        }
+
+        prefetch();
+
+        if (seq.nextStepDueUs(dueUs)) power.hardDeadline(dueUs);
+        if (seq.triggers.nextDueUs(dueUs)) power.hardDeadline(dueUs);
+        if (clockOut.nextDueUs(seq.playback.stepIntervalUs, dueUs)) power.hardDeadline(dueUs);
+
+        updateDisplay();
+
+        PowerState state = sc.playing ? PowerState::Playing
+            : t - lastActivityUs >= POWER_IDLE_AFTER_MS * 1000 ? PowerState::Idle
+            : PowerState::Stopped;
+        power.setState(state, !sc.playing);
+        power.softDeadline(t + power.profile().scanUs);
+
+        if (policy == Policy::BusyPoll) {
+            power.finishWait(power.plan(t), t, t, t);
+        } else {
+            wait();
+        }
+    }
+
+    // Attack copies for triggers due within a block, as main.cpp's
+    // prefetchUpcoming()
+    void prefetch() {
+        if (policy == Policy::BusyPoll) return;
+        seq.forEachUpcoming(t, PREFETCH_AHEAD_US, [this](uint8_t track, uint32_t stepNumber) {
+            if (prefetchedStep[track] == stepNumber + 1) return;
+            prefetchedStep[track] = stepNumber + 1;
+            advance(cpu(PREFETCH_CPU_US));
+        });
+        uint32_t dueUs;
+        if (seq.nextStepDueUs(dueUs) && (int32_t)(dueUs - PREFETCH_AHEAD_US - t) > 0) {
+            power.softDeadline(dueUs - PREFETCH_AHEAD_US);
+        }
+    }
+
+    void updateDisplay() {
+        if (!needsRedraw) return;
+        uint32_t sinceUs = t - lastDrawUs;
+        if (sinceUs < DISPLAY_UPDATE_US) {
+            power.softDeadline(lastDrawUs + DISPLAY_UPDATE_US);
+            return;
+        }
+        if (policy == Policy::BlockDefer && !power.fits(t, drawCostUs) &&
+            sinceUs < DISPLAY_MAX_DEFER_US) {
+            return;
+        }
+        lastDrawUs = t;
+        needsRedraw = false;
+        uint32_t cost = cpu(DRAW_CPU_US) + DRAW_PUSH_US;
+        advance(cost);
+        uint32_t decayed = drawCostUs - drawCostUs / 8;
+        drawCostUs = cost > decayed ? cost : decayed;
+        result.draws++;
+    }
+
+    // PowerManager::wait() with the blocking replaced by the wake-up model
+    void wait() {
+        uint32_t start = t;
+        PowerPlan p = power.plan(start);
+        uint32_t sleepUs = p.sleepUntilUs - start;
+        if (sleepUs > 0) {
+            uint32_t wakeUs = sleepUs + rng.range(TIMER_JITTER_MIN_US, TIMER_JITTER_MAX_US);
+            if (power.sleepAllowed && sleepUs >= SLEEP_MIN_US) {
+                wakeUs += rng.range(SLEEP_WAKE_MIN_US, SLEEP_WAKE_MAX_US);
+            }
+            advance(wakeUs);
+        }
+        uint32_t blockEnd = t;
+        if (p.spin && (int32_t)(t - p.spinUntilUs) < 0) advance(p.spinUntilUs - t);
+        power.finishWait(p, start, blockEnd, t);
+    }
+};
+
+int main() {
+    printf("{\n  \"platform\": \"host-sim\",\n  \"results\": [\n");
+    const size_t count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+    for (size_t i = 0; i < count; i++) {
+        for (uint8_t pol = 0; pol < 3; pol++) {
+            const Scenario& sc = SCENARIOS[i];
+            SimResult r = Simulation(sc, (Policy)pol).run();
+            double totalUs = sc.seconds * 1e6;
+            printf("    {\"scenario\": \"%s\", \"policy\": \"%s\", \"cpu_idle_pct\": %.1f, "
+                   "\"spin_pct\": %.2f, \"wakeups_per_s\": %.0f, \"hard_deadlines\": %u, "
+                   "\"late_mean_us\": %.1f, \"late_max_us\": %u, \"late_over_%uus\": %u, "
+                   "\"key_latency_max_us\": %u, \"draws\": %u, \"prefetched_pct\": %.1f, "
+                   "\"seconds_playing\": %.1f, \"seconds_stopped\": %.1f, \"seconds_idle\": %.1f}%s\n",
+                   sc.name, POLICY_NAMES[pol], 100.0 * r.blockedUs / totalUs,
+                   100.0 * r.spinUs / totalUs, r.wakeups / (double)sc.seconds,
+                   (unsigned)r.hardEvents, r.hardEvents ? (double)r.lateSumUs / r.hardEvents : 0.0,
+                   (unsigned)r.lateMaxUs, (unsigned)POWER_LATE_US, (unsigned)r.lateCount,
+                   (unsigned)r.keyLatencyMaxUs, (unsigned)r.draws,
+                   r.triggers ? 100.0 * r.prefetched / r.triggers : 0.0,
+                   r.stateUs[0] / 1e6, r.stateUs[1] / 1e6, r.stateUs[2] / 1e6,
+                   i + 1 < count || pol < 2 ? "," : "");
+        }
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Host check of live recording (recorder.h) on scripted hit timelines.
+// Each case plays the pattern at 120 BPM from a fixed time, replays its
+// hits at musical positions (in steps from the start; the key is seen
+// latencyUs later, as if the player lined it up with what they heard),
+// and runs the sequencer the way the main loop does: update, scheduleStep
+// and fireDue every millisecond.
+//
+// For every expected hit it asserts the step written, its micro-timing
+// value, and the first pass of the pattern on which the sequencer plays
+// it. The live hit has already sounded, so a recorded step must not play
+// again on the pass it was played on; snapped forward onto the step about
+// to start, that takes skipOnNextStep. After its first pass a recorded
+// step must play on every pass, and no step outside the script may be set.
+// Reports as JSON and exits non-zero if any case fails.
+//
+//   pio run -e record_check && .pio/build/record_check/program
+
+#include <Arduino.h>
+#include <cstdio>
+#include "recorder.h"
+
+using CheckConfig = Engine4x8;
+
+constexpr uint16_t CHECK_BPM = 120;
+constexpr uint32_t CHECK_START_US = 0xFFFFFFFFu - 1500000u;  // micros() wraps mid-case
+constexpr uint8_t CHECK_PASSES = 4;
+constexpr uint8_t MAX_HITS = 3;
+
+struct Hit {
+    uint8_t track;
+    float position;  // As played, in steps from the start
+    // Expected outcome
+    uint8_t step;
+    int8_t micro;
+    uint8_t firstPass;  // Pass of the pattern it first plays on
+};
+
+struct RecordCase {
+    const char* name;
+    uint8_t strength;
+    uint32_t latencyUs;
+    uint8_t length;
+    Hit hits[MAX_HITS];
+    uint8_t hitCount;
+};
+
+const RecordCase CASES[] = {
+    // 0.3 of a step late, snapped fully, half way and not at all
+    {"strength_100_late", 100, 0, 8, {{0, 2.3f, 2, 0, 1}}, 1},
+    {"strength_50_late", 50, 0, 8, {{0, 2.3f, 2, 14, 1}}, 1},
+    {"strength_0_late", 0, 0, 8, {{0, 2.3f, 2, 29, 1}}, 1},
+    // A quarter step early: snapped fully it lands on the step about to
+    // start, which must skip it this pass; kept early, its trigger was
+    // queued before the hit and doesn't play this pass either
+    {"strength_100_early_skips", 100, 0, 8, {{1, 2.75f, 3, 0, 1}}, 1},
+    {"strength_50_early", 50, 0, 8, {{1, 2.75f, 3, -12, 1}}, 1},
+    {"strength_0_early", 0, 0, 8, {{1, 2.75f, 3, -24, 1}}, 1},
+    // Keys seen 30 ms and 80 ms late are moved back to where they were
+    // played; uncompensated, the second would land on step 6
+    {"latency_30ms", 0, 30000, 8, {{2, 4.1f, 4, 10, 1}, {3, 5.8f, 6, -19, 1}}, 2},
+    {"latency_80ms", 100, 80000, 8, {{2, 4.9f, 5, 0, 1}}, 1},
+    // Snapped past the last step onto step 0 of the next pass, which must
+    // skip it; kept early, it first plays a pass later too
+    {"wrap_last_step", 100, 0, 8, {{0, 7.7f, 0, 0, 2}, {1, 7.9f, 0, 0, 2}}, 2},
+    {"wrap_last_step_unquantized", 0, 0, 8, {{0, 7.9f, 0, -10, 2}}, 1},
+    {"wrap_short_pattern", 100, 0, 6, {{0, 5.6f, 0, 0, 2}}, 1},
+    // Played just before the wrap, seen just after it
+    {"wrap_latency", 100, 30000, 8, {{3, 7.9f, 0, 0, 2}}, 1},
+};
+
+bool runCase(const RecordCase& c, bool first) {
+    Sequencer<CheckConfig> seq;
+    Recorder recorder;
+    recorder.armed = true;
+    recorder.strength = c.strength;
+    recorder.latencyUs = c.latencyUs;
+    seq.setBPM(CHECK_BPM);
+    seq.setPatternLength(c.length);
+    seq.togglePlay();
+    seq.playback.stepStartUs = CHECK_START_US;
+    seq.scheduleStep();
+
+    const uint32_t stepUs = seq.playback.stepIntervalUs;
+    uint32_t playedPasses[CheckConfig::tracks][CheckConfig::steps] = {};
+    int8_t written[MAX_HITS];
+    uint8_t nextHit = 0;
+
+    for (uint32_t t = 0; seq.playback.stepCount < (uint32_t)CHECK_PASSES * c.length; t += 1000) {
+        const uint32_t nowUs = CHECK_START_US + t;
+        if (seq.update(nowUs)) seq.scheduleStep();
+        // Hits keep their exact times; none is within a millisecond of a step start
+        while (nextHit < c.hitCount) {
+            const uint32_t seenUs = (uint32_t)(c.hits[nextHit].position * stepUs) + c.latencyUs;
+            if (t < seenUs) break;
+            written[nextHit] = recorder.recordHit(seq, c.hits[nextHit].track, CHECK_START_US + seenUs);
+            nextHit++;
+        }
+        seq.triggers.fireDue(nowUs, [&](uint8_t track, uint8_t step) {
+            playedPasses[track][step] |= 1u << (seq.stepNumber(step) / c.length);
+        });
+    }
+
+    bool ok = nextHit == c.hitCount;
+    bool expected[CheckConfig::tracks][CheckConfig::steps] = {};
+    printf("%s    {\"case\": \"%s\", \"hits\": [", first ? "" : ",\n", c.name);
+    for (uint8_t i = 0; i < c.hitCount; i++) {
+        const Hit& h = c.hits[i];
+        const uint32_t passes = playedPasses[h.track][h.step] & ((1u << CHECK_PASSES) - 1);
+        const uint32_t wantPasses = ((1u << CHECK_PASSES) - 1) & ~((1u << h.firstPass) - 1);
+        const int8_t micro = seq.pattern.getMicro(h.track, h.step);
+        const bool pass = i < nextHit && written[i] == h.step && seq.pattern.getStep(h.track, h.step) &&
+                          micro == h.micro && passes == wantPasses;
+        printf("%s{\"track\": %u, \"step\": %d, \"expected_step\": %u, \"micro\": %d, "
+               "\"expected_micro\": %d, \"played_passes\": \"0x%x\", \"expected_passes\": \"0x%x\", "
+               "\"pass\": %s}",
+               i ? ", " : "", h.track, i < nextHit ? written[i] : -1, h.step, micro, h.micro,
+               (unsigned)passes, (unsigned)wantPasses, pass ? "true" : "false");
+        expected[h.track][h.step] = true;
+        ok &= pass;
+    }
+    uint8_t stray = 0;
+    for (uint8_t track = 0; track < CheckConfig::tracks; track++) {
+        for (uint8_t step = 0; step < CheckConfig::steps; step++) {
+            if (seq.pattern.getStep(track, step) && !expected[track][step]) stray++;
+        }
+    }
+    printf("], \"stray_steps\": %u, \"pass\": %s}", stray, ok && !stray ? "true" : "false");
+    return ok && !stray;
+}
+
+int main() {
+    printf("{\n  \"platform\": \"host-check\",\n  \"record\": [\n");
+    bool ok = true;
+    bool first = true;
+    for (const RecordCase& c : CASES) {
+        if (!runCase(c, first)) {
+            fprintf(stderr, "%s: recorded steps differ from the script\n", c.name);
+            ok = false;
+        }
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+    return ok ? 0 : 1;
+}
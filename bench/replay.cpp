@@ -0,0 +1,336 @@
+// Deterministic replay of sessions (src/session.h) through the firmware
+// itself: main.cpp's setup() and loop() run against the host stubs on a
+// virtual clock, and the keys and MIDI bytes of the session are fed in at
+// their times. Every run of a session takes the same path, so what it
+// draws and plays can be compared exactly. Each session runs in a child
+// process of its own, from a fresh boot. Reports as JSON:
+//
+//   results  host time per loop pass by what the pass did (draw, trigger,
+//            input, midi, idle; the first that applies), for setup(), and
+//            for mixing each 256-frame speaker block
+//   hashes   frames pushed to the display and a hash of their pixels, and
+//            output frames of the speaker mix and a hash of them
+//   memory   peak bytes of each memory tag (src/memory.h), host sizes
+//
+// A session that takes any tag over its budget fails, so a change that
+// needs more memory than the budgets allow shows up here first.
+//
+// The SD card holds a synthetic kit (drum_synth.h): hits as /1.wav to
+// /5.wav, a file that won't load, loops in / and /loops, and in stereo
+// builds (env replay_stereo) a stereo /wide.wav. --sd <dir>
+// loads a folder from disk instead, e.g. a copy of the card a session
+// was recorded with.
+//
+//   pio run -e replay && .pio/build/replay/program bench/sessions/*.ses
+//   tools/bench_compare.py bench/baseline/replay.json current.json
+
+#include "main.cpp"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "drum_synth.h"
+
+constexpr uint32_t REPLAY_START_US = 1000;       // Virtual micros() at boot
+constexpr uint32_t REPLAY_TAIL_US = 2000000;     // Run on after a recording's last record
+constexpr uint64_t REPLAY_MAX_PASSES = 50000000;  // Gives up on a loop that stops time
+constexpr uint32_t REPLAY_SAMPLE_RATE = 22050;
+
+enum class Stage : uint8_t { Setup, Draw, Trigger, Input, Midi, Idle, Mix };
+constexpr uint8_t STAGE_COUNT = 7;
+const char* const STAGE_NAMES[] = {"setup", "draw", "trigger", "input", "midi", "idle", "mix"};
+
+struct StageTime {
+    uint64_t ns = 0;
+    uint64_t maxNs = 0;
+    uint32_t count = 0;
+
+    void add(uint64_t t) {
+        ns += t;
+        if (t > maxNs) maxNs = t;
+        count++;
+    }
+};
+
+void put16(std::vector<uint8_t>& v, uint16_t x) { v.push_back(x); v.push_back(x >> 8); }
+void put32(std::vector<uint8_t>& v, uint32_t x) { put16(v, x); put16(v, x >> 16); }
+
+std::vector<uint8_t> makeWav(const std::vector<int16_t>& samples, uint32_t rate, uint16_t channels = 1) {
+    std::vector<uint8_t> wav = {'R', 'I', 'F', 'F'};
+    put32(wav, 36 + samples.size() * 2);
+    wav.insert(wav.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put32(wav, 16);
+    put16(wav, 1);  // PCM
+    put16(wav, channels);
+    put32(wav, rate);
+    put32(wav, rate * 2 * channels);
+    put16(wav, 2 * channels);
+    put16(wav, 16);
+    wav.insert(wav.end(), {'d', 'a', 't', 'a'});
+    put32(wav, samples.size() * 2);
+    for (int16_t s : samples) put16(wav, (uint16_t)s);
+    return wav;
+}
+
+std::vector<int16_t> synthOneShot(DrumVoice voice, float velocity, uint32_t seed) {
+    std::vector<float> mix(REPLAY_SAMPLE_RATE * 6 / 10, 0.0f);
+    SynthRng rng(seed);
+    synthHit(mix, 0, voice, velocity, REPLAY_SAMPLE_RATE, rng);
+    std::vector<int16_t> out(mix.size());
+    for (size_t i = 0; i < mix.size(); i++) out[i] = (int16_t)(mix[i] * 26000.0f);
+    return out;
+}
+
+void loadSyntheticCard() {
+    SD.addFile("/1.wav", makeWav(synthOneShot(DrumVoice::Kick, 1.0f, 1), REPLAY_SAMPLE_RATE));
+    SD.addFile("/2.wav", makeWav(synthOneShot(DrumVoice::Snare, 0.9f, 2), REPLAY_SAMPLE_RATE));
+    SD.addFile("/3.wav", makeWav(synthOneShot(DrumVoice::Hat, 0.8f, 3), REPLAY_SAMPLE_RATE));
+    SD.addFile("/4.wav", makeWav(synthOneShot(DrumVoice::Snare, 0.3f, 4), REPLAY_SAMPLE_RATE));
+    SD.addFile("/5.wav", makeWav(synthOneShot(DrumVoice::Kick, 0.5f, 5), REPLAY_SAMPLE_RATE));
+    SD.addFile("/bad.wav", {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'J', 'U', 'N', 'K'});
+
+    const LoopSpec loops[] = {
+        {"loop_120", 120, 16, 0.0f, false, 0.0f, 0.0f, 21},
+        {"break_96", 96, 32, 0.0f, true, 0.0f, 0.0f, 22},
+        {"pad_124", 124, 16, 0.0f, false, 0.6f, 0.0f, 23},
+    };
+    SD.addFile("/loop_120.wav", makeWav(synthLoop(loops[0], REPLAY_SAMPLE_RATE).samples, REPLAY_SAMPLE_RATE));
+    SD.addFile("/loops/break_96.wav", makeWav(synthLoop(loops[1], REPLAY_SAMPLE_RATE).samples, REPLAY_SAMPLE_RATE));
+    SD.addFile("/loops/pad_124.wav", makeWav(synthLoop(loops[2], REPLAY_SAMPLE_RATE).samples, REPLAY_SAMPLE_RATE));
+
+    // Stereo builds also get a stereo file: kick left, hat right
+    if (STEREO) {
+        const std::vector<int16_t> left = synthOneShot(DrumVoice::Kick, 0.8f, 6);
+        const std::vector<int16_t> right = synthOneShot(DrumVoice::Hat, 0.8f, 7);
+        std::vector<int16_t> wide(left.size() * 2);
+        for (size_t i = 0; i < left.size(); i++) {
+            wide[2 * i] = left[i];
+            wide[2 * i + 1] = right[i];
+        }
+        SD.addFile("/wide.wav", makeWav(wide, REPLAY_SAMPLE_RATE, 2));
+    }
+}
+
+bool loadCardFromDisk(const std::string& dir) {
+    namespace fs = std::filesystem;
+    std::error_code err;
+    for (auto it = fs::recursive_directory_iterator(dir, err); !err && it != fs::recursive_directory_iterator();
+         it.increment(err)) {
+        if (!it->is_regular_file()) continue;
+        std::ifstream in(it->path(), std::ios::binary);
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        SD.addFile("/" + fs::relative(it->path(), dir).generic_string(), std::move(bytes));
+    }
+    if (err) fprintf(stderr, "%s: %s\n", dir.c_str(), err.message().c_str());
+    return !err;
+}
+
+uint64_t hostNs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Applies a key record as the next keyboard scan will see it
+void pressKeys(const SessionKeys& k) {
+    std::vector<char> held(k.keys, k.keys + k.keyCount);
+    Keyboard_Class::KeysState state;
+    state.word.assign(k.word, k.word + k.wordCount);
+    state.enter = k.flags & SESSION_KEY_ENTER;
+    state.del = k.flags & SESSION_KEY_DEL;
+    M5Cardputer.Keyboard.setKeys(held, state);
+}
+
+// Replays one session from boot and writes its results to out, one
+// "R <result>", "H <hashes>" or "M <memory>" line each. False if it can't
+// be replayed or went over a memory budget.
+bool replaySession(const std::string& name, const std::vector<uint8_t>& bytes, FILE* out) {
+    SessionReader reader;
+    if (!reader.begin(bytes.data(), bytes.size())) {
+        fprintf(stderr, "%s: not a session\n", name.c_str());
+        return false;
+    }
+    if (reader.tracks != Engine::tracks || reader.steps != Engine::steps) {
+        fprintf(stderr, "%s: recorded on a %ux%u engine, this build is %ux%u\n", name.c_str(),
+                reader.tracks, reader.steps, Engine::tracks, Engine::steps);
+        return false;
+    }
+
+    hostClock.enabled = true;
+    hostClock.nowUs = REPLAY_START_US;
+    M5Cardputer.Speaker.mixing = true;
+    StageTime stages[STAGE_COUNT];
+
+    uint64_t t0 = hostNs();
+    setup();
+    stages[(uint8_t)Stage::Setup].add(hostNs() - t0 - M5Cardputer.Speaker.mixNs);
+    const uint32_t baseUs = hostClock.nowUs;
+
+    SessionRecord rec;
+    bool pending = reader.next(rec);
+    uint32_t lastUs = 0;
+    bool ended = false;
+    uint64_t passes = 0;
+    while (passes++ < REPLAY_MAX_PASSES) {
+        const uint32_t nowUs = hostClock.nowUs;
+
+        // Every MIDI byte that has arrived, and one key change: each key
+        // record is a change the device saw on a scan of its own
+        bool keys = false, midi = false;
+        while (pending && (int32_t)(nowUs - (baseUs + rec.timeUs)) >= 0) {
+            if (rec.kind == SessionKind::End) {
+                ended = true;
+                break;
+            }
+            if (rec.kind == SessionKind::Keys) {
+                if (keys) break;
+                pressKeys(rec.keys);
+                keys = true;
+            } else {
+                Serial.feed(rec.midi);
+                midi = true;
+            }
+            lastUs = rec.timeUs;
+            pending = reader.next(rec);
+        }
+        if (ended || (!pending && (int32_t)(nowUs - (baseUs + lastUs + REPLAY_TAIL_US)) >= 0)) break;
+
+        // MIDI wakes the loop from its wait, keys are only seen when it
+        // next polls
+        hostClock.wakePending = pending && rec.kind == SessionKind::Midi;
+        hostClock.wakeUs = baseUs + rec.timeUs;
+
+        const uint32_t pushes = M5Cardputer.Display.pushCount;
+        const uint32_t plays = M5Cardputer.Speaker.playCount;
+        const uint64_t mixBefore = M5Cardputer.Speaker.mixNs;
+        t0 = hostNs();
+        loop();
+        const uint64_t ns = hostNs() - t0 - (M5Cardputer.Speaker.mixNs - mixBefore);
+
+        Stage stage = Stage::Idle;
+        if (M5Cardputer.Display.pushCount != pushes) stage = Stage::Draw;
+        else if (M5Cardputer.Speaker.playCount != plays) stage = Stage::Trigger;
+        else if (keys) stage = Stage::Input;
+        else if (midi) stage = Stage::Midi;
+        stages[(uint8_t)stage].add(ns);
+        M5Cardputer.Speaker.mixUntil(hostClock.nowUs);
+    }
+    if (passes > REPLAY_MAX_PASSES) {
+        fprintf(stderr, "%s: virtual time stopped moving\n", name.c_str());
+        return false;
+    }
+
+    // Mixing is timed per speaker block
+    const HostSpeaker& speaker = M5Cardputer.Speaker;
+    StageTime& mix = stages[(uint8_t)Stage::Mix];
+    const size_t blockFrames = HostSpeakerConfig().dma_buf_len;
+    mix.count = (uint32_t)(speaker.mixedFrames / blockFrames);
+    mix.ns = speaker.mixNs;
+
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+        const StageTime& s = stages[i];
+        if (s.count == 0) continue;
+        fprintf(out, "R {\"name\": \"replay_%s_%s\", \"iterations\": %u, \"ns_per_iter\": %.1f",
+                name.c_str(), STAGE_NAMES[i], s.count, (double)s.ns / s.count);
+        if (i != (uint8_t)Stage::Mix) fprintf(out, ", \"max_ns\": %llu", (unsigned long long)s.maxNs);
+        fprintf(out, "}\n");
+    }
+    fprintf(out, "H \"%s\": {\"frames\": %u, \"frame_hash\": \"%016llx\", \"audio_frames\": %llu, "
+                 "\"audio_hash\": \"%016llx\"}\n",
+            name.c_str(), M5Cardputer.Display.pushCount,
+            (unsigned long long)M5Cardputer.Display.frameHash,
+            (unsigned long long)speaker.mixedFrames, (unsigned long long)speaker.mixHash);
+
+    const MemoryMap& mem = memoryMap();
+    fprintf(out, "M \"%s\": {", name.c_str());
+    for (uint8_t i = 0; i < MEM_TAG_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %u", i ? ", " : "", MEM_POLICIES[i].name, (unsigned)mem.usage[i].peak);
+    }
+    fprintf(out, "}\n");
+    for (uint8_t i = 0; i < MEM_TAG_COUNT; i++) {
+        if (mem.usage[i].refused) {
+            fprintf(stderr, "%s: %s went over its %u KB budget (%u refused, peak %u KB)\n",
+                    name.c_str(), MEM_POLICIES[i].name, (unsigned)(mem.budgets[i] / 1024),
+                    (unsigned)mem.usage[i].refused, (unsigned)(mem.usage[i].peak / 1024));
+        }
+    }
+    return mem.overBudget() == 0;
+}
+
+int main(int argc, char** argv) {
+    std::string cardDir;
+    std::vector<std::string> sessions;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--sd" && i + 1 < argc) {
+            cardDir = argv[++i];
+        } else {
+            sessions.push_back(arg);
+        }
+    }
+    if (sessions.empty()) {
+        fprintf(stderr, "usage: %s [--sd <dir>] <session.ses>...\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<std::string> results, hashes, memory;
+    bool ok = true;
+    for (const std::string& path : sessions) {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!in && bytes.empty()) {
+            fprintf(stderr, "can't read %s\n", path.c_str());
+            ok = false;
+            continue;
+        }
+        std::string name = std::filesystem::path(path).stem().string();
+
+        int fds[2];
+        if (pipe(fds) != 0) return 1;
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            close(fds[0]);
+            freopen("/dev/null", "w", stdout);  // Serial: logs, MIDI out
+            FILE* out = fdopen(fds[1], "w");
+            bool loaded = cardDir.empty() ? (loadSyntheticCard(), true) : loadCardFromDisk(cardDir);
+            bool replayed = loaded && replaySession(name, bytes, out);
+            fclose(out);
+            _exit(replayed ? 0 : 1);
+        }
+        close(fds[1]);
+        FILE* in2 = fdopen(fds[0], "r");
+        char line[512];
+        while (fgets(line, sizeof(line), in2)) {
+            std::string s(line);
+            while (!s.empty() && (s.back() == '\n' || s.back() == '\r')) s.pop_back();
+            if (s.compare(0, 2, "R ") == 0) results.push_back(s.substr(2));
+            else if (s.compare(0, 2, "H ") == 0) hashes.push_back(s.substr(2));
+            else if (s.compare(0, 2, "M ") == 0) memory.push_back(s.substr(2));
+        }
+        fclose(in2);
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s: replay failed\n", name.c_str());
+            ok = false;
+        }
+    }
+
+    printf("{\n  \"platform\": \"host-replay\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        printf("    %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+    }
+    printf("  ],\n  \"hashes\": {\n");
+    for (size_t i = 0; i < hashes.size(); i++) {
+        printf("    %s%s\n", hashes[i].c_str(), i + 1 < hashes.size() ? "," : "");
+    }
+    printf("  },\n  \"memory\": {\n");
+    for (size_t i = 0; i < memory.size(); i++) {
+        printf("    %s%s\n", memory[i].c_str(), i + 1 < memory.size() ? "," : "");
+    }
+    printf("  }\n}\n");
+    return ok ? 0 : 1;
+}
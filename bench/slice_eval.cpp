@@ -0,0 +1,190 @@
+// Host quality check for slice mode and time-stretch, on synthetic loops
+// with known hit times (drum_synth.h). Reports as JSON:
+//
+//   onsets   precision, recall and F-measure of detected onsets within
+//            +-10 ms, and the mean placement error of the matches
+//   slices   loop length and tempo found, and the share of hits that got
+//            a slice on their own step
+//   stretch  for WSOLA and plain overlap-add: pitch error and tone purity
+//            of a stretched chord, and onset F-measure and timing error
+//            of a stretched loop (hits should move with the tempo)
+//
+//   pio run -e slice_eval && .pio/build/slice_eval/program
+
+#include <Arduino.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "drum_synth.h"
+#include "slicer.h"
+#include "stretch.h"
+
+constexpr uint32_t EVAL_SAMPLE_RATE = 22050;
+constexpr float ONSET_TOLERANCE_MS = 10.0f;
+
+const LoopSpec LOOPS[] = {
+    {"break_120", 120, 16, 0.0f, false, 0.0f, 0.0f, 11},
+    {"break_96_2bar", 96, 32, 0.0f, true, 0.0f, 0.0f, 12},
+    {"break_170_ghosts", 170, 32, 0.0f, true, 0.0f, 0.002f, 13},
+    {"swing_110", 110, 16, 0.33f, true, 0.0f, 0.0f, 14},
+    {"break_pad_124", 124, 16, 0.0f, false, 0.25f, 0.0f, 15},
+    {"noisy_140", 140, 32, 0.0f, true, 0.1f, 0.02f, 16},
+};
+
+const float STRETCH_RATIOS[] = {0.8f, 1.25f, 1.5f};  // Output length / input length
+
+struct Match {
+    uint32_t truePositives = 0;
+    uint32_t detected = 0;
+    uint32_t expected = 0;
+    double errorSumMs = 0;
+
+    float precision() const { return detected ? (float)truePositives / detected : 0; }
+    float recall() const { return expected ? (float)truePositives / expected : 0; }
+    float fMeasure() const {
+        float p = precision(), r = recall();
+        return p + r > 0 ? 2 * p * r / (p + r) : 0;
+    }
+    float meanErrorMs() const { return truePositives ? (float)(errorSumMs / truePositives) : 0; }
+};
+
+// Greedy one-to-one matching of sorted onset lists
+Match matchOnsets(const std::vector<uint32_t>& truth, const uint32_t* found, uint16_t count,
+                  uint32_t sampleRate) {
+    Match m;
+    m.expected = truth.size();
+    m.detected = count;
+    const double tolerance = ONSET_TOLERANCE_MS * sampleRate / 1000.0;
+    size_t j = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        while (j < truth.size() && truth[j] + tolerance < found[i]) j++;
+        if (j < truth.size() && fabs((double)found[i] - truth[j]) <= tolerance) {
+            m.truePositives++;
+            m.errorSumMs += fabs((double)found[i] - truth[j]) * 1000.0 / sampleRate;
+            j++;
+        }
+    }
+    return m;
+}
+
+// Power of a frequency over a buffer (Goertzel), relative to the total
+double tonePower(const std::vector<int16_t>& x, size_t from, size_t to, double hz, uint32_t rate) {
+    const double w = 2.0 * M_PI * hz / rate, c = 2.0 * cos(w);
+    double s1 = 0, s2 = 0;
+    for (size_t i = from; i < to; i++) {
+        const double s0 = x[i] + c * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    const double n = (double)(to - from);
+    return (s1 * s1 + s2 * s2 - c * s1 * s2) * 2.0 / (n * n);
+}
+
+// Frequency of the strongest autocorrelation peak between lo and hi Hz
+double fundamentalHz(const std::vector<int16_t>& x, size_t from, size_t to, double lo, double hi,
+                     uint32_t rate) {
+    const uint32_t minLag = (uint32_t)(rate / hi), maxLag = (uint32_t)(rate / lo) + 1;
+    std::vector<double> r(maxLag + 2, 0.0);
+    for (uint32_t lag = minLag - 1; lag <= maxLag + 1; lag++) {
+        double sum = 0;
+        for (size_t i = from; i + lag < to; i++) sum += (double)x[i] * x[i + lag];
+        r[lag] = sum;
+    }
+    uint32_t best = minLag;
+    for (uint32_t lag = minLag; lag <= maxLag; lag++) {
+        if (r[lag] > r[best]) best = lag;
+    }
+    // Parabolic interpolation around the peak
+    const double a = r[best - 1], b = r[best], c = r[best + 1];
+    const double denom = a - 2 * b + c;
+    const double lag = best + (denom != 0 ? 0.5 * (a - c) / denom : 0.0);
+    return rate / lag;
+}
+
+std::vector<int16_t> stretch(const std::vector<int16_t>& in, float ratio, uint8_t toleranceDivider,
+                             uint32_t rate) {
+    static WsolaStretcher stretcher;
+    stretcher.toleranceDivider = toleranceDivider;
+    std::vector<int16_t> out(WsolaStretcher::stretchedLength(in.size(), ratio, 1.0f));
+    stretcher.begin(in.data(), in.size(), out.data(), out.size(), rate);
+    while (!stretcher.process(4096)) {
+    }
+    return out;
+}
+
+void evalOnsets(Slicer& slicer, bool& first) {
+    for (const LoopSpec& spec : LOOPS) {
+        SynthLoop loop = synthLoop(spec, EVAL_SAMPLE_RATE);
+        uint32_t found[2 * SLICE_MAX];
+        uint16_t count = slicer.detectOnsets(loop.samples.data(), loop.samples.size(),
+                                             EVAL_SAMPLE_RATE, found, 2 * SLICE_MAX);
+        Match m = matchOnsets(loop.onsets, found, count, EVAL_SAMPLE_RATE);
+
+        SliceTable table;
+        slicer.analyze(loop.samples.data(), loop.samples.size(), EVAL_SAMPLE_RATE, table);
+        uint32_t onStep = 0;
+        for (uint8_t s : loop.onsetSteps) onStep += table.sliceAt(s) >= 0;
+
+        printf("%s    {\"loop\": \"%s\", \"hits\": %u, \"detected\": %u, \"precision\": %.3f, "
+               "\"recall\": %.3f, \"f_measure\": %.3f, \"mean_error_ms\": %.2f, "
+               "\"loop_steps\": %u, \"expected_steps\": %u, \"bpm\": %.1f, \"expected_bpm\": %.1f, "
+               "\"slices\": %u, \"hits_with_slice\": %.3f}",
+               first ? "" : ",\n", spec.name, m.expected, m.detected, m.precision(), m.recall(),
+               m.fMeasure(), m.meanErrorMs(), table.loopSteps, spec.steps, table.bpm, spec.bpm,
+               table.count, (float)onStep / loop.onsetSteps.size());
+        first = false;
+    }
+}
+
+void evalStretch(Slicer& slicer, bool& first) {
+    // A sustained chord root at 220 Hz for pitch and purity
+    std::vector<int16_t> chord(EVAL_SAMPLE_RATE * 2);
+    for (size_t i = 0; i < chord.size(); i++) {
+        const double t = (double)i / EVAL_SAMPLE_RATE;
+        chord[i] = (int16_t)(12000 * sin(2 * M_PI * 220 * t) + 6000 * sin(2 * M_PI * 330 * t));
+    }
+    SynthLoop loop = synthLoop(LOOPS[0], EVAL_SAMPLE_RATE);
+
+    const char* const METHODS[] = {"ola", "wsola"};
+    const uint8_t DIVIDERS[] = {0, 4};
+    for (uint8_t m = 0; m < 2; m++) {
+        for (float ratio : STRETCH_RATIOS) {
+            std::vector<int16_t> tone = stretch(chord, ratio, DIVIDERS[m], EVAL_SAMPLE_RATE);
+            const size_t from = tone.size() / 4, to = tone.size() * 3 / 4;
+            double total = 0;
+            for (size_t i = from; i < to; i++) total += (double)tone[i] * tone[i];
+            total /= (double)(to - from);
+            const double tones = tonePower(tone, from, to, 220, EVAL_SAMPLE_RATE) +
+                                 tonePower(tone, from, to, 330, EVAL_SAMPLE_RATE);
+            const double purityDb = 10 * log10(tones / total);
+            const double hz = fundamentalHz(tone, from, to, 80, 300, EVAL_SAMPLE_RATE);
+            const double cents = 1200 * log2(hz / 110.0);  // 220 and 330 share 110 Hz
+
+            std::vector<int16_t> beat = stretch(loop.samples, ratio, DIVIDERS[m], EVAL_SAMPLE_RATE);
+            std::vector<uint32_t> moved;
+            for (uint32_t t : loop.onsets) moved.push_back((uint32_t)(t * ratio + 0.5f));
+            uint32_t found[2 * SLICE_MAX];
+            uint16_t count = slicer.detectOnsets(beat.data(), beat.size(), EVAL_SAMPLE_RATE, found,
+                                                 2 * SLICE_MAX);
+            Match match = matchOnsets(moved, found, count, EVAL_SAMPLE_RATE);
+
+            printf("%s    {\"method\": \"%s\", \"ratio\": %.2f, \"pitch_error_cents\": %.2f, "
+                   "\"tone_purity_db\": %.2f, \"onset_f_measure\": %.3f, \"onset_error_ms\": %.2f}",
+                   first ? "" : ",\n", METHODS[m], ratio, cents, purityDb, match.fMeasure(),
+                   match.meanErrorMs());
+            first = false;
+        }
+    }
+}
+
+int main() {
+    Slicer slicer;
+    printf("{\n  \"platform\": \"host-eval\",\n  \"onsets\": [\n");
+    bool first = true;
+    evalOnsets(slicer, first);
+    printf("\n  ],\n  \"stretch\": [\n");
+    first = true;
+    evalStretch(slicer, first);
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,339 @@
+// Host correctness check of WAV decoding (wav.h): u8, s16, s24, s32 and
+// f32 PCM and IMA ADPCM, mono and stereo, each decoded through WavDecoder
+// and compared with a reference decode computed here in double precision
+// straight from the file's samples. Stereo files are checked for both the
+// mono mix, (left + right) / 2, and the side, (left - right) / 2.
+//
+// Tolerances, in 16-bit LSB: 1 for mono files and the side, which covers
+// the converters truncating where the reference doesn't round, and 1.5 for
+// the stereo mix, where each channel is truncated to 16 bits before their
+// average is truncated again. IMA ADPCM is checked against a reference
+// block decoder written from the format's description (to the same
+// tolerances), and against the PCM it was encoded from for a
+// signal-to-error ratio of at least IMA_MIN_SNR_DB.
+//
+// Lengths are odd so the last read chunk and ADPCM block are partial, and
+// the f32 files go past full scale to check clamping.
+//
+// Malformed headers must neither hang readInfo() nor let decode() write
+// past the frames it reported: a chunk size that wraps the read position
+// back onto its own header, one that runs past the end of the file, and
+// data sizes far beyond the bytes actually there (which readInfo() clamps
+// to them). Reports as JSON and exits non-zero if any case fails.
+//
+//   pio run -e wav_check && .pio/build/wav_check/program
+
+#include <Arduino.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "drum_synth.h"
+#include "wav.h"
+#include "wav_fixtures.h"
+
+constexpr uint32_t CHECK_SAMPLE_RATE = 22050;
+constexpr size_t CHECK_FRAMES = 10007;
+constexpr double CHANNEL_TOLERANCE = 1.0;
+constexpr double MIX_TOLERANCE = 1.5;
+constexpr double IMA_MIN_SNR_DB = 25.0;
+
+struct Format {
+    const char* name;
+    uint16_t format;
+    uint16_t bits;
+};
+
+const Format FORMATS[] = {
+    {"u8", WAV_FORMAT_PCM, 8},
+    {"s16", WAV_FORMAT_PCM, 16},
+    {"s24", WAV_FORMAT_PCM, 24},
+    {"s32", WAV_FORMAT_PCM, 32},
+    {"f32", WAV_FORMAT_FLOAT, 32},
+    {"ima", WAV_FORMAT_IMA_ADPCM, 4},
+};
+
+// A fixture and what it should decode to, per channel in 16-bit units
+struct Fixture {
+    std::vector<uint8_t> wav;
+    std::vector<double> channel[2];
+    std::vector<int16_t> pcm;  // IMA: the interleaved input it was encoded from
+};
+
+// Two tones and noise. PCM starts on full-scale samples, which float takes
+// past full scale now and then; ADPCM starts from silence instead, as the
+// encoder can't follow a full-scale square from its smallest step
+double signal(size_t frame, uint16_t channel, bool extremes, bool overRange, SynthRng& rng) {
+    if (extremes && frame < 4) return (frame & 1) ? -1.0 : 1.0;
+    if (overRange && frame % 1000 == 7) return channel ? -1.5 : 1.5;
+    const double t = (double)frame / CHECK_SAMPLE_RATE;
+    return 0.6 * sin(2 * M_PI * (220.0 + 110.0 * channel) * t) + 0.2 * sin(2 * M_PI * 3100.0 * t) +
+           0.1 * rng.signedUnit();
+}
+
+int64_t quantize(double v, double scale) {
+    double q = floor(v * scale + 0.5);
+    return (int64_t)fmax(-scale - 1, fmin(scale, q));
+}
+
+Fixture makeFixture(const Format& f, uint16_t channels) {
+    Fixture fx;
+    SynthRng rng(7 + channels);
+    std::vector<uint8_t> data;
+    uint16_t blockAlign = channels * f.bits / 8;
+    uint16_t samplesPerBlock = 0;
+
+    if (f.format == WAV_FORMAT_IMA_ADPCM) {
+        blockAlign = 256 * channels;
+        samplesPerBlock = (blockAlign - 4 * channels) * 2 / channels + 1;
+        fx.pcm.resize(CHECK_FRAMES * channels);
+        for (size_t i = 0; i < fx.pcm.size(); i++) {
+            fx.pcm[i] = (int16_t)quantize(signal(i / channels, i % channels, false, false, rng), 32767);
+        }
+        encodeIma(data, fx.pcm, channels, blockAlign, samplesPerBlock);
+        // Drop the end of the last block so it decodes partially
+        data.resize(data.size() - blockAlign / 3);
+        fx.wav = wavFile(f.format, f.bits, channels, CHECK_SAMPLE_RATE, blockAlign, samplesPerBlock, data);
+        return fx;
+    }
+
+    for (size_t frame = 0; frame < CHECK_FRAMES; frame++) {
+        for (uint16_t c = 0; c < channels; c++) {
+            const double v = signal(frame, c, true, f.format == WAV_FORMAT_FLOAT, rng);
+            double ref = 0;
+            if (f.format == WAV_FORMAT_FLOAT) {
+                float x = (float)v;
+                uint32_t bits;
+                memcpy(&bits, &x, 4);
+                put32(data, bits);
+                ref = (double)x * 32767.0;
+            } else if (f.bits == 8) {
+                int64_t q = quantize(v, 127) + 128;
+                data.push_back((uint8_t)q);
+                ref = (double)(q - 128) * 256.0;
+            } else if (f.bits == 16) {
+                int64_t q = quantize(v, 32767);
+                put16(data, (uint16_t)q);
+                ref = (double)q;
+            } else if (f.bits == 24) {
+                int64_t q = quantize(v, 8388607);
+                data.push_back((uint8_t)q);
+                put16(data, (uint16_t)(q >> 8));
+                ref = (double)q / 256.0;
+            } else {
+                int64_t q = quantize(v, 2147483647.0);
+                put32(data, (uint32_t)q);
+                ref = (double)q / 65536.0;
+            }
+            fx.channel[c].push_back(ref);
+        }
+    }
+    fx.wav = wavFile(f.format, f.bits, channels, CHECK_SAMPLE_RATE, blockAlign, 0, data);
+    return fx;
+}
+
+// Reference IMA ADPCM decode to separate channels: per channel a 4-byte
+// header (predictor, step index), then 4-bit codes, low nibble first;
+// stereo alternates 4 bytes (8 codes) of each channel
+void referenceIma(const std::vector<uint8_t>& wav, size_t dataOffset, size_t dataSize, uint16_t channels,
+                  uint16_t blockAlign, uint16_t samplesPerBlock, std::vector<double>* out) {
+    for (size_t block = 0; block < dataSize; block += blockAlign) {
+        const uint8_t* b = wav.data() + dataOffset + block;
+        const size_t bytes = std::min<size_t>(blockAlign, dataSize - block);
+        if (bytes < 4u * channels) break;
+        int32_t predictor[2], index[2];
+        std::vector<double> decoded[2];
+        for (uint16_t c = 0; c < channels; c++) {
+            predictor[c] = (int16_t)(b[4 * c] | (b[4 * c + 1] << 8));
+            index[c] = std::min<int32_t>(b[4 * c + 2], 88);
+            decoded[c].push_back(predictor[c]);
+        }
+        auto code = [&](uint16_t c, uint8_t nibble) {
+            const int32_t step = IMA_STEP_TABLE[index[c]];
+            int32_t magnitude = step >> 3;
+            if (nibble & 1) magnitude += step >> 2;
+            if (nibble & 2) magnitude += step >> 1;
+            if (nibble & 4) magnitude += step;
+            predictor[c] = std::max(-32768, std::min(32767, predictor[c] + ((nibble & 8) ? -magnitude : magnitude)));
+            index[c] = std::max(0, std::min(88, index[c] + IMA_INDEX_TABLE[nibble]));
+            decoded[c].push_back(predictor[c]);
+        };
+        const size_t groupBytes = 4 * channels;
+        for (size_t g = 4 * channels; g + groupBytes <= bytes; g += groupBytes) {
+            for (uint16_t c = 0; c < channels; c++) {
+                for (size_t i = 0; i < 4; i++) {
+                    code(c, b[g + 4 * c + i] & 0x0F);
+                    code(c, b[g + 4 * c + i] >> 4);
+                }
+            }
+        }
+        if (channels == 1) {
+            // Mono decodes a trailing partial group byte by byte
+            for (size_t g = 4 + (bytes - 4) / 4 * 4; g < bytes; g++) {
+                code(0, b[g] & 0x0F);
+                code(0, b[g] >> 4);
+            }
+        }
+        const size_t frames = std::min<size_t>(decoded[0].size(), samplesPerBlock);
+        for (uint16_t c = 0; c < channels; c++) {
+            out[c].insert(out[c].end(), decoded[c].begin(), decoded[c].begin() + frames);
+        }
+    }
+}
+
+struct Result {
+    double maxError = 0;
+    double sideMaxError = 0;
+    double snrDb = 0;
+    size_t frames = 0;
+    size_t expected = 0;
+};
+
+double clamp16(double v) { return fmax(-32768.0, fmin(32767.0, v)); }
+
+Result check(const Format& f, uint16_t channels) {
+    Fixture fx = makeFixture(f, channels);
+    MemorySource src{&fx.wav};
+    WavDecoder decoder;
+    WavInfo info;
+    Result r;
+    if (!decoder.readInfo(src, info)) return r;
+
+    if (f.format == WAV_FORMAT_IMA_ADPCM) {
+        referenceIma(fx.wav, info.dataOffset, info.dataSize, channels, info.blockAlign,
+                     info.samplesPerBlock, fx.channel);
+    }
+    r.expected = fx.channel[0].size();
+
+    std::vector<int16_t> mono(info.frames), side(info.frames);
+    r.frames = decoder.decode(src, info, mono.data(), info.frames, channels == 2 ? side.data() : nullptr);
+    if (r.frames != r.expected) return r;
+
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < r.frames; i++) {
+        const double l = fx.channel[0][i];
+        const double rr = channels == 2 ? fx.channel[1][i] : l;
+        const double mid = clamp16((l + rr) / 2);
+        r.maxError = fmax(r.maxError, fabs(mono[i] - mid));
+        if (channels == 2) r.sideMaxError = fmax(r.sideMaxError, fabs(side[i] - clamp16((l - rr) / 2)));
+        if (!fx.pcm.empty()) {
+            const double in = channels == 2 ? (fx.pcm[2 * i] + fx.pcm[2 * i + 1]) / 2.0 : fx.pcm[i];
+            signal += in * in;
+            noise += (mono[i] - in) * (mono[i] - in);
+        }
+    }
+    if (!fx.pcm.empty()) r.snrDb = 10 * log10(signal / fmax(noise, 1.0));
+    return r;
+}
+
+// MemorySource that gives out after a set number of reads, so a parser
+// stuck on one chunk fails the check instead of hanging it
+struct BoundedSource : MemorySource {
+    uint32_t readsLeft = 1000;
+
+    size_t read(uint8_t* out, size_t n) {
+        if (readsLeft == 0) return 0;
+        readsLeft--;
+        return MemorySource::read(out, n);
+    }
+};
+
+struct HeaderCase {
+    const char* name;
+    uint16_t bits;
+    uint16_t channels;
+    uint32_t junkSize;  // Size of a chunk before the data one, 0 for none
+    uint32_t dataSize;  // Written into the data chunk's header
+    size_t bytes;       // Data actually in the file
+    bool accepted;
+    size_t frames;      // Expected, when accepted
+};
+
+const HeaderCase HEADER_CASES[] = {
+    {"chunk_size_wraps", 8, 1, 0xFFFFFFF8u, 1001, 1001, false, 0},
+    {"chunk_past_end", 8, 1, 5000, 1001, 1001, false, 0},
+    {"data_past_end_u8_mono", 8, 1, 0, 0x80000000u, 1001, true, 1001},
+    {"data_past_end_s16_stereo", 16, 2, 0, 0xFFFFFFF0u, 2002, true, 500},
+};
+
+bool checkHeader(const HeaderCase& h, bool first) {
+    std::vector<uint8_t> data(h.bytes);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 37);
+    const uint16_t blockAlign = h.channels * h.bits / 8;
+    std::vector<uint8_t> wav = wavFile(WAV_FORMAT_PCM, h.bits, h.channels, CHECK_SAMPLE_RATE, blockAlign, 0, data);
+
+    // wavFile's data chunk header starts after RIFF (12) and fmt (24)
+    const size_t dataChunk = 36;
+    wav[dataChunk + 4] = (uint8_t)h.dataSize;
+    wav[dataChunk + 5] = (uint8_t)(h.dataSize >> 8);
+    wav[dataChunk + 6] = (uint8_t)(h.dataSize >> 16);
+    wav[dataChunk + 7] = (uint8_t)(h.dataSize >> 24);
+    if (h.junkSize) {
+        std::vector<uint8_t> junk = {'j', 'u', 'n', 'k'};
+        put32(junk, h.junkSize);
+        wav.insert(wav.begin() + dataChunk, junk.begin(), junk.end());
+    }
+
+    BoundedSource src;
+    src.bytes = &wav;
+    WavDecoder decoder;
+    WavInfo info;
+    const bool accepted = decoder.readInfo(src, info);
+    bool pass = accepted == h.accepted && src.readsLeft > 0;
+    size_t frames = 0;
+    bool overrun = false;
+    if (accepted && info.frames > h.bytes) {
+        pass = false;  // More frames than bytes: the size wasn't clamped
+        frames = info.frames;
+    } else if (accepted) {
+        // Room for what was reported plus a guard band that must stay untouched
+        constexpr size_t GUARD = 64;
+        std::vector<int16_t> mono(info.frames + GUARD, 0x5A5A), side(info.frames + GUARD, 0x5A5A);
+        frames = decoder.decode(src, info, mono.data(), info.frames, h.channels == 2 ? side.data() : nullptr);
+        for (size_t i = info.frames; i < info.frames + GUARD; i++) {
+            overrun |= mono[i] != 0x5A5A || side[i] != 0x5A5A;
+        }
+        pass &= info.frames == h.frames && frames == h.frames && !overrun;
+    }
+    printf("%s    {\"case\": \"%s\", \"accepted\": %s, \"frames\": %u, \"expected_frames\": %u, "
+           "\"overrun\": %s, \"pass\": %s}",
+           first ? "" : ",\n", h.name, accepted ? "true" : "false", (unsigned)frames, (unsigned)h.frames,
+           overrun ? "true" : "false", pass ? "true" : "false");
+    return pass;
+}
+
+int main() {
+    printf("{\n  \"platform\": \"host-check\",\n  \"decode\": [\n");
+    bool ok = true;
+    bool first = true;
+    for (const Format& f : FORMATS) {
+        for (uint16_t channels = 1; channels <= 2; channels++) {
+            Result r = check(f, channels);
+            const bool ima = f.format == WAV_FORMAT_IMA_ADPCM;
+            const double tolerance = channels == 2 ? MIX_TOLERANCE : CHANNEL_TOLERANCE;
+            const bool pass = r.frames == r.expected && r.expected > 0 && r.maxError <= tolerance &&
+                              r.sideMaxError <= CHANNEL_TOLERANCE && (!ima || r.snrDb >= IMA_MIN_SNR_DB);
+            printf("%s    {\"case\": \"%s_%s\", \"frames\": %u, \"expected_frames\": %u, "
+                   "\"max_error\": %.3f, \"side_max_error\": %.3f, ",
+                   first ? "" : ",\n", f.name, channels == 2 ? "stereo" : "mono", (unsigned)r.frames,
+                   (unsigned)r.expected, r.maxError, r.sideMaxError);
+            if (ima) printf("\"snr_db\": %.1f, ", r.snrDb);
+            printf("\"pass\": %s}", pass ? "true" : "false");
+            if (!pass) {
+                fprintf(stderr, "%s_%s: decode out of tolerance\n", f.name, channels == 2 ? "stereo" : "mono");
+                ok = false;
+            }
+            first = false;
+        }
+    }
+    printf("\n  ],\n  \"headers\": [\n");
+    first = true;
+    for (const HeaderCase& h : HEADER_CASES) {
+        if (!checkHeader(h, first)) {
+            fprintf(stderr, "%s: malformed header not handled\n", h.name);
+            ok = false;
+        }
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+    return ok ? 0 : 1;
+}
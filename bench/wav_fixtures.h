@@ -0,0 +1,101 @@
+#ifndef WAV_FIXTURES_H
+#define WAV_FIXTURES_H
+
+// WAV files built in memory for host benchmarks and checks: byte writers,
+// a minimal IMA ADPCM encoder, the RIFF wrapper, and a read-only Source
+// for WavDecoder.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "wav.h"
+
+inline void put16(std::vector<uint8_t>& v, uint16_t x) { v.push_back(x); v.push_back(x >> 8); }
+inline void put32(std::vector<uint8_t>& v, uint32_t x) { put16(v, x); put16(v, x >> 16); }
+
+// Minimal IMA ADPCM encoder (for producing test files only)
+inline void encodeIma(std::vector<uint8_t>& out, const std::vector<int16_t>& pcm, uint16_t channels,
+                      uint16_t blockAlign, uint16_t samplesPerBlock) {
+    size_t frames = pcm.size() / channels;
+    ImaState state[2] = {{0, 0}, {0, 0}};
+    for (size_t start = 0; start < frames; start += samplesPerBlock) {
+        size_t blockStart = out.size();
+        for (uint16_t c = 0; c < channels; c++) {
+            state[c].predictor = pcm[start * channels + c];
+            put16(out, (uint16_t)state[c].predictor);
+            out.push_back((uint8_t)state[c].index);
+            out.push_back(0);
+        }
+        auto encode = [&](uint16_t c, size_t frame) -> uint8_t {
+            int32_t sample = frame < frames ? pcm[frame * channels + c] : 0;
+            int32_t step = IMA_STEP_TABLE[state[c].index];
+            int32_t diff = sample - state[c].predictor;
+            uint8_t nibble = diff < 0 ? 8 : 0;
+            if (diff < 0) diff = -diff;
+            if (diff >= step) { nibble |= 4; diff -= step; }
+            if (diff >= step >> 1) { nibble |= 2; diff -= step >> 1; }
+            if (diff >= step >> 2) nibble |= 1;
+            state[c].decode(nibble);
+            return nibble;
+        };
+        // Nibble order matches wavDecodeImaBlock: mono packs pairs, stereo
+        // alternates 4-byte groups per channel
+        size_t frame = start + 1;
+        while (out.size() - blockStart < blockAlign) {
+            for (uint16_t c = 0; c < channels; c++) {
+                for (int i = 0; i < 4; i++) {
+                    uint8_t lo = encode(c, frame + 2 * i);
+                    uint8_t hi = encode(c, frame + 2 * i + 1);
+                    out.push_back(lo | (hi << 4));
+                }
+            }
+            frame += 8;
+        }
+    }
+}
+
+// RIFF/WAVE file around a data chunk; samplesPerBlock is for ADPCM only
+inline std::vector<uint8_t> wavFile(uint16_t format, uint16_t bitsPerSample, uint16_t channels,
+                                    uint32_t sampleRate, uint16_t blockAlign, uint16_t samplesPerBlock,
+                                    const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> wav;
+    uint32_t fmtSize = samplesPerBlock ? 20 : 16;
+    wav.insert(wav.end(), {'R', 'I', 'F', 'F'});
+    put32(wav, 4 + 8 + fmtSize + 8 + data.size());
+    wav.insert(wav.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put32(wav, fmtSize);
+    put16(wav, format);
+    put16(wav, channels);
+    put32(wav, sampleRate);
+    put32(wav, sampleRate * blockAlign / (samplesPerBlock ? samplesPerBlock : 1));
+    put16(wav, blockAlign);
+    put16(wav, bitsPerSample);
+    if (samplesPerBlock) {
+        put16(wav, 2);
+        put16(wav, samplesPerBlock);
+    }
+    wav.insert(wav.end(), {'d', 'a', 't', 'a'});
+    put32(wav, data.size());
+    wav.insert(wav.end(), data.begin(), data.end());
+    return wav;
+}
+
+// Read-only in-memory Source for WavDecoder, so decoding can be measured
+// and checked without file system overhead
+struct MemorySource {
+    const std::vector<uint8_t>* bytes;
+    size_t pos = 0;
+
+    size_t read(uint8_t* out, size_t n) {
+        n = std::min(n, bytes->size() - pos);
+        memcpy(out, bytes->data() + pos, n);
+        pos += n;
+        return n;
+    }
+    bool seek(uint32_t p) { pos = std::min<size_t>(p, bytes->size()); return true; }
+    size_t position() const { return pos; }
+    size_t size() const { return bytes->size(); }
+};
+
+#endif
@@ -4,7 +4,17 @@
 #include <M5Cardputer.h>
 #include <SD.h>
 #include <SPI.h>
-#include <vector>
+#include "memory.h"
+#include "trace.h"
+#include "wav.h"
+#include "kitloader.h"
+#include "browser.h"
+#include "waveform.h"
+#include "slicer.h"
+#include "stretch.h"
+#include "prefetch.h"
+#include "pan.h"
+#include "engine.h"
 
 // SD Card pins for Cardputer ADV
 constexpr int SD_SCK  = 40;
@@ -12,123 +22,176 @@ constexpr int SD_MISO = 39;
 constexpr int SD_MOSI = 14;
 constexpr int SD_CS   = 12;
 
-constexpr uint8_t MAX_SAMPLES = 16;  // Max samples we can load
-
-// WAV header structure
-struct WavHeader {
-    char riff[4];
-    uint32_t fileSize;
-    char wave[4];
-    char fmt[4];
-    uint32_t fmtSize;
-    uint16_t audioFormat;
-    uint16_t numChannels;
-    uint32_t sampleRate;
-    uint32_t byteRate;
-    uint16_t blockAlign;
-    uint16_t bitsPerSample;
+// SPI clock: start safe, then probe faster clocks against a CRC of data read
+// at the safe clock. The SD pins go through the GPIO matrix, which caps
+// reliable SPI at 40 MHz.
+constexpr uint32_t SD_SAFE_HZ = 20000000;
+constexpr uint32_t SD_PROBE_BYTES = 32768;
+constexpr uint8_t SD_PROBE_READS = 3;
+
+// Result of the last loadKit() call
+struct KitLoadStats {
+    uint8_t files = 0;
+    uint32_t bytes = 0;
+    uint32_t ms = 0;
+
+    float mbPerSec() const {
+        return ms ? bytes / (ms * 1000.0f) : 0.0f;
+    }
 };
 
-// Sample buffer
+constexpr size_t STRETCH_CHUNK_FRAMES = 2048;  // Rendered per loop pass
+
+// Rest of a voice started from its prefetched attack, queued once the
+// channel has room
+struct VoiceTail {
+    const int16_t* data = nullptr;
+    size_t length = 0;  // 0 when nothing is waiting
+    uint32_t sampleRate = 0;
+    uint8_t slot = 0;
+};
+
+// Pan of a slot's stereo renders when they need redoing in full
+constexpr int8_t PAN_STALE = -128;
+
+// Sample buffer. In a stereo build the block holding data also holds the
+// side channel of a stereo file and the stereo render the slot plays, and
+// a stretch render's block its stereo render.
 struct Sample {
-    int16_t* data = nullptr;
+    int16_t* data = nullptr;  // Mono (the mid of a stereo file)
+    int16_t* side = nullptr;  // Stereo file: (left - right) / 2
+    int16_t* stereo = nullptr;  // Interleaved, panned
     size_t length = 0;
     uint32_t sampleRate = 22050;
     bool loaded = false;
     char name[16] = {0};  // Short name for display
+    WaveformPyramid wave;  // Thumbnail overview, built on load
+    SliceTable slices;     // Loop length and slices, found on load
+    SampleMode mode = SampleMode::OneShot;
+    int16_t* stretched = nullptr;  // Render at stretchedBpm (Stretch mode)
+    int16_t* stretchedStereo = nullptr;
+    size_t stretchedLength = 0;
+    uint16_t stretchedBpm = 0;
+    int8_t pan = 0;
+    int8_t renderedPan = 0;  // Pan the stereo renders are done with
 };
 
+template <typename Config>
 class AudioManager {
 public:
-    Sample samples[MAX_SAMPLES];
+    // Speaker mixer channels: one per track, up to the 8 M5Unified mixes.
+    // Past that tracks share them (see engine.h)
+    static constexpr uint8_t VOICES = Config::tracks < 8 ? Config::tracks : 8;
+    static constexpr uint8_t OUT_CHANNELS = STEREO ? 2 : 1;  // Samples per played frame
+
+    Sample samples[Config::samples];
     uint8_t sampleCount = 0;
-    std::vector<String> wavFiles;  // List of WAV files on SD
+    SampleBrowser browser;  // Folders and WAV files on SD, read lazily
     bool sdInitialized = false;
+    WavDecoder decoder;  // Owns the streaming buffer, reused for every load
+    KitLoader kitLoader;
+    KitLoadStats lastKit;
+    uint32_t spiFrequency = SD_SAFE_HZ;
+    Slicer slicer;
+    WsolaStretcher stretcher;
+    AttackCache<VOICES> attacks;  // Attacks of upcoming hits, in internal RAM
 
     bool init() {
+        attacks.begin();
+
         // Initialize SD card with custom SPI pins
         SPI.begin(SD_SCK, SD_MISO, SD_MOSI, SD_CS);
 
-        if (!SD.begin(SD_CS, SPI, 25000000)) {
-            Serial.println("SD Card init failed!");
+        if (!SD.begin(SD_CS, SPI, SD_SAFE_HZ)) {
+            LOG_ERROR("SD Card init failed!\n");
             return false;
         }
 
         sdInitialized = true;
-        Serial.println("SD Card initialized");
+        LOG_INFO("SD Card initialized\n");
 
         // Set speaker volume
         M5Cardputer.Speaker.setVolume(200);
 
-        // Scan for WAV files
-        scanWavFiles();
+        // Use a sample file to find the fastest clock that reads back clean.
+        // The probe remounts the card, so no folder may stay open across it
+        char probePath[BROWSER_PATH_MAX] = "";
+        if (browser.open("/")) {
+            int32_t first = browser.nextFile(-1, 1);
+            if (first >= 0) {
+                strncpy(probePath, browser.pathOf(first), sizeof(probePath) - 1);
+                probePath[sizeof(probePath) - 1] = 0;
+            }
+            browser.close();
+        }
+        if (probePath[0]) probeSpiFrequency(probePath);
+
+        // List the root folder
+        browser.open("/");
 
         return true;
     }
 
-    void scanWavFiles() {
-        wavFiles.clear();
-        File root = SD.open("/");
-        if (!root) return;
-
-        while (true) {
-            File entry = root.openNextFile();
-            if (!entry) break;
-
-            if (entry.isDirectory()) {
-                entry.close();
-                continue;
-            }
-
-            String fullPath = entry.name();  // Returns full path like "/1.wav"
-            entry.close();
-
-            // Get just the filename part
-            int lastSlash = fullPath.lastIndexOf('/');
-            String filename = (lastSlash >= 0) ? fullPath.substring(lastSlash + 1) : fullPath;
+    // CRC of the first SD_PROBE_BYTES of a file, 0 if unreadable
+    uint32_t probeCrc(const char* path) {
+        File file = SD.open(path, FILE_READ);
+        if (!file) return 0;
+        uint8_t buf[512];
+        uint32_t crc = 0;
+        size_t total = 0;
+        while (total < SD_PROBE_BYTES) {
+            size_t n = file.read(buf, sizeof(buf));
+            if (n == 0) break;
+            crc = crc32Update(crc, buf, n);
+            total += n;
+        }
+        file.close();
+        return total > 0 ? crc : 0;
+    }
 
-            // Skip macOS resource fork files (start with ._)
-            if (filename.startsWith("._")) {
-                Serial.printf("Skipping macOS file: %s\n", fullPath.c_str());
-                continue;
+    void probeSpiFrequency(const char* path) {
+        const uint32_t candidates[] = {40000000, 26666667};
+        uint32_t reference = probeCrc(path);
+        if (reference == 0) return;
+
+        for (uint32_t hz : candidates) {
+            SD.end();
+            if (!SD.begin(SD_CS, SPI, hz)) continue;
+            bool stable = true;
+            for (uint8_t r = 0; r < SD_PROBE_READS && stable; r++) {
+                stable = probeCrc(path) == reference;
             }
-
-            // Check if it's a WAV file
-            if (filename.endsWith(".wav") || filename.endsWith(".WAV")) {
-                // Ensure path starts with /
-                String path = fullPath;
-                if (!path.startsWith("/")) {
-                    path = "/" + path;
-                }
-                wavFiles.push_back(path);
-                Serial.printf("Added WAV: %s\n", path.c_str());
+            if (stable) {
+                spiFrequency = hz;
+                LOG_INFO("SD SPI clock: %u Hz\n", (unsigned)hz);
+                return;
             }
+            LOG_WARN("SD SPI %u Hz failed CRC check\n", (unsigned)hz);
         }
-        root.close();
-
-        // Sort files alphabetically
-        std::sort(wavFiles.begin(), wavFiles.end());
 
-        Serial.printf("Total WAV files found: %d\n", wavFiles.size());
+        // Nothing faster was stable: back to the known-good clock
+        SD.end();
+        SD.begin(SD_CS, SPI, SD_SAFE_HZ);
+        spiFrequency = SD_SAFE_HZ;
+        LOG_INFO("SD SPI clock: %u Hz (safe)\n", (unsigned)SD_SAFE_HZ);
     }
 
-    uint8_t getWavFileCount() {
-        return wavFiles.size();
+    // WAV files in the browser's current folder. Reads the whole folder,
+    // so prefer SampleBrowser::nextFile() for stepping through it.
+    uint32_t getWavFileCount() {
+        return browser.fileCount();
     }
 
-    const char* getWavFileName(uint8_t index) {
-        if (index < wavFiles.size()) {
-            return wavFiles[index].c_str();
-        }
-        return "";
+    // Full path of the browser entry at index
+    const char* getWavFileName(uint32_t index) {
+        return browser.pathOf(index);
     }
 
     // Get short name for display (without path and extension)
-    String getShortName(uint8_t index) {
-        if (index >= wavFiles.size()) return "---";
-        String name = wavFiles[index];
-        // Remove leading /
-        if (name.startsWith("/")) name = name.substring(1);
+    String getShortName(uint32_t index) {
+        const BrowserEntry* e = browser.entry(index);
+        if (!e) return "---";
+        String name = browser.name(*e);
         // Remove .wav extension
         int dotPos = name.lastIndexOf('.');
         if (dotPos > 0) name = name.substring(0, dotPos);
@@ -138,21 +201,22 @@ public:
     }
 
     bool loadSample(uint8_t index, const char* filename) {
-        Serial.printf("loadSample(%d, %s)\n", index, filename);
+        LOG_DEBUG("loadSample(%d, %s)\n", index, filename);
+        TRACE(TraceEvent::LoadBegin, index);
 
-        if (index >= MAX_SAMPLES || !sdInitialized) {
-            Serial.printf("Cannot load: idx=%d sd=%d\n", index, sdInitialized);
+        if (index >= Config::samples || !sdInitialized) {
+            LOG_WARN("Cannot load: idx=%d sd=%d\n", index, sdInitialized);
             return false;
         }
 
         File file = SD.open(filename, FILE_READ);
         if (!file) {
-            Serial.printf("Failed to open: %s\n", filename);
+            LOG_DEBUG("Failed to open: %s\n", filename);
             // Try without leading slash
             if (filename[0] == '/') {
                 file = SD.open(filename + 1, FILE_READ);
                 if (!file) {
-                    Serial.printf("Also failed: %s\n", filename + 1);
+                    LOG_WARN("Also failed: %s\n", filename + 1);
                     return false;
                 }
             } else {
@@ -160,129 +224,600 @@ public:
             }
         }
 
-        Serial.printf("File opened, size=%d\n", file.size());
+        LOG_DEBUG("File opened, size=%d\n", file.size());
 
-        // Read WAV header
-        WavHeader header;
-        file.read((uint8_t*)&header, sizeof(WavHeader));
+        uint32_t sourceSize = file.size();
+        bool ok = loadFromSource(index, filename, file);
+        file.close();
+        if (ok) persistThumbnail(index, filename, sourceSize);
+        return ok;
+    }
 
-        // Validate WAV format
-        if (memcmp(header.riff, "RIFF", 4) != 0 ||
-            memcmp(header.wave, "WAVE", 4) != 0) {
-            Serial.printf("%s is not a valid WAV file\n", filename);
-            file.close();
-            return false;
-        }
+    // Loads filenames[i] into slot i for every file, with SD reads on the
+    // other core overlapping decoding. Files are read in directory order,
+    // which on a card filled by copying follows cluster order, so the card
+    // sees mostly sequential multi-sector reads. Returns files loaded.
+    uint8_t loadKit(const char* const* filenames, uint8_t count, bool* loaded) {
+        if (count > KIT_MAX_FILES) count = KIT_MAX_FILES;
+        for (uint8_t i = 0; i < count; i++) loaded[i] = false;
+        if (!sdInitialized) return 0;
+
+        uint8_t order[KIT_MAX_FILES];
+        directoryOrder(filenames, count, order);
+
+        uint32_t start = millis();
+        bool ran = kitLoader.run(filenames, order, count, [&](uint8_t i, KitSource& src) {
+            TRACE(TraceEvent::LoadBegin, i);
+            if (i < Config::samples) {
+                loaded[i] = loadFromSource(i, filenames[i], src);
+            }
+        });
 
-        // Debug: print WAV info
-        Serial.printf("WAV: %s - %dHz %dbit %dch\n",
-            filename, header.sampleRate, header.bitsPerSample, header.numChannels);
+        // No memory for the pipeline: fall back to one file at a time
+        if (!ran) {
+            for (uint8_t i = 0; i < count; i++) loaded[i] = loadSample(i, filenames[i]);
+        }
 
-        // Skip to data chunk
-        if (header.fmtSize > 16) {
-            file.seek(file.position() + (header.fmtSize - 16));
+        lastKit.files = 0;
+        for (uint8_t i = 0; i < count; i++) lastKit.files += loaded[i];
+        lastKit.bytes = ran ? kitLoader.bytesRead : 0;
+        lastKit.ms = millis() - start;
+        LOG_INFO("Kit: %d files, %u bytes in %u ms (%.2f MB/s)\n", lastKit.files,
+                 (unsigned)lastKit.bytes, (unsigned)lastKit.ms, lastKit.mbPerSec());
+
+        if (ran) {
+            for (uint8_t i = 0; i < count; i++) {
+                if (!loaded[i]) continue;
+                File file = SD.open(filenames[i], FILE_READ);
+                if (!file) continue;
+                uint32_t sourceSize = file.size();
+                file.close();
+                persistThumbnail(i, filenames[i], sourceSize);
+            }
         }
+        return lastKit.files;
+    }
 
-        // Find data chunk
-        char chunkId[4];
-        uint32_t dataSize = 0;
-        while (file.available()) {
-            file.read((uint8_t*)chunkId, 4);
-            file.read((uint8_t*)&dataSize, 4);
+    // Fills order with indices into filenames sorted by their position in
+    // the root directory; files not found there keep their relative order
+    // at the end
+    void directoryOrder(const char* const* filenames, uint8_t count, uint8_t* order) {
+        uint8_t placed = 0;
+        bool used[KIT_MAX_FILES] = {false};
 
-            if (memcmp(chunkId, "data", 4) == 0) {
-                break;
+        File root = SD.open("/");
+        while (root && placed < count) {
+            File entry = root.openNextFile();
+            if (!entry) break;
+            const char* name = entry.name();
+            if (name[0] == '/') name++;
+            for (uint8_t i = 0; i < count; i++) {
+                const char* want = filenames[i][0] == '/' ? filenames[i] + 1 : filenames[i];
+                if (!used[i] && strcmp(name, want) == 0) {
+                    used[i] = true;
+                    order[placed++] = i;
+                }
             }
-            file.seek(file.position() + dataSize);
+            entry.close();
+        }
+        if (root) root.close();
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (!used[i]) order[placed++] = i;
         }
+    }
 
-        if (dataSize == 0) {
-            Serial.printf("No data chunk in %s\n", filename);
-            file.close();
+    // Decodes a WAV from any WavDecoder source into slot index
+    template <typename Source>
+    bool loadFromSource(uint8_t index, const char* filename, Source& file) {
+        // Parse header and locate the data chunk
+        WavInfo info;
+        if (!decoder.readInfo(file, info)) {
+            LOG_WARN("%s is not a supported WAV file\n", filename);
             return false;
         }
 
-        // Calculate samples
-        size_t bytesPerSample = header.bitsPerSample / 8;
-        size_t numSamples = dataSize / bytesPerSample;
+        LOG_DEBUG("WAV: %s - fmt 0x%x %dHz %dbit %dch\n",
+            filename, info.format, info.sampleRate, info.bitsPerSample, info.channels);
+
+        if (info.frames == 0) {
+            LOG_WARN("No audio data in %s\n", filename);
+            return false;
+        }
 
-        // Free existing data
+        size_t numSamples = info.frames;
+
+        // Retire existing data
+        dropStretch(index);
         if (samples[index].data != nullptr) {
-            free(samples[index].data);
+            // Slot i plays on channel i; the mixer may still be reading the
+            // old sample until the output drains
+            stopVoice(index % VOICES);
+            cancelTails(index);
+            attacks.invalidate();
+            retire(samples[index].data, index % VOICES, true);
             samples[index].data = nullptr;
         }
 
-        // Allocate memory (PSRAM preferred)
-        samples[index].data = (int16_t*)ps_malloc(numSamples * sizeof(int16_t));
-        if (!samples[index].data) {
-            samples[index].data = (int16_t*)malloc(numSamples * sizeof(int16_t));
+        // PSRAM, or internal RAM while the reserve allows. A stereo build
+        // keeps a stereo file's side and the stereo render in the same block.
+        const bool keepSide = STEREO && info.channels == 2;
+        static_assert((uint64_t)WAV_MAX_FRAMES * 4 * sizeof(int16_t) <= 0xFFFFFFFFu,
+                      "sample buffer size must fit a 32-bit size_t");
+        const size_t blockSamples = numSamples * (1 + keepSide + (STEREO ? 2 : 0));
+        samples[index].data = (int16_t*)memAlloc(MemTag::Samples, blockSamples * sizeof(int16_t));
+        if (!samples[index].data && retiredCount) {
+            drainRetired();
+            samples[index].data = (int16_t*)memAlloc(MemTag::Samples, blockSamples * sizeof(int16_t));
         }
 
         if (!samples[index].data) {
-            Serial.printf("Memory allocation failed for %s\n", filename);
-            file.close();
+            // The old sample is gone: leave nothing that points into it
+            LOG_ERROR("Memory allocation failed for %s\n", filename);
+            Sample& s = samples[index];
+            s.side = nullptr;
+            s.stereo = nullptr;
+            s.length = 0;
+            s.loaded = false;
+            s.wave.build(nullptr, 0);
+            s.slices = SliceTable();
+            s.mode = SampleMode::OneShot;
             return false;
         }
+        samples[index].side = keepSide ? samples[index].data + numSamples : nullptr;
+        samples[index].stereo = STEREO ? samples[index].data + numSamples * (1 + keepSide) : nullptr;
 
-        // Read audio data
-        if (header.bitsPerSample == 16) {
-            file.read((uint8_t*)samples[index].data, dataSize);
-        } else if (header.bitsPerSample == 8) {
-            uint8_t* temp = (uint8_t*)malloc(dataSize);
-            if (temp) {
-                file.read(temp, dataSize);
-                for (size_t i = 0; i < numSamples; i++) {
-                    samples[index].data[i] = (int16_t)((temp[i] - 128) << 8);
-                }
-                free(temp);
-            }
-        }
-
-        file.close();
+        // Stream, convert and downmix into the sample buffer
+        numSamples = decoder.decode(file, info, samples[index].data, numSamples, samples[index].side);
 
+        samples[index].wave.build(samples[index].data, numSamples);
+        if (!slicer.analyze(samples[index].data, numSamples, info.sampleRate, samples[index].slices)) {
+            samples[index].mode = SampleMode::OneShot;
+        } else if (samples[index].mode == SampleMode::Slice && samples[index].slices.count < 2) {
+            samples[index].mode = SampleMode::OneShot;
+        }
         samples[index].length = numSamples;
-        samples[index].sampleRate = header.sampleRate;
+        samples[index].sampleRate = info.sampleRate;
         samples[index].loaded = true;
+        if (STEREO) {
+            renderPan(samples[index], 0, numSamples, samples[index].pan);
+            samples[index].renderedPan = samples[index].pan;
+        }
 
         // Store short name
         String shortName = filename;
-        if (shortName.startsWith("/")) shortName = shortName.substring(1);
+        int lastSlash = shortName.lastIndexOf('/');
+        if (lastSlash >= 0) shortName = shortName.substring(lastSlash + 1);
         int dotPos = shortName.lastIndexOf('.');
         if (dotPos > 0) shortName = shortName.substring(0, dotPos);
         strncpy(samples[index].name, shortName.c_str(), 15);
 
-        Serial.printf("Loaded %s: %d samples @ %dHz\n",
-                      filename, numSamples, header.sampleRate);
+        LOG_INFO("Loaded %s: %d samples @ %dHz\n",
+                      filename, numSamples, info.sampleRate);
 
         if (index >= sampleCount) sampleCount = index + 1;
 
+        TRACE(TraceEvent::LoadEnd, index);
         return true;
     }
 
+    // Writes the slot's thumbnail to the cache unless it's already there
+    void persistThumbnail(uint8_t index, const char* filename, uint32_t sourceSize) {
+        const WaveformPyramid& wave = samples[index].wave;
+        if (wave.isCached(filename, sourceSize)) return;
+        if (!wave.save(filename, sourceSize)) {
+            LOG_WARN("Could not cache thumbnail for %s\n", filename);
+        }
+    }
+
+    // Cached thumbnail of a file that may not be loaded; false if none
+    bool loadThumbnail(const char* filename, WaveformPyramid& out) {
+        File file = SD.open(filename, FILE_READ);
+        if (!file) return false;
+        uint32_t sourceSize = file.size();
+        file.close();
+        return out.load(filename, sourceSize);
+    }
+
     void playSample(uint8_t index, uint8_t channel = 0) {
-        if (index >= MAX_SAMPLES || !samples[index].loaded) {
-            Serial.printf("playSample: index %d not loaded\n", index);
+        if (index >= Config::samples || !samples[index].loaded) {
+            LOG_DEBUG("playSample: index %d not loaded\n", index);
             return;
         }
 
-        Serial.printf("Playing sample %d on ch %d\n", index, channel);
+        tails[channel % VOICES].length = 0;
+        cutRetired(channel % VOICES);
+        TRACE(TraceEvent::SampleTrigger, (index << 8) | channel);
         M5Cardputer.Speaker.playRaw(
-            samples[index].data,
-            samples[index].length,
+            STEREO ? samples[index].stereo : samples[index].data,
+            samples[index].length * OUT_CHANNELS,
             samples[index].sampleRate,
-            false,
+            STEREO,
             1,
-            channel % 4,  // Use channels 0-3
+            channel % VOICES,
             true
         );
     }
 
+    // Plays slot index for a sequencer step, as its mode says. stepNumber
+    // is the running step count, which places the step within a loop.
+    // The attack comes from internal RAM when prefetchStep() was called
+    // for it a block ahead.
+    void playStep(uint8_t index, uint32_t stepNumber, uint8_t channel) {
+        const int16_t* data;
+        size_t length;
+        if (!stepSource(index, stepNumber, data, length)) return;
+        TRACE(TraceEvent::SampleTrigger, (index << 8) | channel);
+
+        const uint8_t ch = channel % VOICES;
+        const uint32_t rate = samples[index].sampleRate;
+        tails[ch].length = 0;
+        cutRetired(ch);
+        const AttackLine* line = attacks.take(ch, data);
+        if (!line) {
+            M5Cardputer.Speaker.playRaw(data, length, rate, STEREO, 1, ch, true);
+            return;
+        }
+        M5Cardputer.Speaker.playRaw(line->data, line->frames, rate, STEREO, 1, ch, true);
+        if (length > line->frames) {
+            tails[ch].data = data + line->frames;
+            tails[ch].length = length - line->frames;
+            tails[ch].sampleRate = rate;
+            tails[ch].slot = index;
+        }
+    }
+
+    // Copies the attack of what playStep() will play into internal RAM
+    void prefetchStep(uint8_t index, uint32_t stepNumber, uint8_t channel) {
+        const int16_t* data;
+        size_t length;
+        if (stepSource(index, stepNumber, data, length)) {
+            attacks.prefetch(channel % VOICES, data, length);
+        }
+    }
+
+    // Queues the rest of each voice started from an attack copy once its
+    // channel has room. Returns true while any are still waiting.
+    bool feedVoices() {
+        bool waiting = false;
+        for (uint8_t ch = 0; ch < VOICES; ch++) {
+            VoiceTail& t = tails[ch];
+            if (t.length == 0) continue;
+            size_t queued = M5Cardputer.Speaker.isPlaying(ch);
+            if (queued >= 2) {
+                waiting = true;
+                continue;
+            }
+            if (queued == 0) attacks.stats.lateTails++;
+            M5Cardputer.Speaker.playRaw(t.data, t.length, t.sampleRate, STEREO, 1, ch, false);
+            t.length = 0;
+        }
+        return waiting;
+    }
+
+    // One mixer block: how far ahead triggers are prefetched
+    uint32_t blockUs() {
+        auto cfg = M5Cardputer.Speaker.config();
+        if (cfg.sample_rate == 0) return 0;
+        return (uint32_t)((uint64_t)cfg.dma_buf_len * 1000000 / cfg.sample_rate);
+    }
+
+    // Next mode a slot supports: slicing needs a loop with at least two
+    // slices, stretching any loop. Returns the mode now set.
+    SampleMode cycleMode(uint8_t index) {
+        if (index >= Config::samples) return SampleMode::OneShot;
+        Sample& s = samples[index];
+        switch (s.mode) {
+            case SampleMode::OneShot:
+                s.mode = s.slices.count >= 2 ? SampleMode::Slice
+                       : s.slices.isLoop() ? SampleMode::Stretch : SampleMode::OneShot;
+                break;
+            case SampleMode::Slice:
+                s.mode = s.slices.isLoop() ? SampleMode::Stretch : SampleMode::OneShot;
+                break;
+            case SampleMode::Stretch:
+                s.mode = SampleMode::OneShot;
+                break;
+        }
+        if (s.mode != SampleMode::Stretch) dropStretch(index);
+        return s.mode;
+    }
+
+    // Whether a Stretch-mode slot still needs rendering for bpm
+    bool stretchPending(uint16_t bpm) const {
+        if (renderSlot >= 0) return true;
+        for (uint8_t i = 0; i < Config::samples; i++) {
+            const Sample& s = samples[i];
+            if (s.loaded && s.mode == SampleMode::Stretch && s.stretchedBpm != bpm) return true;
+        }
+        return false;
+    }
+
+    // Frees retired blocks the speaker task can no longer be reading:
+    // their voice has gone quiet, or was cut and the output has drained
+    void freeRetired() {
+        uint8_t kept = 0;
+        for (uint8_t i = 0; i < retiredCount; i++) {
+            const RetiredBlock& r = retired[i];
+            if (r.cut ? micros() - r.cutUs >= outputLatencyUs()
+                      : tails[r.voice].length == 0 && !M5Cardputer.Speaker.isPlaying(r.voice)) {
+                memFree(r.data);
+            } else {
+                retired[kept++] = r;
+            }
+        }
+        retiredCount = kept;
+    }
+
+    // Renders up to maxFrames of the next time-stretch owed for bpm.
+    // The finished render replaces the slot's previous one, which is
+    // retired until its channel has stopped playing it or been
+    // retriggered. Returns false when there was nothing it could render yet.
+    bool updateStretch(uint16_t bpm, size_t maxFrames) {
+        freeRetired();
+
+        // A tempo change restarts the render
+        if (renderSlot >= 0 && renderBpm != bpm) {
+            memFree(renderBuffer);
+            renderBuffer = nullptr;
+            renderSlot = -1;
+        }
+
+        if (renderSlot < 0) {
+            if (retiredCount) return false;
+            for (uint8_t i = 0; i < Config::samples && renderSlot < 0; i++) {
+                Sample& s = samples[i];
+                if (!s.loaded || s.mode != SampleMode::Stretch || s.stretchedBpm == bpm) continue;
+                size_t length = WsolaStretcher::stretchedLength(s.length, s.slices.bpm, bpm);
+                renderBuffer = (int16_t*)memAlloc(MemTag::Stretch,
+                                                  length * (1 + (STEREO ? 2 : 0)) * sizeof(int16_t));
+                if (!renderBuffer) {
+                    LOG_WARN("No memory to stretch %s\n", s.name);
+                    s.mode = SampleMode::OneShot;
+                    continue;
+                }
+                stretcher.begin(s.data, s.length, renderBuffer, length, s.sampleRate);
+                renderSlot = i;
+                renderBpm = bpm;
+                renderLength = length;
+                renderPanFrames = 0;
+                renderPanValue = s.pan;
+            }
+            if (renderSlot < 0) return false;
+        }
+
+        if (!stretcher.process(maxFrames)) return true;
+
+        // Then its stereo render, with the slot's pan when the render began
+        Sample& s = samples[renderSlot];
+        if (STEREO && renderPanFrames < renderLength) {
+            const size_t n = renderLength - renderPanFrames < maxFrames ? renderLength - renderPanFrames
+                                                                        : maxFrames;
+            panMono(renderBuffer + renderPanFrames, renderBuffer + renderLength + 2 * renderPanFrames,
+                    n, stretchGains(s, renderPanValue));
+            renderPanFrames += n;
+            if (renderPanFrames < renderLength) return true;
+        }
+
+        if (s.stretched) retire(s.stretched, renderSlot % VOICES, false);
+        s.stretched = renderBuffer;
+        s.stretchedStereo = STEREO ? renderBuffer + renderLength : nullptr;
+        s.stretchedLength = renderLength;
+        s.stretchedBpm = renderBpm;
+        if (STEREO && renderPanValue != s.renderedPan) s.renderedPan = PAN_STALE;
+        LOG_DEBUG("Stretched %s from %.1f to %u BPM\n", s.name, s.slices.bpm, renderBpm);
+        renderBuffer = nullptr;
+        renderSlot = -1;
+        return true;
+    }
+
+    // Sets a slot's pan; its stereo renders follow in updatePan()
+    void setPan(uint8_t index, int8_t pan) {
+        if (index < Config::samples) samples[index].pan = panClamp(pan);
+    }
+
+    // Whether a slot's stereo renders are behind its pan
+    bool panPending() const {
+        if (!STEREO) return false;
+        for (uint8_t i = 0; i < Config::samples; i++) {
+            if (samples[i].loaded && samples[i].renderedPan != samples[i].pan) return true;
+        }
+        return false;
+    }
+
+    // Re-renders up to maxFrames of the stereo renders of the next slot
+    // whose pan changed: the sample, then its stretch render. In place, so
+    // a voice playing from them picks the new pan up where it has got to.
+    void updatePan(size_t maxFrames) {
+        if (!STEREO) return;
+        if (panSlot >= 0 && samples[panSlot].pan != panValue) panSlot = -1;  // Changed again
+        if (panSlot < 0) {
+            for (uint8_t i = 0; i < Config::samples && panSlot < 0; i++) {
+                const Sample& s = samples[i];
+                if (!s.loaded || s.renderedPan == s.pan) continue;
+                panSlot = i;
+                panValue = s.pan;
+                panFrames = 0;
+            }
+            if (panSlot < 0) return;
+        }
+
+        Sample& s = samples[panSlot];
+        const size_t total = s.length + (s.stretched ? s.stretchedLength : 0);
+        while (maxFrames > 0 && panFrames < total) {
+            size_t n;
+            if (panFrames < s.length) {
+                n = s.length - panFrames < maxFrames ? s.length - panFrames : maxFrames;
+                renderPan(s, panFrames, n, panValue);
+            } else {
+                const size_t at = panFrames - s.length;
+                n = s.stretchedLength - at < maxFrames ? s.stretchedLength - at : maxFrames;
+                panMono(s.stretched + at, s.stretchedStereo + 2 * at, n, stretchGains(s, panValue));
+            }
+            panFrames += n;
+            maxFrames -= n;
+        }
+        if (panFrames >= total) {
+            s.renderedPan = panValue;
+            panSlot = -1;
+        }
+    }
+
+    // Delay from playRaw() to sound leaving the speaker: the speaker
+    // task's DMA ring has to drain first
+    uint32_t outputLatencyUs() {
+        auto cfg = M5Cardputer.Speaker.config();
+        if (cfg.sample_rate == 0) return 0;
+        return (uint32_t)((uint64_t)cfg.dma_buf_len * cfg.dma_buf_count * 1000000 / cfg.sample_rate);
+    }
+
     void setVolume(uint8_t volume) {
         M5Cardputer.Speaker.setVolume(volume);
     }
 
     void stopAll() {
         M5Cardputer.Speaker.stop();
+        for (uint8_t ch = 0; ch < VOICES; ch++) {
+            tails[ch].length = 0;
+            cutRetired(ch);
+        }
+    }
+
+    // Any voice still sounding (the output must not sleep)
+    bool isSounding() {
+        return M5Cardputer.Speaker.isPlaying();
+    }
+
+private:
+    int8_t renderSlot = -1;         // Slot being time-stretched, -1 if none
+    uint16_t renderBpm = 0;
+    int16_t* renderBuffer = nullptr;
+    size_t renderLength = 0;
+    // Memory the speaker task may still be reading, freed when silent
+    struct RetiredBlock {
+        int16_t* data;
+        uint8_t voice;
+        bool cut;                   // Its voice was stopped or retriggered at cutUs
+        uint32_t cutUs;
+    };
+    static constexpr uint8_t RETIRED_MAX = 4;
+    RetiredBlock retired[RETIRED_MAX];
+    uint8_t retiredCount = 0;
+    size_t renderPanFrames = 0;     // Of the stretch render's stereo render done
+    int8_t renderPanValue = 0;
+    int8_t panSlot = -1;            // Slot whose pan is being re-rendered, -1 if none
+    int8_t panValue = 0;
+    size_t panFrames = 0;           // Frames of it re-rendered
+    VoiceTail tails[VOICES];
+
+    // Frames [from, from + frames) of a slot's stereo render
+    static void renderPan(Sample& s, size_t from, size_t frames, int8_t pan) {
+        if (s.side) {
+            panMidSide(s.data + from, s.side + from, s.stereo + 2 * from, frames, panBalance(pan));
+        } else {
+            panMono(s.data + from, s.stereo + 2 * from, frames, panGains(pan));
+        }
+    }
+
+    // A stretch render is mono; one of a stereo file keeps the level it
+    // had at centre
+    static PanGains stretchGains(const Sample& s, int8_t pan) {
+        return s.side ? panBalance(pan) : panGains(pan);
+    }
+
+    // What a step plays of slot index: a slice, the stretched render or
+    // the whole sample, as samples of OUT_CHANNELS interleaved. False for
+    // nothing, e.g. a slice-mode step without a slice, which lets the
+    // previous slice play on.
+    bool stepSource(uint8_t index, uint32_t stepNumber, const int16_t*& data, size_t& length) const {
+        if (index >= Config::samples || !samples[index].loaded) return false;
+        const Sample& s = samples[index];
+        if (s.mode == SampleMode::Slice) {
+            int8_t slice = s.slices.sliceAt(stepNumber);
+            if (slice < 0) return false;
+            data = (STEREO ? s.stereo : s.data) + s.slices.start[slice] * OUT_CHANNELS;
+            length = (s.slices.end(slice) - s.slices.start[slice]) * OUT_CHANNELS;
+        } else if (s.mode == SampleMode::Stretch && s.stretched) {
+            data = STEREO ? s.stretchedStereo : s.stretched;
+            length = s.stretchedLength * OUT_CHANNELS;
+        } else {
+            data = STEREO ? s.stereo : s.data;
+            length = s.length * OUT_CHANNELS;
+        }
+        return true;
+    }
+
+    // A retrigger or stop of a retired block's voice stops it playing; a
+    // looped stretch never goes silent otherwise. The speaker task may
+    // still be mixing a block of it, so it's freed once the output has
+    // drained.
+    void cutRetired(uint8_t ch) {
+        for (uint8_t i = 0; i < retiredCount; i++) {
+            if (!retired[i].cut && retired[i].voice == ch) {
+                retired[i].cut = true;
+                retired[i].cutUs = micros();
+            }
+        }
+    }
+
+    void stopVoice(uint8_t ch) {
+        M5Cardputer.Speaker.stop(ch);
+        cutRetired(ch);
+    }
+
+    // Waits out the drain of every cut retired block and frees them, for
+    // an allocation that needs their memory back
+    void drainRetired() {
+        uint32_t waitUs = 0;
+        for (uint8_t i = 0; i < retiredCount; i++) {
+            const uint32_t drainedUs = micros() - retired[i].cutUs;
+            if (retired[i].cut && drainedUs < outputLatencyUs() && outputLatencyUs() - drainedUs > waitUs) {
+                waitUs = outputLatencyUs() - drainedUs;
+            }
+        }
+        if (waitUs) delayMicroseconds(waitUs);
+        freeRetired();
+    }
+
+    // Hands memory voice ch may still be playing to freeRetired(). With
+    // the list full, the oldest block is cut short and its drain waited out.
+    void retire(int16_t* data, uint8_t ch, bool cut) {
+        if (retiredCount == RETIRED_MAX) {
+            stopVoice(retired[0].voice);
+            const uint32_t drainedUs = micros() - retired[0].cutUs;
+            if (drainedUs < outputLatencyUs()) delayMicroseconds(outputLatencyUs() - drainedUs);
+            memFree(retired[0].data);
+            for (uint8_t i = 1; i < retiredCount; i++) retired[i - 1] = retired[i];
+            retiredCount--;
+        }
+        retired[retiredCount++] = {data, ch, cut, micros()};
+    }
+
+    // Drops queued tails that read from a slot's memory
+    void cancelTails(uint8_t index) {
+        for (uint8_t ch = 0; ch < VOICES; ch++) {
+            if (tails[ch].slot == index) tails[ch].length = 0;
+        }
+    }
+
+    // Stops using a slot's render, e.g. when its sample is replaced
+    void dropStretch(uint8_t index) {
+        Sample& s = samples[index];
+        if (panSlot == index) panSlot = -1;
+        if (renderSlot == index) {
+            memFree(renderBuffer);
+            renderBuffer = nullptr;
+            renderSlot = -1;
+        }
+        if (s.stretched) {
+            cancelTails(index);
+            attacks.invalidate();
+            retire(s.stretched, index % VOICES, false);
+            s.stretched = nullptr;
+            s.stretchedStereo = nullptr;
+        }
+        s.stretchedLength = 0;
+        s.stretchedBpm = 0;
     }
 };
 
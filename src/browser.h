@@ -0,0 +1,429 @@
+#ifndef BROWSER_H
+#define BROWSER_H
+
+// Sample browser over the SD card's folder tree. Directory entries are read
+// lazily in fixed-size pages, and only a few pages are cached at a time.
+// Names are interned in one string pool and referenced by 32-bit offset, so
+// memory use is the same for a folder of ten files or ten thousand.
+//
+// Entries are listed in directory order: sorting would need every name in
+// memory at once.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <cstdint>
+
+constexpr uint8_t BROWSER_PAGE_ENTRIES = 16;
+constexpr uint8_t BROWSER_CACHED_PAGES = 8;
+constexpr uint32_t BROWSER_POOL_BYTES = 8192;
+constexpr uint16_t BROWSER_POOL_SLOTS = 512;  // Dedup hash slots, power of two
+constexpr uint16_t BROWSER_NAME_MAX = 255;    // FAT long file name limit
+constexpr uint16_t BROWSER_PATH_MAX = 256;
+constexpr uint8_t BROWSER_PREFIX_MAX = 24;
+
+// Append-only pool of NUL-terminated strings. intern() returns the offset
+// of an existing copy when there is one, so pages that are evicted and read
+// again don't grow the pool.
+template <uint32_t BYTES, uint16_t SLOTS>
+class StringPool {
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+public:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+
+    StringPool() { clear(); }
+
+    void clear() {
+        used = 0;
+        live = 0;
+        for (uint16_t i = 0; i < SLOTS; i++) slots[i] = NONE;
+    }
+
+    // Offset of the interned copy of s[0..len), NONE if the pool is full
+    uint32_t intern(const char* s, size_t len) {
+        uint32_t hash = 2166136261u;  // FNV-1a
+        for (size_t i = 0; i < len; i++) hash = (hash ^ (uint8_t)s[i]) * 16777619u;
+
+        uint16_t slot = hash & (SLOTS - 1);
+        while (slots[slot] != NONE) {
+            const char* existing = data + slots[slot];
+            if (strncmp(existing, s, len) == 0 && existing[len] == 0) return slots[slot];
+            slot = (slot + 1) & (SLOTS - 1);
+        }
+
+        if (used + len + 1 > BYTES) return NONE;
+        uint32_t offset = used;
+        memcpy(data + used, s, len);
+        data[used + len] = 0;
+        used += len + 1;
+
+        // Past 3/4 load new strings are stored but no longer deduplicated
+        if (live < SLOTS * 3 / 4) {
+            slots[slot] = offset;
+            live++;
+        }
+        return offset;
+    }
+
+    const char* get(uint32_t offset) const { return offset < used ? data + offset : ""; }
+    uint32_t size() const { return used; }
+    uint32_t available() const { return BYTES - used; }
+
+private:
+    char data[BYTES];
+    uint32_t slots[SLOTS];
+    uint32_t used = 0;
+    uint16_t live = 0;
+};
+
+struct BrowserEntry {
+    uint32_t name;  // Offset into the browser's string pool
+    bool isDir;
+};
+
+struct BrowserPage {
+    static constexpr uint32_t EMPTY = 0xFFFFFFFF;
+    uint32_t first = EMPTY;  // Index of entries[0] in the folder
+    uint32_t lastUse = 0;
+    uint8_t count = 0;
+    BrowserEntry entries[BROWSER_PAGE_ENTRIES];
+};
+
+class SampleBrowser {
+public:
+    using Pool = StringPool<BROWSER_POOL_BYTES, BROWSER_POOL_SLOTS>;
+
+    uint32_t selected = 0;
+
+    // Lists the folder at path; false if it can't be opened
+    bool open(const char* path) {
+        if (dir) dir.close();
+        dir = SD.open(path);
+        if (!dir || !dir.isDirectory()) {
+            if (dir) dir.close();
+            return false;
+        }
+        strncpy(dirPath, path, BROWSER_PATH_MAX - 1);
+        dirPath[BROWSER_PATH_MAX - 1] = 0;
+        dirPos = 0;
+        total = 0;
+        totalKnown = false;
+        selected = 0;
+        clearSearch();
+        invalidate();
+        return true;
+    }
+
+    // Lets go of the folder handle, e.g. before the card is remounted;
+    // open() again before reading entries
+    void close() {
+        if (dir) dir.close();
+    }
+
+    const char* path() const { return dirPath; }
+
+    // Entry at index in the current folder, nullptr past the end. Reading
+    // a page before the one last read rewinds the directory.
+    const BrowserEntry* entry(uint32_t index) {
+        if (totalKnown && index >= total) return nullptr;
+        uint32_t first = index - index % BROWSER_PAGE_ENTRIES;
+        BrowserPage* page = findPage(first);
+        if (!page) page = loadPage(first);
+        if (!page || index - first >= page->count) return nullptr;
+        page->lastUse = ++useClock;
+        return &page->entries[index - first];
+    }
+
+    const char* name(const BrowserEntry& e) const { return pool.get(e.name); }
+
+    // Full path of the entry at index, valid until the next call
+    const char* pathOf(uint32_t index) {
+        const BrowserEntry* e = entry(index);
+        if (!e || !joinPath(pathBuf, dirPath, name(*e))) return "";
+        return pathBuf;
+    }
+
+    // Number of entries; reads to the end of the folder the first time
+    uint32_t count() {
+        if (!totalKnown) scan(dirPos, [](uint32_t, const char*, size_t, bool) { return false; });
+        return total;
+    }
+
+    // Number of WAV files (not folders); always reads the whole folder
+    uint32_t fileCount() {
+        uint32_t files = 0;
+        scan(0, [&](uint32_t, const char*, size_t, bool isDir) {
+            files += !isDir;
+            return false;
+        });
+        return files;
+    }
+
+    // Next WAV file from index in direction (+1/-1), wrapping at either
+    // end. Pass -1 with direction +1 for the first file. -1 if none. Only
+    // wrapping backwards needs the folder's length.
+    int32_t nextFile(int32_t from, int8_t direction) {
+        bool wrapped = false;
+        int32_t i = from;
+        while (true) {
+            i += direction;
+            if (i < 0) {
+                if (wrapped || count() == 0) return -1;
+                wrapped = true;
+                i = total - 1;
+            }
+            const BrowserEntry* e = entry(i);
+            if (!e) {
+                if (wrapped) return -1;
+                wrapped = true;
+                i = -1;
+                continue;
+            }
+            if (!e->isDir) return i;
+        }
+    }
+
+    // Index of the WAV file called name in the current folder, -1 if none
+    int32_t indexOf(const char* fileName) {
+        const size_t wanted = strlen(fileName);
+        return scan(0, [&](uint32_t, const char* n, size_t len, bool isDir) {
+            return !isDir && len == wanted && strncasecmp(n, fileName, len) == 0;
+        });
+    }
+
+    // Moves the selection, ending any search
+    void moveSelection(int32_t delta) {
+        clearSearch();
+        int64_t target = (int64_t)selected + delta;
+        if (target < 0) target = 0;
+        if (!entry((uint32_t)target)) {
+            target = totalKnown && total > 0 ? total - 1 : selected;
+        }
+        selected = (uint32_t)target;
+    }
+
+    // Opens the selected folder; false if the selection is a file
+    bool enterSelected() {
+        const BrowserEntry* e = entry(selected);
+        if (!e || !e->isDir) return false;
+        char child[BROWSER_PATH_MAX];
+        return joinPath(child, dirPath, name(*e)) && open(child);
+    }
+
+    // Opens the parent folder with the folder we came from selected
+    bool up() {
+        if (strcmp(dirPath, "/") == 0) return false;
+        char parent[BROWSER_PATH_MAX];
+        strcpy(parent, dirPath);
+        char* slash = strrchr(parent, '/');
+        char child[BROWSER_NAME_MAX + 1];
+        strncpy(child, slash + 1, BROWSER_NAME_MAX);
+        child[BROWSER_NAME_MAX] = 0;
+        if (slash == parent) slash++;
+        *slash = 0;
+        if (!open(parent)) return false;
+
+        int32_t found = scan(0, [&](uint32_t, const char* n, size_t len, bool isDir) {
+            return isDir && strlen(child) == len && strncmp(n, child, len) == 0;
+        });
+        if (found >= 0) selected = found;
+        return true;
+    }
+
+    // Incremental prefix search: each typed character narrows the match,
+    // searching forward from the current selection and wrapping once.
+    // Matching is case-insensitive. Returns false if nothing matches.
+    bool typeChar(char c) {
+        if (prefixLen >= BROWSER_PREFIX_MAX) return false;
+        if (prefixLen == 0) searchStart = selected;
+        prefix[prefixLen++] = c;
+        prefix[prefixLen] = 0;
+        // Usually the current match still fits, and a match for the longer
+        // prefix can't come before it
+        if (matchName[0] && strncasecmp(matchName, prefix, prefixLen) == 0) return true;
+        return findPrefix(selected);
+    }
+
+    bool backspace() {
+        if (prefixLen == 0) return false;
+        prefix[--prefixLen] = 0;
+        if (prefixLen == 0) {
+            selected = searchStart;
+            matchName[0] = 0;
+            return true;
+        }
+        return findPrefix(searchStart);
+    }
+
+    void clearSearch() {
+        prefixLen = 0;
+        prefix[0] = 0;
+        matchName[0] = 0;
+    }
+
+    const char* searchPrefix() const { return prefix; }
+
+    uint32_t poolBytes() const { return pool.size(); }
+
+private:
+    File dir;
+    char dirPath[BROWSER_PATH_MAX] = "/";
+    char pathBuf[BROWSER_PATH_MAX];
+    uint32_t dirPos = 0;  // Index of the entry the next read returns
+    uint32_t total = 0;
+    bool totalKnown = false;
+
+    Pool pool;
+    BrowserPage pages[BROWSER_CACHED_PAGES];
+    uint32_t useClock = 0;
+
+    char prefix[BROWSER_PREFIX_MAX + 1] = {0};
+    uint8_t prefixLen = 0;
+    uint32_t searchStart = 0;
+    char matchName[BROWSER_NAME_MAX + 1] = {0};  // Name at selected after a search
+
+    // False if the result doesn't fit in BROWSER_PATH_MAX
+    static bool joinPath(char* out, const char* dirPath, const char* name) {
+        bool root = dirPath[0] == '/' && dirPath[1] == 0;
+        int n = snprintf(out, BROWSER_PATH_MAX, "%s/%s", root ? "" : dirPath, name);
+        return n > 0 && n < BROWSER_PATH_MAX;
+    }
+
+    static bool isWavName(const char* name, size_t len) {
+        return len > 4 && strcasecmp(name + len - 4, ".wav") == 0;
+    }
+
+    void invalidate() {
+        pool.clear();
+        for (BrowserPage& page : pages) page.first = BrowserPage::EMPTY;
+    }
+
+    BrowserPage* findPage(uint32_t first) {
+        for (BrowserPage& page : pages) {
+            if (page.first == first) return &page;
+        }
+        return nullptr;
+    }
+
+    // Reads the page starting at first into the cache. Going backwards
+    // means rewinding and re-reading from the start of the folder, so the
+    // pages leading up to it are read in the same pass to fill half the
+    // cache; scrolling back through them then costs nothing.
+    BrowserPage* loadPage(uint32_t first) {
+        uint32_t start = first;
+        if (first < dirPos) {
+            uint32_t back = (BROWSER_CACHED_PAGES / 2 - 1) * BROWSER_PAGE_ENTRIES;
+            start = first > back ? first - back : 0;
+        }
+        BrowserPage* page = nullptr;
+        for (uint32_t p = start; p <= first; p += BROWSER_PAGE_ENTRIES) {
+            page = findPage(p);
+            if (!page) page = fillPage(p);
+            if (!page) return nullptr;
+            page->lastUse = ++useClock;
+        }
+        return page;
+    }
+
+    BrowserPage* fillPage(uint32_t first) {
+        // Make sure a whole page of maximum-length names fits
+        if (pool.available() < BROWSER_PAGE_ENTRIES * (BROWSER_NAME_MAX + 1)) invalidate();
+
+        BrowserPage* page = &pages[0];
+        for (BrowserPage& p : pages) {
+            if (p.first == BrowserPage::EMPTY) {
+                page = &p;
+                break;
+            }
+            if (p.lastUse < page->lastUse) page = &p;
+        }
+        page->first = BrowserPage::EMPTY;
+        page->count = 0;
+
+        if (!seekEntry(first)) return nullptr;
+        while (page->count < BROWSER_PAGE_ENTRIES &&
+               readEntry([&](const char* n, size_t len, bool isDir) {
+                   page->entries[page->count++] = {pool.intern(n, len), isDir};
+               })) {
+        }
+        if (page->count == 0) return nullptr;
+        page->first = first;
+        return page;
+    }
+
+    bool seekEntry(uint32_t target) {
+        if (!dir) return false;
+        if (target < dirPos) {
+            dir.rewindDirectory();
+            dirPos = 0;
+        }
+        while (dirPos < target) {
+            if (!readEntry([](const char*, size_t, bool) {})) return false;
+        }
+        return true;
+    }
+
+    // Reads the next listed entry (a folder or WAV file, hidden names
+    // skipped) and passes its name to fn. False at the end of the folder.
+    template <typename Fn>
+    bool readEntry(Fn fn) {
+        while (true) {
+            File e = dir.openNextFile();
+            if (!e) {
+                total = dirPos;
+                totalKnown = true;
+                return false;
+            }
+            // Some cores return the full path, others just the name
+            const char* n = e.name();
+            const char* slash = strrchr(n, '/');
+            if (slash) n = slash + 1;
+            size_t len = strlen(n);
+            bool isDir = e.isDirectory();
+
+            if (n[0] != '.' && len <= BROWSER_NAME_MAX && (isDir || isWavName(n, len))) {
+                fn(n, len, isDir);
+                e.close();
+                dirPos++;
+                return true;
+            }
+            e.close();
+        }
+    }
+
+    // Streams entries from index from without caching them, stopping at
+    // the first one match() accepts. Returns its index or -1.
+    template <typename Fn>
+    int32_t scan(uint32_t from, Fn match) {
+        if (!seekEntry(from)) return -1;
+        int32_t found = -1;
+        while (found < 0) {
+            uint32_t index = dirPos;
+            if (!readEntry([&](const char* n, size_t len, bool isDir) {
+                    if (match(index, n, len, isDir)) found = index;
+                })) {
+                break;
+            }
+        }
+        return found;
+    }
+
+    bool findPrefix(uint32_t from) {
+        auto match = [this](uint32_t, const char* n, size_t len, bool) {
+            if (len < prefixLen || strncasecmp(n, prefix, prefixLen) != 0) return false;
+            memcpy(matchName, n, len);
+            matchName[len] = 0;
+            return true;
+        };
+        int32_t found = scan(from, match);
+        if (found < 0 && from > 0) found = scan(0, match);
+        if (found < 0) {
+            matchName[0] = 0;
+            return false;
+        }
+        selected = found;
+        return true;
+    }
+};
+
+#endif
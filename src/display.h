@@ -3,13 +3,51 @@
 
 #include <M5Cardputer.h>
 #include "sequencer.h"
+#include "browser.h"
+#include "waveform.h"
+#include "slicer.h"
+#include "engine.h"
+#include "memory.h"
+#include "pan.h"
 
-// Layout constants
-constexpr int16_t GRID_ORIGIN_X = 50;  // More space for sample names
-constexpr int16_t GRID_ORIGIN_Y = 35;
-constexpr int16_t CELL_WIDTH = 22;
-constexpr int16_t CELL_HEIGHT = 20;
-constexpr int16_t CELL_PADDING = 2;
+constexpr int16_t SCREEN_WIDTH = 240;
+constexpr int16_t SCREEN_HEIGHT = 135;
+
+constexpr int16_t layoutMin(int16_t a, int16_t b) { return a < b ? a : b; }
+
+// Step grid geometry for an engine configuration, worked out at compile
+// time. Cells are at most 22x20 (the 4x8 layout) and shrink to fit the
+// area between the step numbers and the playhead marker; on small cells
+// padding, rounding, labels and names drop out.
+template <typename Config>
+struct GridLayout {
+    static constexpr int16_t ORIGIN_X = 50;  // Sample names to the left
+    static constexpr int16_t ORIGIN_Y = 35;
+    static constexpr int16_t BOTTOM = 115;
+    static constexpr int16_t CELL_WIDTH = layoutMin(22, (SCREEN_WIDTH - ORIGIN_X - 2) / Config::steps);
+    static constexpr int16_t CELL_HEIGHT = layoutMin(20, (BOTTOM - ORIGIN_Y) / Config::tracks);
+    static constexpr int16_t CELL_PADDING = layoutMin(CELL_WIDTH, CELL_HEIGHT) >= 12 ? 2 : 1;
+    static constexpr int16_t INNER_WIDTH = CELL_WIDTH - CELL_PADDING * 2;
+    static constexpr int16_t INNER_HEIGHT = CELL_HEIGHT - CELL_PADDING * 2;
+    static constexpr int16_t CELL_RADIUS = layoutMin(INNER_WIDTH, INNER_HEIGHT) >= 8 ? 2 : 0;
+    static constexpr bool SHOW_NAMES = CELL_HEIGHT >= 9;     // 8 px font
+    static constexpr bool SHOW_MICRO = INNER_WIDTH >= 6;
+    static constexpr uint8_t LABEL_EVERY = CELL_WIDTH >= 12 ? 1 : CELL_WIDTH >= 6 ? 4 : 8;
+    static constexpr int16_t PLAYHEAD_HALF = layoutMin(4, CELL_WIDTH / 2);
+
+    static_assert(CELL_WIDTH >= 3 && CELL_HEIGHT >= 3, "grid doesn't fit the screen");
+};
+
+// Browser list
+constexpr int16_t BROWSER_ROW_HEIGHT = 11;
+constexpr uint8_t BROWSER_ROWS = 9;
+constexpr uint8_t BROWSER_NAME_CHARS = 38;
+constexpr int16_t BROWSER_PREVIEW_X = 136;  // Thumbnail of the selection, top right
+
+// Memory map: one row per tag, usage as a bar against the budget
+constexpr int16_t MEMORY_ROW_HEIGHT = 11;
+constexpr int16_t MEMORY_BAR_X = 56;
+constexpr int16_t MEMORY_BAR_WIDTH = 112;
 
 // Colors (RGB565)
 constexpr uint16_t COLOR_BG = 0x0000;           // Black
@@ -22,25 +60,126 @@ constexpr uint16_t COLOR_PLAYHEAD = 0xF800;     // Red
 constexpr uint16_t COLOR_TEXT = 0xFFFF;         // White
 constexpr uint16_t COLOR_TEXT_DIM = 0x8410;     // Gray
 constexpr uint16_t COLOR_HIGHLIGHT = 0x001F;    // Blue for selected track
+constexpr uint16_t COLOR_WAVE_PEAK = 0x2945;    // Dim gray-blue, behind names
+constexpr uint16_t COLOR_WAVE_RMS = 0x4A69;
+constexpr uint16_t COLOR_SLICE = 0xFD20;        // Orange, slice starts on thumbnails
+constexpr uint16_t COLOR_BEAT = 0x05FF;         // Cyan, beats of a stretched loop
+constexpr uint16_t COLOR_PAN = 0x07E0;          // Green, track pan under the name
 
+template <typename Config>
 class DisplayManager {
 public:
+    using Layout = GridLayout<Config>;
+
     M5Canvas canvas;
-    String sampleNames[NUM_INSTRUMENTS] = {"1", "2", "3", "4"};
+    String sampleNames[Config::tracks];
+    const WaveformPyramid* sampleWaves[Config::tracks] = {nullptr};
+    const SliceTable* sampleSlices[Config::tracks] = {nullptr};
+    SampleMode sampleModes[Config::tracks] = {};
+    int8_t samplePans[Config::tracks] = {0};
+    uint32_t browserTop = 0;  // First visible browser row
+    char recordStatus[12] = {0};  // e.g. "REC Q75", empty when idle
+
+    DisplayManager() {
+        for (uint8_t i = 0; i < Config::tracks; i++) sampleNames[i] = String(i + 1);
+    }
 
     void init() {
+        // Internal RAM: PSRAM would make every pushSprite a slow copy
         canvas.setColorDepth(16);
-        canvas.createSprite(240, 135);
+        canvas.setPsram(false);
+        canvas.createSprite(SCREEN_WIDTH, SCREEN_HEIGHT);
         canvas.setTextDatum(MC_DATUM);
+        memoryMap().note(MemTag::Canvas, canvas.bufferLength(), true);
     }
 
     void setSampleName(uint8_t track, const String& name) {
-        if (track < NUM_INSTRUMENTS) {
+        if (track < Config::tracks) {
             sampleNames[track] = name;
         }
     }
 
-    void drawAll(const Pattern& pattern, const Cursor& cursor,
+    void setRecordStatus(const char* status) {
+        strncpy(recordStatus, status, sizeof(recordStatus) - 1);
+        recordStatus[sizeof(recordStatus) - 1] = 0;
+    }
+
+    void setSampleWave(uint8_t track, const WaveformPyramid* wave) {
+        if (track < Config::tracks) {
+            sampleWaves[track] = wave;
+        }
+    }
+
+    // Slice starts (slice mode) or beats (stretch mode) are marked on the
+    // track's thumbnail
+    void setSampleMode(uint8_t track, SampleMode mode, const SliceTable* slices) {
+        if (track < Config::tracks) {
+            sampleModes[track] = mode;
+            sampleSlices[track] = slices;
+        }
+    }
+
+    void setSamplePan(uint8_t track, int8_t pan) {
+        if (track < Config::tracks) {
+            samplePans[track] = pan;
+        }
+    }
+
+    // Off-centre pan as a bar from the middle of the name area's bottom
+    // edge towards the side it's panned to
+    void drawPan(int8_t pan, int16_t x, int16_t y, int16_t w) {
+        if (pan == 0) return;
+        const int16_t mid = x + w / 2;
+        const int16_t end = mid + pan * (w / 2) / PAN_MAX;
+        canvas.drawFastHLine(pan < 0 ? end : mid, y, pan < 0 ? mid - end : end - mid, COLOR_PAN);
+    }
+
+    void drawSliceMarks(const SliceTable& slices, SampleMode mode, int16_t x, int16_t y,
+                        int16_t w, int16_t h) {
+        if (!slices.isLoop() || slices.frames == 0) return;
+        if (mode == SampleMode::Slice) {
+            for (uint8_t i = 1; i < slices.count; i++) {
+                canvas.drawFastVLine(x + (int32_t)((uint64_t)slices.start[i] * w / slices.frames),
+                                     y, h, COLOR_SLICE);
+            }
+        } else if (mode == SampleMode::Stretch) {
+            for (uint8_t beat = 4; beat < slices.loopSteps; beat += 4) {
+                canvas.drawFastVLine(x + beat * w / slices.loopSteps, y, h, COLOR_BEAT);
+            }
+        }
+    }
+
+    // Min/max envelope with the RMS band on top, one column per pixel.
+    // Each column reads at most two bins of a level chosen for the width.
+    void drawWaveform(const WaveformPyramid& wave, int16_t x, int16_t y, int16_t w, int16_t h,
+                      uint16_t peakColor, uint16_t rmsColor) {
+        if (!wave.valid() || w <= 0) return;
+        uint8_t level = WaveformPyramid::levelForWidth(w);
+        uint16_t bins = WaveformPyramid::levelBins(level);
+        uint16_t offset = WaveformPyramid::levelOffset(level);
+        int16_t mid = y + h / 2;
+        int32_t scale = h / 2;  // Full scale (128) maps to half the height
+
+        for (int16_t px = 0; px < w; px++) {
+            uint16_t b0 = (uint32_t)px * bins / w;
+            uint16_t b1 = (uint32_t)(px + 1) * bins / w;
+            if (b1 <= b0) b1 = b0 + 1;
+            int8_t lo = wave.minv[offset + b0], hi = wave.maxv[offset + b0];
+            uint8_t r = wave.rms[offset + b0];
+            for (uint16_t b = b0 + 1; b < b1; b++) {
+                lo = wave.minv[offset + b] < lo ? wave.minv[offset + b] : lo;
+                hi = wave.maxv[offset + b] > hi ? wave.maxv[offset + b] : hi;
+                r = wave.rms[offset + b] > r ? wave.rms[offset + b] : r;
+            }
+            int16_t top = mid - hi * scale / 128;
+            int16_t bottom = mid - lo * scale / 128;
+            canvas.drawFastVLine(x + px, top, bottom - top + 1, peakColor);
+            int16_t band = r * scale / 128;
+            canvas.drawFastVLine(x + px, mid - band, 2 * band + 1, rmsColor);
+        }
+    }
+
+    void drawAll(const Pattern<Config>& pattern, const Cursor& cursor,
                  const PlaybackState& playback) {
         // Clear
         canvas.fillSprite(COLOR_BG);
@@ -51,6 +190,12 @@ public:
         canvas.setTextDatum(ML_DATUM);
         canvas.drawString("SEQ", 2, 10);
 
+        // Recording / calibration status
+        if (recordStatus[0]) {
+            canvas.setTextColor(COLOR_PLAYHEAD);
+            canvas.drawString(recordStatus, 26, 10);
+        }
+
         // BPM
         char bpmStr[16];
         sprintf(bpmStr, "%d", playback.bpm);
@@ -75,11 +220,11 @@ public:
             canvas.drawString("STOP", 190, 11);
         }
 
-        // Step numbers (only up to pattern length)
+        // Step numbers (only up to pattern length), thinned out on narrow cells
         canvas.setTextColor(COLOR_TEXT_DIM);
         canvas.setTextDatum(MC_DATUM);
-        for (int col = 0; col < MAX_STEPS; col++) {
-            int16_t x = GRID_ORIGIN_X + col * CELL_WIDTH + CELL_WIDTH / 2;
+        for (uint8_t col = 0; col < Config::steps; col += Layout::LABEL_EVERY) {
+            int16_t x = Layout::ORIGIN_X + col * Layout::CELL_WIDTH + Layout::CELL_WIDTH / 2;
             if (col < playback.patternLength) {
                 canvas.setTextColor(COLOR_TEXT_DIM);
             } else {
@@ -89,53 +234,203 @@ public:
         }
 
         // Grid rows
-        for (int row = 0; row < NUM_INSTRUMENTS; row++) {
-            int16_t y = GRID_ORIGIN_Y + row * CELL_HEIGHT + CELL_HEIGHT / 2;
+        for (uint8_t row = 0; row < Config::tracks; row++) {
+            int16_t y = Layout::ORIGIN_Y + row * Layout::CELL_HEIGHT + Layout::CELL_HEIGHT / 2;
 
-            // Sample name (highlighted if cursor is on this row)
-            canvas.setTextDatum(MR_DATUM);
-            if (cursor.row == row) {
-                canvas.setTextColor(COLOR_CURSOR);
-            } else {
-                canvas.setTextColor(COLOR_TEXT);
+            // Waveform thumbnail behind the name
+            if (sampleWaves[row]) {
+                drawWaveform(*sampleWaves[row], 2, y - Layout::CELL_HEIGHT / 2 + Layout::CELL_PADDING,
+                             Layout::ORIGIN_X - 6, Layout::INNER_HEIGHT,
+                             COLOR_WAVE_PEAK, COLOR_WAVE_RMS);
+            }
+            if (sampleSlices[row] && sampleModes[row] != SampleMode::OneShot) {
+                drawSliceMarks(*sampleSlices[row], sampleModes[row], 2,
+                               y - Layout::CELL_HEIGHT / 2 + Layout::CELL_PADDING,
+                               Layout::ORIGIN_X - 6, Layout::INNER_HEIGHT);
             }
+            if (STEREO) {
+                drawPan(samplePans[row], 2,
+                        y - Layout::CELL_HEIGHT / 2 + Layout::CELL_PADDING + Layout::INNER_HEIGHT - 1,
+                        Layout::ORIGIN_X - 6);
+            }
+
+            // Sample name (highlighted if cursor is on this row); rows
+            // too short for text only get the thumbnail
+            if (Layout::SHOW_NAMES) {
+                canvas.setTextDatum(MR_DATUM);
+                if (cursor.row == row) {
+                    canvas.setTextColor(COLOR_CURSOR);
+                } else {
+                    canvas.setTextColor(COLOR_TEXT);
+                }
 
-            // Truncate name to fit
-            String dispName = sampleNames[row];
-            if (dispName.length() > 6) dispName = dispName.substring(0, 6);
-            canvas.drawString(dispName, GRID_ORIGIN_X - 4, y);
+                // Truncate name to fit
+                String dispName = sampleNames[row];
+                if (dispName.length() > 6) dispName = dispName.substring(0, 6);
+                canvas.drawString(dispName, Layout::ORIGIN_X - 4, y);
+            }
 
             // Cells
-            for (int col = 0; col < MAX_STEPS; col++) {
+            for (uint8_t col = 0; col < Config::steps; col++) {
                 bool active = pattern.getStep(row, col);
                 bool isCursor = (cursor.row == row && cursor.col == col);
                 bool isPlayhead = playback.isPlaying && (col == playback.currentStep);
                 bool inPattern = (col < playback.patternLength);
-                drawCell(row, col, active, isCursor, isPlayhead, inPattern);
+                drawCell(row, col, active, isCursor, isPlayhead, inPattern,
+                         pattern.getMicro(row, col));
             }
         }
 
         // Playhead indicator at bottom
         if (playback.isPlaying) {
-            int16_t x = GRID_ORIGIN_X + playback.currentStep * CELL_WIDTH + CELL_WIDTH / 2;
-            canvas.fillTriangle(x - 4, 128, x + 4, 128, x, 120, COLOR_PLAYHEAD);
+            int16_t x = Layout::ORIGIN_X + playback.currentStep * Layout::CELL_WIDTH + Layout::CELL_WIDTH / 2;
+            canvas.fillTriangle(x - Layout::PLAYHEAD_HALF, 128, x + Layout::PLAYHEAD_HALF, 128, x, 120,
+                                COLOR_PLAYHEAD);
         }
 
         // Help text at very bottom
         canvas.setTextDatum(MC_DATUM);
         canvas.setTextColor(0x4208);
-        canvas.drawString("z/x:sample []:len p:play", 120, 133);
+        canvas.drawString("z/x:smp b:browse []:len p:play", 120, 133);
 
         // Push to display
         canvas.pushSprite(&M5Cardputer.Display, 0, 0);
     }
 
+    // Sample browser for one track: current folder, search prefix, a
+    // thumbnail of the selected file if one is cached and a window of
+    // entries around the selection. Only visible rows are read.
+    void drawBrowser(SampleBrowser& browser, uint8_t track, const WaveformPyramid* preview) {
+        canvas.fillSprite(COLOR_BG);
+
+        if (preview) {
+            drawWaveform(*preview, BROWSER_PREVIEW_X, 1, SCREEN_WIDTH - BROWSER_PREVIEW_X - 2, 20,
+                         COLOR_GRID, COLOR_TEXT_DIM);
+        }
+
+        // Header: target track and folder. It has to end before the
+        // thumbnail, so a long path keeps its tail (the folder we're in)
+        char header[24];
+        const int prefix = snprintf(header, sizeof(header), "T%d ", track + 1);
+        const size_t room = sizeof(header) - 1 - prefix;
+        const char* path = browser.path();
+        const size_t pathLen = strlen(path);
+        if (pathLen > room) {
+            memcpy(header + prefix, "...", 3);
+            memcpy(header + prefix + 3, path + pathLen - (room - 3), room - 3 + 1);
+        } else {
+            memcpy(header + prefix, path, pathLen + 1);
+        }
+        canvas.setTextDatum(ML_DATUM);
+        canvas.setTextColor(COLOR_TEXT);
+        canvas.drawString(header, 2, 6);
+
+        // Search prefix
+        const char* search = browser.searchPrefix();
+        if (search[0]) {
+            char line[BROWSER_PREFIX_MAX + 3];
+            snprintf(line, sizeof(line), "?%s", search);
+            canvas.setTextColor(COLOR_CURSOR);
+            canvas.drawString(line, 2, 16);
+        }
+
+        // Keep the selection inside the visible window
+        if (browser.selected < browserTop) browserTop = browser.selected;
+        if (browser.selected >= browserTop + BROWSER_ROWS) {
+            browserTop = browser.selected - BROWSER_ROWS + 1;
+        }
+
+        for (uint8_t row = 0; row < BROWSER_ROWS; row++) {
+            uint32_t index = browserTop + row;
+            const BrowserEntry* e = browser.entry(index);
+            if (!e) {
+                if (row == 0) {
+                    canvas.setTextColor(COLOR_TEXT_DIM);
+                    canvas.drawString("(no WAV files)", 8, 28);
+                }
+                break;
+            }
+
+            int16_t y = 23 + row * BROWSER_ROW_HEIGHT;
+            if (index == browser.selected) {
+                canvas.fillRect(0, y, SCREEN_WIDTH, BROWSER_ROW_HEIGHT, COLOR_HIGHLIGHT);
+            }
+
+            char line[BROWSER_NAME_CHARS + 2];
+            snprintf(line, sizeof(line), "%s%s", browser.name(*e), e->isDir ? "/" : "");
+            canvas.setTextColor(e->isDir ? COLOR_CURSOR : COLOR_TEXT);
+            canvas.drawString(line, 8, y + BROWSER_ROW_HEIGHT / 2);
+        }
+
+        canvas.setTextDatum(MC_DATUM);
+        canvas.setTextColor(0x4208);
+        canvas.drawString(";.:move ent:load ,:up `:exit", 120, 130);
+
+        canvas.pushSprite(&M5Cardputer.Display, 0, 0);
+    }
+
+    // Memory map: heap left in internal RAM and PSRAM, then each tag's
+    // use in internal RAM (blue) and PSRAM (cyan) against its budget, its
+    // peak (yellow tick) and, in red, a tag that has gone over budget
+    void drawMemory(const MemoryMap& map) {
+        canvas.fillSprite(COLOR_BG);
+
+        char line[40];
+        canvas.setTextDatum(ML_DATUM);
+        canvas.setTextColor(COLOR_TEXT);
+        canvas.drawString("Memory", 2, 6);
+        snprintf(line, sizeof(line), "free int %uK ps %uK",
+                 (unsigned)(MemoryMap::heapFree(true) / 1024),
+                 (unsigned)(MemoryMap::heapFree(false) / 1024));
+        canvas.setTextDatum(MR_DATUM);
+        canvas.setTextColor(COLOR_TEXT_DIM);
+        canvas.drawString(line, SCREEN_WIDTH - 2, 6);
+
+        for (uint8_t i = 0; i < MEM_TAG_COUNT; i++) {
+            const MemUsage& u = map.usage[i];
+            const uint32_t budget = map.budgets[i] ? map.budgets[i] : 1;
+            const int16_t y = 17 + i * MEMORY_ROW_HEIGHT;
+            const int16_t mid = y + MEMORY_ROW_HEIGHT / 2;
+
+            canvas.setTextDatum(ML_DATUM);
+            canvas.setTextColor(u.fallbacks ? COLOR_SLICE : COLOR_TEXT);
+            canvas.drawString(MEM_POLICIES[i].name, 2, mid);
+
+            auto barWidth = [budget](uint32_t bytes) {
+                return (int16_t)((uint64_t)(bytes < budget ? bytes : budget) * MEMORY_BAR_WIDTH / budget);
+            };
+            const int16_t wInternal = barWidth(u.internal);
+            const int16_t wUsed = barWidth(u.used());
+            canvas.drawRect(MEMORY_BAR_X - 1, y + 1, MEMORY_BAR_WIDTH + 2, MEMORY_ROW_HEIGHT - 2,
+                            u.refused ? COLOR_PLAYHEAD : COLOR_GRID);
+            canvas.fillRect(MEMORY_BAR_X, y + 2, wInternal, MEMORY_ROW_HEIGHT - 4, COLOR_HIGHLIGHT);
+            canvas.fillRect(MEMORY_BAR_X + wInternal, y + 2, wUsed - wInternal,
+                            MEMORY_ROW_HEIGHT - 4, COLOR_BEAT);
+            const int16_t peak = barWidth(u.peak);
+            if (peak > 0) {
+                canvas.drawFastVLine(MEMORY_BAR_X + peak - 1, y + 1, MEMORY_ROW_HEIGHT - 2, COLOR_CURSOR);
+            }
+
+            snprintf(line, sizeof(line), "%u/%uK", (unsigned)((u.used() + 1023) / 1024),
+                     (unsigned)(map.budgets[i] / 1024));
+            canvas.setTextDatum(MR_DATUM);
+            canvas.setTextColor(u.refused ? COLOR_PLAYHEAD : COLOR_TEXT_DIM);
+            canvas.drawString(line, SCREEN_WIDTH - 2, mid);
+        }
+
+        canvas.setTextDatum(MC_DATUM);
+        canvas.setTextColor(0x4208);
+        canvas.drawString("orange:fell back to internal  h:exit", 120, 130);
+
+        canvas.pushSprite(&M5Cardputer.Display, 0, 0);
+    }
+
     void drawCell(uint8_t row, uint8_t col, bool active, bool isCursor,
-                  bool isPlayhead, bool inPattern) {
-        int16_t x = GRID_ORIGIN_X + col * CELL_WIDTH + CELL_PADDING;
-        int16_t y = GRID_ORIGIN_Y + row * CELL_HEIGHT + CELL_PADDING;
-        int16_t w = CELL_WIDTH - CELL_PADDING * 2;
-        int16_t h = CELL_HEIGHT - CELL_PADDING * 2;
+                  bool isPlayhead, bool inPattern, int8_t micro = 0) {
+        int16_t x = Layout::ORIGIN_X + col * Layout::CELL_WIDTH + Layout::CELL_PADDING;
+        int16_t y = Layout::ORIGIN_Y + row * Layout::CELL_HEIGHT + Layout::CELL_PADDING;
+        const int16_t w = Layout::INNER_WIDTH;
+        const int16_t h = Layout::INNER_HEIGHT;
 
         // Determine fill color
         uint16_t fillColor;
@@ -151,11 +446,25 @@ public:
             fillColor = COLOR_INACTIVE;
         }
 
-        canvas.fillRoundRect(x, y, w, h, 2, fillColor);
+        if (Layout::CELL_RADIUS) {
+            canvas.fillRoundRect(x, y, w, h, Layout::CELL_RADIUS, fillColor);
+        } else {
+            canvas.fillRect(x, y, w, h, fillColor);
+        }
+
+        // Micro-timing: tick along the bottom, centre is on the grid
+        if (Layout::SHOW_MICRO && active && micro != 0) {
+            int16_t tx = x + w / 2 + micro * w / MICRO_PER_STEP;
+            canvas.drawFastVLine(tx, y + h - 5, 4, COLOR_BG);
+        }
 
         // Cursor border
         if (isCursor) {
-            canvas.drawRoundRect(x - 1, y - 1, w + 2, h + 2, 3, COLOR_CURSOR);
+            if (Layout::CELL_RADIUS) {
+                canvas.drawRoundRect(x - 1, y - 1, w + 2, h + 2, Layout::CELL_RADIUS + 1, COLOR_CURSOR);
+            } else {
+                canvas.drawRect(x - 1, y - 1, w + 2, h + 2, COLOR_CURSOR);
+            }
         }
     }
 };
@@ -0,0 +1,56 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+// Compile-time engine dimensions. Sequencer, AudioManager and
+// DisplayManager are templates over one EngineConfig, so every track and
+// step loop has a constant bound and the pattern uses the narrowest step
+// mask that fits. The build picks a configuration with -DENGINE_TRACKS and
+// -DENGINE_STEPS (see the cardputer-8x16 and cardputer-16x32 environments).
+//
+// Playback has one speaker channel per track, but M5Unified mixes only 8:
+// past 8 tracks, track n shares a channel with track n mod 8, and a hit on
+// either cuts off whatever the other is still playing. Keep tails that must
+// overlap on tracks that don't share a channel.
+
+#include <cstdint>
+#include <type_traits>
+
+// Smallest unsigned type with at least BITS bits (up to 32)
+template <uint8_t BITS>
+using BitMask = typename std::conditional<BITS <= 8, uint8_t,
+                typename std::conditional<BITS <= 16, uint16_t, uint32_t>::type>::type;
+
+template <uint8_t TRACKS, uint8_t STEPS, uint8_t SAMPLES>
+struct EngineConfig {
+    static_assert(TRACKS >= 1 && TRACKS <= 16, "1-16 tracks");
+    static_assert(STEPS >= 1 && STEPS <= 32, "1-32 steps");
+    static_assert(SAMPLES >= TRACKS, "every track needs a sample slot");
+
+    static constexpr uint8_t tracks = TRACKS;
+    static constexpr uint8_t steps = STEPS;
+    static constexpr uint8_t samples = SAMPLES;  // Sample slots held in PSRAM
+
+    using StepMask = BitMask<STEPS>;    // One bit per step of a track
+    using TrackMask = BitMask<TRACKS>;  // One bit per track
+};
+
+using Engine4x8 = EngineConfig<4, 8, 16>;
+using Engine8x16 = EngineConfig<8, 16, 16>;
+using Engine16x32 = EngineConfig<16, 32, 32>;
+
+#ifndef ENGINE_TRACKS
+#define ENGINE_TRACKS 4
+#endif
+
+#ifndef ENGINE_STEPS
+#define ENGINE_STEPS 8
+#endif
+
+#ifndef ENGINE_SAMPLES
+#define ENGINE_SAMPLES (ENGINE_TRACKS * 2 > 16 ? ENGINE_TRACKS * 2 : 16)
+#endif
+
+// The configuration this build runs
+using Engine = EngineConfig<ENGINE_TRACKS, ENGINE_STEPS, ENGINE_SAMPLES>;
+
+#endif
@@ -2,6 +2,7 @@
 #define INPUT_H
 
 #include <M5Cardputer.h>
+#include "pan.h"
 
 enum class InputEvent {
     None,
@@ -18,14 +19,29 @@ enum class InputEvent {
     LengthDown,
     SampleNext,
     SamplePrev,
-    TriggerTrack1,
-    TriggerTrack2,
-    TriggerTrack3,
-    TriggerTrack4
+    Pad,         // Trigger the track in lastPad directly
+    Record,      // Arm/disarm live recording
+    Quantize,    // Cycle quantize strength
+    Calibrate,   // Measure input-to-audio latency by tapping along
+    Browse,      // Open/close the sample browser
+    Back,        // Browser: parent folder
+    Select,      // Browser: open folder or load file
+    Char,        // Browser: search character in lastChar
+    Backspace,   // Browser: delete last search character
+    PowerReport, // Log per-state power, prefetch and memory statistics
+    Mode,        // Cycle the track's sample mode: one-shot, slice, stretch
+    Memory,      // Show/hide the memory map
+    PanLeft,     // Stereo builds: move the track's pan left
+    PanRight     // ... and right
 };
 
 class InputHandler {
 public:
+    bool browsing = false;  // Keys type into the browser search
+    char lastChar = 0;      // Character for InputEvent::Char
+    uint8_t lastPad = 0;    // Track for InputEvent::Pad (keys 1-9, 0)
+    uint32_t lastEventUs = 0;  // When the last event's key was seen
+
     InputEvent poll() {
         if (!M5Cardputer.Keyboard.isChange()) {
             return InputEvent::None;
@@ -35,12 +51,27 @@ public:
             return InputEvent::None;
         }
 
+        uint32_t nowUs = micros();
+
+        // Pads skip the repeat delay so fast rolls can be played and
+        // recorded; isChange() already ignores held keys
+        if (!browsing) {
+            InputEvent pad = pollPads();
+            if (pad != InputEvent::None) {
+                lastEventUs = nowUs;
+                return pad;
+            }
+        }
+
         // Rate limiting
         uint32_t now = millis();
         if (now - lastKeyTime < KEY_REPEAT_DELAY_MS) {
             return InputEvent::None;
         }
         lastKeyTime = now;
+        lastEventUs = nowUs;
+
+        if (browsing) return pollBrowser();
 
         // Arrow keys on Cardputer: ; = up, . = down, , = left, / = right
         // Also keep WASD/ESAD as alternatives
@@ -92,20 +123,77 @@ public:
         if (M5Cardputer.Keyboard.isKeyPressed('x'))
             return InputEvent::SampleNext;
 
-        // Trigger tracks 1-4 directly
-        if (M5Cardputer.Keyboard.isKeyPressed('1'))
-            return InputEvent::TriggerTrack1;
-        if (M5Cardputer.Keyboard.isKeyPressed('2'))
-            return InputEvent::TriggerTrack2;
-        if (M5Cardputer.Keyboard.isKeyPressed('3'))
-            return InputEvent::TriggerTrack3;
-        if (M5Cardputer.Keyboard.isKeyPressed('4'))
-            return InputEvent::TriggerTrack4;
-
         // Clear
         if (M5Cardputer.Keyboard.isKeyPressed('c'))
             return InputEvent::Clear;
 
+        // Sample browser
+        if (M5Cardputer.Keyboard.isKeyPressed('b'))
+            return InputEvent::Browse;
+
+        // Recording: arm, quantize strength, latency calibration
+        if (M5Cardputer.Keyboard.isKeyPressed('r'))
+            return InputEvent::Record;
+        if (M5Cardputer.Keyboard.isKeyPressed('q'))
+            return InputEvent::Quantize;
+        if (M5Cardputer.Keyboard.isKeyPressed('l'))
+            return InputEvent::Calibrate;
+
+        if (M5Cardputer.Keyboard.isKeyPressed('i'))
+            return InputEvent::PowerReport;
+
+        if (M5Cardputer.Keyboard.isKeyPressed('m'))
+            return InputEvent::Mode;
+
+        if (M5Cardputer.Keyboard.isKeyPressed('h'))
+            return InputEvent::Memory;
+
+#if STEREO_OUTPUT
+        if (M5Cardputer.Keyboard.isKeyPressed('u'))
+            return InputEvent::PanLeft;
+        if (M5Cardputer.Keyboard.isKeyPressed('o'))
+            return InputEvent::PanRight;
+#endif
+
+        return InputEvent::None;
+    }
+
+    // Trigger tracks 1-10 directly; the caller ignores pads past the
+    // engine's track count
+    InputEvent pollPads() {
+        static const char PAD_KEYS[] = "1234567890";
+        for (uint8_t pad = 0; PAD_KEYS[pad]; pad++) {
+            if (M5Cardputer.Keyboard.isKeyPressed(PAD_KEYS[pad])) {
+                lastPad = pad;
+                return InputEvent::Pad;
+            }
+        }
+        return InputEvent::None;
+    }
+
+    // In the browser the arrow keys navigate, ` (Esc) closes it and any
+    // other printable key extends the search prefix
+    InputEvent pollBrowser() {
+        Keyboard_Class::KeysState state = M5Cardputer.Keyboard.keysState();
+        if (state.enter)
+            return InputEvent::Select;
+        if (state.del)
+            return InputEvent::Backspace;
+
+        for (char c : state.word) {
+            switch (c) {
+                case ';': return InputEvent::Up;
+                case '.': return InputEvent::Down;
+                case ',': return InputEvent::Back;
+                case '/': return InputEvent::Select;
+                case '`': return InputEvent::Browse;
+                default:
+                    if (c >= ' ' && c < 127) {
+                        lastChar = c;
+                        return InputEvent::Char;
+                    }
+            }
+        }
         return InputEvent::None;
     }
 
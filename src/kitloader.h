@@ -0,0 +1,279 @@
+#ifndef KITLOADER_H
+#define KITLOADER_H
+
+// Pipelined bulk loading of several sample files. A reader task on the
+// other core pulls large, sector-aligned chunks off the SD card into a
+// small ring of DMA-capable buffers while the calling task decodes the
+// previous chunk. The reader moves on to the next file as soon as the
+// current one is read, so SD transfers and conversion overlap across
+// file boundaries without ever staging a whole file in memory.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <cstdint>
+#include "memory.h"
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#else
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+constexpr size_t KIT_CHUNK_BYTES = 16384;  // 32 sectors per read
+constexpr uint8_t KIT_CHUNK_COUNT = 3;     // One being read, one decoded, one spare
+constexpr uint8_t KIT_MAX_FILES = 16;
+
+inline uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+struct KitChunk {
+    static constexpr uint8_t NO_BUFFER = 0xFF;
+    uint8_t buffer;  // Index into the ring, NO_BUFFER for an empty end marker
+    uint8_t file;
+    bool last;       // Final chunk of this file
+    bool error;      // File could not be opened
+    uint32_t size;
+    uint32_t fileSize;  // Whole file's, for WavDecoder to check its header against
+};
+
+// Fixed-capacity blocking queue: FreeRTOS queue on target, mutex and
+// condition variable on host
+template <typename T, uint8_t CAPACITY>
+class KitQueue {
+public:
+#ifdef ARDUINO
+    KitQueue() { handle = xQueueCreate(CAPACITY, sizeof(T)); }
+    ~KitQueue() { vQueueDelete(handle); }
+    void push(const T& item) { xQueueSend(handle, &item, portMAX_DELAY); }
+    T pop() {
+        T item;
+        xQueueReceive(handle, &item, portMAX_DELAY);
+        return item;
+    }
+
+private:
+    QueueHandle_t handle;
+#else
+    void push(const T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < CAPACITY; });
+        items.push_back(item);
+        notEmpty.notify_one();
+    }
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty(); });
+        T item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
+
+private:
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+#endif
+};
+
+class KitLoader;
+
+// Source for WavDecoder over the chunks of one file. Supports forward
+// seeks only, which is all the decoder needs.
+class KitSource {
+public:
+    KitSource(KitLoader& loader, uint8_t file) : loader(loader), file(file) {}
+
+    size_t read(uint8_t* out, size_t n);
+    bool seek(uint32_t target);
+    size_t position() const { return pos; }
+    size_t size();
+    bool failed() const { return error; }
+
+    // Consume whatever the decoder didn't read so the next file starts clean
+    void drain();
+
+private:
+    KitLoader& loader;
+    uint8_t file;
+    KitChunk chunk = {KitChunk::NO_BUFFER, 0, false, false, 0, 0};
+    bool haveChunk = false;
+    bool ended = false;
+    bool error = false;
+    uint32_t chunkPos = 0;
+    size_t pos = 0;
+    uint32_t fileSize = 0;
+
+    bool nextChunk();
+};
+
+class KitLoader {
+public:
+    uint32_t bytesRead = 0;
+
+    // Reads paths[order[0..count)] in that order and calls
+    // onFile(fileIndex, KitSource&) for each on the calling task.
+    template <typename Fn>
+    bool run(const char* const* paths, const uint8_t* order, uint8_t count, Fn onFile) {
+        if (!allocBuffers()) return false;
+        this->paths = paths;
+        this->order = order;
+        this->count = count;
+        bytesRead = 0;
+        for (uint8_t i = 0; i < KIT_CHUNK_COUNT; i++) freeChunks.push(i);
+
+        startReader();
+        for (uint8_t i = 0; i < count; i++) {
+            KitSource src(*this, order[i]);
+            onFile(order[i], src);
+            src.drain();
+        }
+        waitReader();
+
+        // Reclaim the ring so the next run starts with every buffer free
+        for (uint8_t i = 0; i < KIT_CHUNK_COUNT; i++) freeChunks.pop();
+        freeBuffers();
+        return true;
+    }
+
+private:
+    friend class KitSource;
+
+    uint8_t* buffers[KIT_CHUNK_COUNT] = {nullptr};
+    KitQueue<uint8_t, KIT_CHUNK_COUNT> freeChunks;
+    KitQueue<KitChunk, KIT_CHUNK_COUNT + 1> fullChunks;
+    const char* const* paths = nullptr;
+    const uint8_t* order = nullptr;
+    uint8_t count = 0;
+
+#ifdef ARDUINO
+    SemaphoreHandle_t readerDone = nullptr;
+#else
+    std::thread readerThread;
+#endif
+
+    bool allocBuffers() {
+        for (uint8_t i = 0; i < KIT_CHUNK_COUNT; i++) {
+            buffers[i] = (uint8_t*)memAlloc(MemTag::KitLoad, KIT_CHUNK_BYTES);
+            if (!buffers[i]) {
+                freeBuffers();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void freeBuffers() {
+        for (uint8_t i = 0; i < KIT_CHUNK_COUNT; i++) {
+            memFree(buffers[i]);
+            buffers[i] = nullptr;
+        }
+    }
+
+    void readAll() {
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t index = order[i];
+            File file = SD.open(paths[index], FILE_READ);
+            if (!file) {
+                fullChunks.push({KitChunk::NO_BUFFER, index, true, true, 0, 0});
+                continue;
+            }
+            const uint32_t fileSize = file.size();
+            while (true) {
+                uint8_t buf = freeChunks.pop();
+                size_t n = file.read(buffers[buf], KIT_CHUNK_BYTES);
+                bytesRead += n;
+                bool last = n < KIT_CHUNK_BYTES || file.available() == 0;
+                fullChunks.push({buf, index, last, false, (uint32_t)n, fileSize});
+                if (last) break;
+            }
+            file.close();
+        }
+    }
+
+#ifdef ARDUINO
+    void startReader() {
+        readerDone = xSemaphoreCreateBinary();
+        // loop() runs on core 1, so read on core 0
+        xTaskCreatePinnedToCore([](void* arg) {
+            KitLoader* self = (KitLoader*)arg;
+            self->readAll();
+            xSemaphoreGive(self->readerDone);
+            vTaskDelete(nullptr);
+        }, "kitread", 4096, this, 5, nullptr, 0);
+    }
+
+    void waitReader() {
+        xSemaphoreTake(readerDone, portMAX_DELAY);
+        vSemaphoreDelete(readerDone);
+        readerDone = nullptr;
+    }
+#else
+    void startReader() { readerThread = std::thread([this] { readAll(); }); }
+    void waitReader() { readerThread.join(); }
+#endif
+};
+
+inline bool KitSource::nextChunk() {
+    if (ended) return false;
+    chunk = loader.fullChunks.pop();
+    haveChunk = chunk.buffer != KitChunk::NO_BUFFER;
+    chunkPos = 0;
+    fileSize = chunk.fileSize;
+    if (chunk.error) error = true;
+    if (chunk.last && !haveChunk) ended = true;
+    return haveChunk;
+}
+
+inline size_t KitSource::read(uint8_t* out, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        if (!haveChunk && !nextChunk()) break;
+        size_t avail = chunk.size - chunkPos;
+        size_t take = (n - done) < avail ? (n - done) : avail;
+        if (out) memcpy(out + done, loader.buffers[chunk.buffer] + chunkPos, take);
+        chunkPos += take;
+        done += take;
+        if (chunkPos == chunk.size) {
+            loader.freeChunks.push(chunk.buffer);
+            haveChunk = false;
+            if (chunk.last) ended = true;
+        }
+    }
+    pos += done;
+    return done;
+}
+
+// Known from the first chunk on
+inline size_t KitSource::size() {
+    if (!haveChunk && pos == 0) nextChunk();
+    return fileSize;
+}
+
+inline bool KitSource::seek(uint32_t target) {
+    if (target < pos) return false;
+    return read(nullptr, target - pos) == target - pos;
+}
+
+inline void KitSource::drain() {
+    while (!ended) {
+        if (!haveChunk && !nextChunk()) continue;
+        read(nullptr, chunk.size - chunkPos);
+    }
+}
+
+#endif
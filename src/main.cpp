@@ -3,25 +3,82 @@
 #include "audio.h"
 #include "display.h"
 #include "input.h"
+#include "memory.h"
+#include "midi.h"
+#include "power.h"
+#include "recorder.h"
+#include "session.h"
+#include "trace.h"
+
+static_assert(Engine::tracks <= sizeof(MIDI_TRACK_NOTES), "a MIDI note for every track");
 
 // Global objects
-Sequencer sequencer;
-AudioManager audio;
-DisplayManager display;
+Sequencer<Engine> sequencer;
+AudioManager<Engine> audio;
+DisplayManager<Engine> display;
 InputHandler input;
+Recorder recorder;
+PowerManager power;
+
+// MIDI sync and pads over USB serial
+MidiParser midiParser;
+MidiOut midiOut(Serial);
+MidiClockSync midiSync;
+MidiClockOut midiClockOut;
+uint16_t midiSongPosition = 0;  // 16th notes since start
 
 // Timing
-constexpr uint32_t DISPLAY_UPDATE_MS = 50;  // 20 Hz
-uint32_t lastDisplayUpdate = 0;
+constexpr uint32_t DISPLAY_UPDATE_US = 50000;  // 20 Hz
+constexpr uint32_t DISPLAY_MAX_DEFER_US = 200000;
+constexpr uint32_t VOICE_FEED_US = 1000;  // Recheck for room behind an attack
+uint32_t lastDisplayUpdateUs = 0;
+uint32_t drawCostUs = 0;        // Recent worst redraw time
+uint32_t renderCostUs = 2000;   // Recent worst stretch or pan render chunk, a guess until measured
+constexpr uint8_t SAMPLE_CYCLE_TRIES = 8;  // Files z/x skips over when they don't load
+uint32_t lastActivityMs = 0;    // Last key or MIDI input, for the idle state
+uint32_t lastThermalCheckMs = 0;
 bool needsRedraw = true;
 
+// Memory map screen ('h'), redrawn while shown since usage changes on its own
+constexpr uint32_t MEMORY_REFRESH_US = 500000;
+bool showMemory = false;
+
+// Sample browser target track and thumbnail of its selection
+uint8_t browseTrack = 0;
+WaveformPyramid browsePreview;
+bool browsePreviewValid = false;
+
+#if SESSION_RECORD
+// Keys and MIDI from boot, for replay on host (bench/replay.cpp)
+SessionRecorder session;
+uint32_t sessionCostUs = 5000;  // Recent worst SD append, a guess until measured
+#endif
+
 void handleInput(InputEvent event);
-void updateDisplaySampleNames();
+void handleBrowserInput(InputEvent event);
+void updateBrowsePreview();
+void handleMidiInput();
+void triggerCurrentStep();
+void playTrigger(uint8_t track, uint8_t step);
+void prefetchUpcoming(uint32_t nowUs);
+void padHit(uint8_t track);
+void updateRecordStatus();
+bool assignTrackFile(uint8_t track, uint32_t fileIndex);
 void cycleTrackSample(uint8_t track, int8_t direction);
+void updateDisplay(uint32_t nowUs);
+void updateRenders(uint32_t nowUs);
+void updateTrackMode(uint8_t track);
+void updatePowerState(uint32_t nowMs);
+#if SESSION_RECORD
+void recordKeys();
+void updateSession(uint32_t nowUs);
+#endif
 
 void setup() {
     Serial.begin(115200);
-    Serial.println("Drum Sequencer starting...");
+    LOG_INFO("Drum Sequencer starting...\n");
+    traceStartDrainTask();
+    const uint32_t internalFreeAtBoot = MemoryMap::heapFree(true);
 
     // Initialize M5Cardputer with speaker enabled
     auto cfg = M5.config();
@@ -29,6 +86,15 @@ void setup() {
     M5Cardputer.begin(cfg, true);
 
     // Explicitly enable and configure speaker
+#if STEREO_OUTPUT
+    // Stereo goes to an external I2S DAC instead of the mono internal amp
+    auto spk = M5Cardputer.Speaker.config();
+    spk.pin_bck = STEREO_I2S_BCK;
+    spk.pin_ws = STEREO_I2S_WS;
+    spk.pin_data_out = STEREO_I2S_DOUT;
+    spk.stereo = true;
+    M5Cardputer.Speaker.config(spk);
+#endif
     M5Cardputer.Speaker.begin();
     M5Cardputer.Speaker.setVolume(255);  // Max volume
 
@@ -52,9 +118,7 @@ void setup() {
         }
     }
 
-    M5Cardputer.Display.printf("Found %d WAV files\n", audio.getWavFileCount());
-
-    if (audio.getWavFileCount() == 0) {
+    if (audio.browser.nextFile(-1, 1) < 0) {
         M5Cardputer.Display.setTextColor(TFT_RED);
         M5Cardputer.Display.println("No WAV files found!");
         M5Cardputer.Display.println("Add .wav files to SD root");
@@ -64,23 +128,24 @@ void setup() {
         }
     }
 
-    // Load samples using simple hardcoded paths (like original working version)
-    M5Cardputer.Display.println("Loading samples...");
-    for (int i = 0; i < 4; i++) {
-        char filename[16];
-        sprintf(filename, "/%d.wav", i + 1);
-        M5Cardputer.Display.printf("%s...", filename);
-        if (audio.loadSample(i, filename)) {
-            M5Cardputer.Display.println("OK");
-        } else {
-            M5Cardputer.Display.println("FAIL");
-        }
+    // Load the startup kit /1.wav, /2.wav, ... (one per track) in one pipelined pass
+    M5Cardputer.Display.printf("Loading samples (SPI %d MHz)...\n",
+                               (int)(audio.spiFrequency / 1000000));
+    static_assert(Engine::tracks <= KIT_MAX_FILES, "startup kit larger than the loader");
+    char kitPaths[Engine::tracks][8];
+    const char* kitFiles[Engine::tracks];
+    for (int i = 0; i < Engine::tracks; i++) {
+        snprintf(kitPaths[i], sizeof(kitPaths[i]), "/%d.wav", i + 1);
+        kitFiles[i] = kitPaths[i];
     }
-
-    // Scan for additional WAV files for sample switching
-    audio.scanWavFiles();
-    M5Cardputer.Display.printf("Total WAVs: %d\n", audio.getWavFileCount());
-    delay(500);
+    bool kitLoaded[Engine::tracks];
+    audio.loadKit(kitFiles, Engine::tracks, kitLoaded);
+    for (int i = 0; i < Engine::tracks; i++) {
+        M5Cardputer.Display.printf("%s...%s\n", kitFiles[i], kitLoaded[i] ? "OK" : "FAIL");
+    }
+    M5Cardputer.Display.printf("%u KB in %u ms (%.1f MB/s)\n",
+                               (unsigned)(audio.lastKit.bytes / 1024),
+                               (unsigned)audio.lastKit.ms, audio.lastKit.mbPerSec());
 
     delay(500);
 
@@ -93,74 +158,356 @@ void setup() {
     sequencer.init();
     display.init();
 
-    // Set initial track sample assignments (samples 0-3 are loaded from /1.wav-/4.wav)
-    for (int i = 0; i < NUM_INSTRUMENTS; i++) {
-        sequencer.trackSamples[i] = i;  // Track i uses sample i
+    // Set initial track sample assignments (sample i is loaded from
+    // /<i+1>.wav); z/x continue from that file's place in the root folder
+    for (int i = 0; i < Engine::tracks; i++) {
+        sequencer.setTrackSample(i, i, kitLoaded[i] ? audio.browser.indexOf(kitPaths[i] + 1) : -1);
+        display.setSampleWave(i, &audio.samples[i].wave);
         // Set display name from the loaded sample
         if (audio.samples[i].loaded) {
             display.setSampleName(i, audio.samples[i].name);
         }
+        updateTrackMode(i);
     }
 
-    // Set a default pattern
-    sequencer.pattern.setStep(0, 0, true);
-    sequencer.pattern.setStep(0, 4, true);
-    sequencer.pattern.setStep(1, 2, true);
-    sequencer.pattern.setStep(1, 6, true);
-    for (int i = 0; i < 8; i++) {
-        sequencer.pattern.setStep(2, i, true);
+    // Set a default pattern: kick on the beat, snare between, hats throughout
+    for (int i = 0; i < Engine::steps; i++) {
+        if (i % 4 == 0) sequencer.pattern.setStep(0, i, true);
+        if (i % 4 == 2 && Engine::tracks > 1) sequencer.pattern.setStep(1, i, true);
+        if (Engine::tracks > 2) sequencer.pattern.setStep(2, i, true);
     }
 
-    Serial.println("Setup complete!");
+    // Until calibrated, compensate for the speaker's output buffering
+    recorder.latencyUs = audio.outputLatencyUs();
+    LOG_INFO("Record latency estimate: %u us\n", (unsigned)recorder.latencyUs);
+
+    // MIDI input ends the loop's wait straight away
+#if ARDUINO_USB_MODE && ARDUINO_USB_CDC_ON_BOOT
+    Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, [](void*, esp_event_base_t, int32_t, void*) {
+        power.wake();
+    });
+#endif
+    power.begin();
+
+    // M5Unified, the SD card and the speaker's DMA buffers keep what they
+    // took from internal RAM during setup, less what's tracked by tag; the
+    // engine objects are static
+    const uint32_t taken = internalFreeAtBoot - MemoryMap::heapFree(true);
+    const uint32_t tracked = memoryMap().internalUsed();
+    memoryMap().note(MemTag::System, taken > tracked ? taken - tracked : 0, true);
+    memoryMap().note(MemTag::Static, sizeof(sequencer) + sizeof(audio) + sizeof(display) +
+                     sizeof(input) + sizeof(recorder) + sizeof(power) + sizeof(browsePreview),
+                     true);
+
+#if SESSION_RECORD
+    session.begin("/session.ses", Engine::tracks, Engine::steps);
+#endif
+
+    LOG_INFO("Setup complete!\n");
     needsRedraw = true;
 }
 
 void loop() {
-    uint32_t now = millis();
-
     // Always update keyboard state first
     M5Cardputer.update();
+#if SESSION_RECORD
+    if (M5Cardputer.Keyboard.isChange()) recordKeys();
+#endif
 
     // Handle input
     InputEvent event = input.poll();
     if (event != InputEvent::None) {
+        TRACE(TraceEvent::Input, (uint16_t)event);
         handleInput(event);
         needsRedraw = true;
+        lastActivityMs = millis();
+    }
+
+    // MIDI clock, transport and pads
+    handleMidiInput();
+
+    // Update sequencer (internal clock)
+    if (sequencer.update(micros())) {
+        triggerCurrentStep();
+#if MIDI_OUT_ENABLED
+        // On the step's grid time, not when this pass got to it
+        midiClockOut.onStep(sequencer.playback.stepStartUs);
+#endif
+    }
+
+    // Step triggers whose micro-timing offset has come due
+    sequencer.triggers.fireDue(micros(), playTrigger);
+
+#if MIDI_OUT_ENABLED
+    while (midiClockOut.poll(micros(), sequencer.playback.stepIntervalUs)) {
+        midiOut.sendClock();
+    }
+#endif
+
+    // Attacks of the triggers due within a mixer block, and the rest of
+    // voices started from them
+    prefetchUpcoming(micros());
+
+    // Deadlines that must be met to the microsecond
+    uint32_t dueUs;
+    if (sequencer.nextStepDueUs(dueUs)) power.hardDeadline(dueUs);
+    if (sequencer.triggers.nextDueUs(dueUs)) power.hardDeadline(dueUs);
+#if MIDI_OUT_ENABLED
+    if (midiClockOut.nextDueUs(sequencer.playback.stepIntervalUs, dueUs)) power.hardDeadline(dueUs);
+#endif
+
+    updateDisplay(micros());
+    updateRenders(micros());
+#if SESSION_RECORD
+    updateSession(micros());
+#endif
+    updatePowerState(millis());
+
+    // Sleep until the next deadline, key scan or MIDI input
+    power.softDeadline(micros() + power.profile().scanUs);
+    power.wait();
+}
+
+// Redraws at most every DISPLAY_UPDATE_US, and only when the redraw ends
+// before the next hard deadline, so drawing never delays a step
+void updateDisplay(uint32_t nowUs) {
+    if (showMemory && nowUs - lastDisplayUpdateUs >= MEMORY_REFRESH_US) needsRedraw = true;
+    if (!needsRedraw) return;
+    uint32_t sinceUs = nowUs - lastDisplayUpdateUs;
+    if (sinceUs < DISPLAY_UPDATE_US) {
+        power.softDeadline(lastDisplayUpdateUs + DISPLAY_UPDATE_US);
+        return;
+    }
+    if (!power.fits(nowUs, drawCostUs) && sinceUs < DISPLAY_MAX_DEFER_US) return;
+
+    lastDisplayUpdateUs = nowUs;
+    needsRedraw = false;
+    TRACE(TraceEvent::DrawBegin, 0);
+    if (input.browsing) {
+        display.drawBrowser(audio.browser, browseTrack,
+                            browsePreviewValid ? &browsePreview : nullptr);
+    } else if (showMemory) {
+        display.drawMemory(memoryMap());
+    } else {
+        display.drawAll(sequencer.pattern, sequencer.cursor, sequencer.playback);
+    }
+    TRACE(TraceEvent::DrawEnd, 0);
+
+    // Track the worst recent redraw, decaying so one slow frame doesn't
+    // hold redraws back for good
+    uint32_t cost = micros() - nowUs;
+    uint32_t decayed = drawCostUs - drawCostUs / 8;
+    drawCostUs = cost > decayed ? cost : decayed;
+}
+
+// Time-stretch renders for Stretch-mode tracks, then stereo re-renders
+// after a pan change, a chunk at a time between deadlines like redraws.
+// A stretch waiting on its old render's channel doesn't keep the loop
+// awake; it's retried on later passes. Replaced sample memory is freed
+// here once the speaker task is done with it.
+void updateRenders(uint32_t nowUs) {
+    audio.freeRetired();
+    const bool stretching = audio.stretchPending(sequencer.playback.bpm);
+    if (!stretching && !audio.panPending()) return;
+    if (!power.fits(nowUs, renderCostUs)) return;
+
+    bool rendered = stretching && audio.updateStretch(sequencer.playback.bpm, STRETCH_CHUNK_FRAMES);
+    if (rendered) {
+        needsRedraw = true;
+    } else if (audio.panPending()) {
+        audio.updatePan(PAN_CHUNK_FRAMES);
+        rendered = true;
     }
+    if (!rendered) return;
+    power.softDeadline(micros());  // More to render: don't sleep
+
+    uint32_t cost = micros() - nowUs;
+    uint32_t decayed = renderCostUs - renderCostUs / 8;
+    renderCostUs = cost > decayed ? cost : decayed;
+}
+
+#if SESSION_RECORD
+// Keyboard state as input.h reads it
+void recordKeys() {
+    SessionKeys keys;
+    Keyboard_Class::KeysState state = M5Cardputer.Keyboard.keysState();
+    keys.flags = (state.enter ? SESSION_KEY_ENTER : 0) | (state.del ? SESSION_KEY_DEL : 0);
+    for (const auto& pos : M5Cardputer.Keyboard.keyList()) {
+        if (keys.keyCount < SESSION_MAX_KEYS) keys.keys[keys.keyCount++] = M5Cardputer.Keyboard.getKey(pos);
+    }
+    for (char c : state.word) {
+        if (keys.wordCount < SESSION_MAX_KEYS) keys.word[keys.wordCount++] = c;
+    }
+    session.keys(keys, micros());
+}
 
-    // Update sequencer
+// Appends the session log to SD between deadlines: in chunks while
+// playing, everything once stopped
+void updateSession(uint32_t nowUs) {
+    size_t pending = session.pending();
+    if (pending == 0) return;
+    if (sequencer.playback.isPlaying && pending < SESSION_FLUSH_BYTES) return;
+    if (!power.fits(nowUs, sessionCostUs)) return;
+
+    if (!session.flush()) LOG_WARN("Session write failed\n");
+    uint32_t cost = micros() - nowUs;
+    uint32_t decayed = sessionCostUs - sessionCostUs / 8;
+    sessionCostUs = cost > decayed ? cost : decayed;
+}
+#endif
+
+void updatePowerState(uint32_t nowMs) {
+    PowerState state = PowerState::Stopped;
     if (sequencer.playback.isPlaying) {
-        bool stepChanged = sequencer.update(now);
+        state = PowerState::Playing;
+    } else if (nowMs - lastActivityMs >= POWER_IDLE_AFTER_MS) {
+        state = PowerState::Idle;
+    }
 
-        if (stepChanged) {
-            needsRedraw = true;
+    // Light sleep would stall the speaker DMA and drop the USB host
+    power.setState(state, !audio.isSounding() && !Serial);
 
-            // Trigger samples for current step
-            uint8_t step = sequencer.playback.currentStep;
-            for (uint8_t inst = 0; inst < NUM_INSTRUMENTS; inst++) {
-                if (sequencer.pattern.getStep(inst, step)) {
-                    audio.playSample(inst, inst);  // Track N uses sample slot N
-                }
-            }
+    if (nowMs - lastThermalCheckMs >= POWER_THERMAL_CHECK_MS) {
+        lastThermalCheckMs = nowMs;
+        power.updateThermal(temperatureRead());
+    }
+}
+
+void triggerCurrentStep() {
+    needsRedraw = true;
+
+    // Queue this step's samples at their micro-timing offsets; on-grid
+    // ones are due now and fire straight away
+    TRACE(TraceEvent::Step, sequencer.playback.currentStep);
+    sequencer.scheduleStep();
+    sequencer.triggers.fireDue(micros(), playTrigger);
+}
+
+void playTrigger(uint8_t track, uint8_t step) {
+    // Loops in slice mode play the slice on this step
+    audio.playStep(sequencer.getTrackSample(track), sequencer.stepNumber(step), track);
+#if MIDI_OUT_ENABLED
+    midiOut.sendNoteOn(MIDI_DRUM_CHANNEL, MIDI_TRACK_NOTES[track], 100);
+    midiOut.sendNoteOff(MIDI_DRUM_CHANNEL, MIDI_TRACK_NOTES[track]);
+#endif
+}
+
+// Copies the attacks of triggers due within the next mixer block into
+// internal RAM, so the speaker task doesn't start them from cold PSRAM,
+// and wakes the loop a block before the next step to do so
+void prefetchUpcoming(uint32_t nowUs) {
+    const uint32_t aheadUs = audio.blockUs();
+    sequencer.forEachUpcoming(nowUs, aheadUs, [](uint8_t track, uint32_t stepNumber) {
+        audio.prefetchStep(sequencer.getTrackSample(track), stepNumber, track);
+    });
+
+    uint32_t dueUs;
+    if (sequencer.nextStepDueUs(dueUs) && (int32_t)(dueUs - aheadUs - nowUs) > 0) {
+        power.softDeadline(dueUs - aheadUs);
+    }
+    if (audio.feedVoices()) power.softDeadline(nowUs + VOICE_FEED_US);
+}
+
+// Pad key: audition, and record or calibrate when active
+void padHit(uint8_t track) {
+    audio.playSample(sequencer.getTrackSample(track), track);
+    if (recorder.calibrating) {
+        if (recorder.calibrationTap(sequencer, input.lastEventUs)) {
+            LOG_INFO("Measured latency: %u us\n", (unsigned)recorder.latencyUs);
         }
+        updateRecordStatus();
+    } else {
+        recorder.recordHit(sequencer, track, input.lastEventUs);
     }
+}
 
-    // Update display
-    if (needsRedraw && (now - lastDisplayUpdate >= DISPLAY_UPDATE_MS)) {
-        lastDisplayUpdate = now;
-        needsRedraw = false;
-        display.drawAll(sequencer.pattern, sequencer.cursor, sequencer.playback);
+void updateRecordStatus() {
+    char status[12] = "";
+    if (recorder.calibrating) {
+        snprintf(status, sizeof(status), "CAL %d/%d", recorder.calTaps, RECORD_CAL_TAPS);
+    } else if (recorder.armed) {
+        snprintf(status, sizeof(status), "REC Q%d", recorder.strength);
+    }
+    display.setRecordStatus(status);
+}
+
+void handleMidiInput() {
+    while (Serial.available()) {
+        // Timestamp on arrival; MidiClockSync filters out the polling jitter
+        uint32_t nowUs = micros();
+        uint8_t byte = Serial.read();
+#if SESSION_RECORD
+        session.midi(byte, nowUs);
+#endif
+        MidiMessage msg = midiParser.parse(byte);
+        lastActivityMs = millis();
+
+        switch (msg.type) {
+            case MidiMessageType::Clock:
+                TRACE(TraceEvent::MidiClock, 0);
+                midiSync.onTick(nowUs);
+                if (!sequencer.playback.externalClock) break;
+                if (midiSync.isLocked()) {
+                    sequencer.setExternalTempo(midiSync.getTickPeriodUs());
+                }
+                // Once locked, steps start on the filtered tick time, so
+                // micro-timing, prefetch and quantize don't see the jitter
+                if (sequencer.clockTick(midiSync.isLocked() ? midiSync.getFilteredTickUs() : nowUs)) {
+                    midiSongPosition++;
+                    triggerCurrentStep();
+                }
+                break;
+
+            case MidiMessageType::Start:
+                midiSongPosition = 0;
+                // Fall through
+            case MidiMessageType::Continue:
+                TRACE(TraceEvent::MidiStart, midiSongPosition);
+                midiClockOut.stop();
+                sequencer.startExternal(midiSongPosition);
+                needsRedraw = true;
+                break;
+
+            case MidiMessageType::Stop:
+                TRACE(TraceEvent::MidiStop, 0);
+                if (sequencer.playback.externalClock) {
+                    sequencer.stop();
+                    audio.stopAll();
+                    needsRedraw = true;
+                }
+                break;
+
+            case MidiMessageType::SongPosition:
+                midiSongPosition = msg.value;
+                break;
+
+            case MidiMessageType::NoteOn:
+                for (uint8_t track = 0; track < Engine::tracks; track++) {
+                    if (msg.data1 == MIDI_TRACK_NOTES[track]) {
+                        audio.playSample(sequencer.getTrackSample(track), track);
+                    }
+                }
+                break;
+
+            default:
+                break;
+        }
     }
 }
 
 void handleInput(InputEvent event) {
+    if (input.browsing) {
+        handleBrowserInput(event);
+        return;
+    }
+
     switch (event) {
         case InputEvent::Up:
             sequencer.cursor.moveUp();
             break;
 
         case InputEvent::Down:
-            sequencer.cursor.moveDown();
+            sequencer.cursor.moveDown(Engine::tracks);
             break;
 
         case InputEvent::Left:
@@ -180,6 +527,15 @@ void handleInput(InputEvent event) {
             if (!sequencer.playback.isPlaying) {
                 audio.stopAll();
             }
+#if MIDI_OUT_ENABLED
+            if (sequencer.playback.isPlaying) {
+                midiOut.sendStart();
+                midiClockOut.onStep(sequencer.playback.stepStartUs);
+            } else {
+                midiOut.sendStop();
+                midiClockOut.stop();
+            }
+#endif
             break;
 
         case InputEvent::BPMUp:
@@ -199,12 +555,10 @@ void handleInput(InputEvent event) {
             break;
 
         case InputEvent::SampleNext:
-            Serial.println("Event: SampleNext (x key)");
             cycleTrackSample(sequencer.cursor.row, 1);
             break;
 
         case InputEvent::SamplePrev:
-            Serial.println("Event: SamplePrev (z key)");
             cycleTrackSample(sequencer.cursor.row, -1);
             break;
 
@@ -212,24 +566,61 @@ void handleInput(InputEvent event) {
             sequencer.pattern.clear();
             break;
 
-        case InputEvent::TriggerTrack1:
-            Serial.println("Event: TriggerTrack1 (1 key)");
-            audio.playSample(0, 0);
+        case InputEvent::Pad:
+            if (input.lastPad < Engine::tracks) padHit(input.lastPad);
             break;
 
-        case InputEvent::TriggerTrack2:
-            Serial.println("Event: TriggerTrack2 (2 key)");
-            audio.playSample(1, 1);
+        case InputEvent::PowerReport:
+            power.logReport();
+            audio.attacks.logReport();
+            memoryMap().logReport();
             break;
 
-        case InputEvent::TriggerTrack3:
-            Serial.println("Event: TriggerTrack3 (3 key)");
-            audio.playSample(2, 2);
+        case InputEvent::Memory:
+            showMemory = !showMemory;
             break;
 
-        case InputEvent::TriggerTrack4:
-            Serial.println("Event: TriggerTrack4 (4 key)");
-            audio.playSample(3, 3);
+        case InputEvent::PanLeft:
+        case InputEvent::PanRight: {
+            const uint8_t track = sequencer.cursor.row;
+            const int8_t pan = panClamp(sequencer.getTrackPan(track) +
+                                        (event == InputEvent::PanRight ? 1 : -1));
+            sequencer.setTrackPan(track, pan);
+            audio.setPan(sequencer.getTrackSample(track), pan);
+            display.setSamplePan(track, pan);
+            break;
+        }
+
+        case InputEvent::Mode:
+            audio.cycleMode(sequencer.cursor.row);
+            updateTrackMode(sequencer.cursor.row);
+            break;
+
+        case InputEvent::Record:
+            recorder.armed = !recorder.armed;
+            recorder.calibrating = false;
+            updateRecordStatus();
+            break;
+
+        case InputEvent::Quantize:
+            recorder.cycleStrength();
+            updateRecordStatus();
+            break;
+
+        case InputEvent::Calibrate:
+            // Tap any pad along with the playing pattern
+            if (sequencer.playback.isPlaying) {
+                recorder.startCalibration();
+            } else {
+                LOG_WARN("Start playback to calibrate latency\n");
+            }
+            updateRecordStatus();
+            break;
+
+        case InputEvent::Browse:
+            browseTrack = sequencer.cursor.row;
+            input.browsing = true;
+            updateBrowsePreview();
             break;
 
         default:
@@ -237,44 +628,95 @@ void handleInput(InputEvent event) {
     }
 }
 
-// Track which wavFile index each track is using
-int trackWavIndex[NUM_INSTRUMENTS] = {0, 1, 2, 3};
+void handleBrowserInput(InputEvent event) {
+    SampleBrowser& browser = audio.browser;
 
-void cycleTrackSample(uint8_t track, int8_t direction) {
-    Serial.printf("cycleTrackSample: track=%d dir=%d wavCount=%d\n",
-                  track, direction, audio.getWavFileCount());
+    switch (event) {
+        case InputEvent::Up:
+            browser.moveSelection(-1);
+            break;
 
-    if (audio.getWavFileCount() == 0) {
-        Serial.println("No WAV files found for cycling!");
-        return;
-    }
+        case InputEvent::Down:
+            browser.moveSelection(1);
+            break;
+
+        case InputEvent::Back:
+            if (browser.up()) sequencer.forgetTrackFiles();
+            break;
+
+        case InputEvent::Select:
+            browser.clearSearch();
+            if (browser.enterSelected()) {
+                sequencer.forgetTrackFiles();
+            } else if (assignTrackFile(browseTrack, browser.selected)) {
+                // A file: loaded into the track, preview it
+                audio.playSample(sequencer.getTrackSample(browseTrack), browseTrack);
+            }
+            break;
+
+        case InputEvent::Char:
+            browser.typeChar(input.lastChar);
+            break;
+
+        case InputEvent::Backspace:
+            browser.backspace();
+            break;
 
-    // Cycle through wavFiles for this track
-    int newWavIdx = trackWavIndex[track] + direction;
+        case InputEvent::Browse:
+            browser.clearSearch();
+            input.browsing = false;
+            return;
 
-    // Wrap around
-    if (newWavIdx < 0) {
-        newWavIdx = audio.getWavFileCount() - 1;
-    } else if (newWavIdx >= audio.getWavFileCount()) {
-        newWavIdx = 0;
+        default:
+            break;
     }
 
-    trackWavIndex[track] = newWavIdx;
+    updateBrowsePreview();
+}
 
-    // Load the new sample into this track's slot
-    const char* filename = audio.getWavFileName(newWavIdx);
-    audio.loadSample(track, filename);  // Load into slot 'track'
+// Cached thumbnail of the selected file, if it has been loaded before
+void updateBrowsePreview() {
+    SampleBrowser& browser = audio.browser;
+    const BrowserEntry* e = browser.entry(browser.selected);
+    browsePreviewValid = e && !e->isDir &&
+                         audio.loadThumbnail(browser.pathOf(browser.selected), browsePreview);
+}
 
-    // Update display name
+// Loads a file of the browser's folder into the track's sample slot.
+// The slot's sample, the file z/x continue from and the name shown are
+// only updated together, when the load succeeds.
+bool assignTrackFile(uint8_t track, uint32_t fileIndex) {
+    if (!audio.loadSample(track, audio.getWavFileName(fileIndex))) return false;
+    sequencer.setTrackSample(track, track, fileIndex);
     display.setSampleName(track, audio.samples[track].name);
-
-    // Play preview
-    audio.playSample(track, track);
+    updateTrackMode(track);
+    return true;
 }
 
-void updateDisplaySampleNames() {
-    for (int i = 0; i < NUM_INSTRUMENTS; i++) {
-        uint8_t sampleIdx = sequencer.trackSamples[i];
-        display.setSampleName(i, audio.getShortName(sampleIdx));
+void cycleTrackSample(uint8_t track, int8_t direction) {
+    LOG_DEBUG("cycleTrackSample: track=%d dir=%d folder=%s\n",
+                  track, direction, audio.browser.path());
+
+    // Next WAV file in the browser's folder that loads, wrapping around
+    const int32_t from = sequencer.getTrackFile(track);
+    int32_t index = from;
+    for (uint8_t tries = 0; tries < SAMPLE_CYCLE_TRIES; tries++) {
+        index = audio.browser.nextFile(index, direction);
+        if (index < 0 || (tries > 0 && index == from)) break;
+        if (assignTrackFile(track, index)) {
+            audio.playSample(sequencer.getTrackSample(track), track);  // Preview
+            return;
+        }
     }
+    LOG_WARN("No loadable WAV file to cycle to\n");
 }
+
+// Shows the track's sample mode; a new sample may have changed it
+void updateTrackMode(uint8_t track) {
+    static const char* const MODE_NAMES[] = {"one-shot", "slice", "stretch"};
+    const Sample& s = audio.samples[sequencer.getTrackSample(track)];
+    display.setSampleMode(track, s.mode, &s.slices);
+    LOG_DEBUG("Track %d: %s\n", track + 1, MODE_NAMES[(uint8_t)s.mode]);
+    (void)MODE_NAMES;
+}
+
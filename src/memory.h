@@ -0,0 +1,285 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+// Tagged allocation. Every heap buffer the firmware owns comes from
+// memAlloc() with the subsystem it belongs to. The tag's policy decides
+// where it goes: what the mixer or a hot loop reads stays in internal
+// SRAM, bulk sample data goes to PSRAM and only falls back to internal
+// RAM while a reserve is left for the system. Past the tag's budget the
+// allocation is refused. Memory owned by libraries (the canvas, M5Unified
+// and SD setup) and the big static objects is noted with note(), so the
+// memory screen ('h') accounts for all of it. On host the replay fails a
+// session that went over any budget.
+//
+// Budgets default to the values below and can be set at build time, e.g.
+// -DMEM_BUDGET_SAMPLES_KB=2048.
+
+#include <Arduino.h>
+#include <cstdint>
+#include <cstdlib>
+#include "trace.h"
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#endif
+
+#ifndef MEM_BUDGET_SAMPLES_KB
+#define MEM_BUDGET_SAMPLES_KB 6144
+#endif
+#ifndef MEM_BUDGET_STRETCH_KB
+#define MEM_BUDGET_STRETCH_KB 2048
+#endif
+#ifndef MEM_BUDGET_ANALYSIS_KB
+#define MEM_BUDGET_ANALYSIS_KB 128
+#endif
+#ifndef MEM_BUDGET_KITLOAD_KB
+#define MEM_BUDGET_KITLOAD_KB 48
+#endif
+#ifndef MEM_BUDGET_ATTACK_KB
+#define MEM_BUDGET_ATTACK_KB 16
+#endif
+#ifndef MEM_BUDGET_SESSION_KB
+#define MEM_BUDGET_SESSION_KB 64
+#endif
+#ifndef MEM_BUDGET_CANVAS_KB
+#define MEM_BUDGET_CANVAS_KB 64
+#endif
+#ifndef MEM_BUDGET_SYSTEM_KB
+#define MEM_BUDGET_SYSTEM_KB 96
+#endif
+#ifndef MEM_BUDGET_STATIC_KB
+#define MEM_BUDGET_STATIC_KB 64
+#endif
+
+// Internal RAM that PSRAM allocations never fall back into: stacks, WiFi,
+// USB and the libraries' own later allocations need it
+#ifndef MEM_INTERNAL_RESERVE_KB
+#define MEM_INTERNAL_RESERVE_KB 48
+#endif
+
+enum class MemTag : uint8_t {
+    Samples,   // Sample data
+    Stretch,   // Time-stretch renders
+    Analysis,  // Onset detection work buffers
+    KitLoad,   // Startup kit read buffers
+    Attack,    // Attack copies the mixer reads
+    Session,   // Session recording buffer
+    Canvas,    // Display sprite (noted)
+    System,    // M5Unified speaker, display and keyboard, SD (noted)
+    Static     // Engine objects (noted)
+};
+constexpr uint8_t MEM_TAG_COUNT = 9;
+
+enum class MemPlace : uint8_t {
+    Internal,     // Internal SRAM only
+    Dma,          // Internal and DMA-capable
+    Psram,        // PSRAM only
+    PreferPsram   // PSRAM, else internal RAM above the reserve
+};
+
+struct MemPolicy {
+    const char* name;
+    MemPlace place;
+    uint32_t budget;  // Bytes
+};
+
+constexpr MemPolicy MEM_POLICIES[MEM_TAG_COUNT] = {
+    {"samples", MemPlace::PreferPsram, MEM_BUDGET_SAMPLES_KB * 1024u},
+    {"stretch", MemPlace::PreferPsram, MEM_BUDGET_STRETCH_KB * 1024u},
+    {"analysis", MemPlace::Internal, MEM_BUDGET_ANALYSIS_KB * 1024u},
+    {"kit load", MemPlace::Dma, MEM_BUDGET_KITLOAD_KB * 1024u},
+    {"attacks", MemPlace::Internal, MEM_BUDGET_ATTACK_KB * 1024u},
+    {"session", MemPlace::PreferPsram, MEM_BUDGET_SESSION_KB * 1024u},
+    {"canvas", MemPlace::Internal, MEM_BUDGET_CANVAS_KB * 1024u},
+    {"system", MemPlace::Internal, MEM_BUDGET_SYSTEM_KB * 1024u},
+    {"static", MemPlace::Internal, MEM_BUDGET_STATIC_KB * 1024u},
+};
+
+struct MemUsage {
+    uint32_t internal = 0;   // Bytes in use by place
+    uint32_t psram = 0;
+    uint32_t peak = 0;       // Most in use at once
+    uint32_t allocs = 0;     // Blocks in use
+    uint32_t refused = 0;    // Allocations refused by the budget
+    uint32_t fallbacks = 0;  // PSRAM allocations placed in internal RAM
+
+    uint32_t used() const { return internal + psram; }
+};
+
+// Accounting for every tag. Allocation happens on the loop task only.
+class MemoryMap {
+public:
+    MemUsage usage[MEM_TAG_COUNT];
+    uint32_t budgets[MEM_TAG_COUNT];
+
+    MemoryMap() {
+        for (uint8_t i = 0; i < MEM_TAG_COUNT; i++) budgets[i] = MEM_POLICIES[i].budget;
+    }
+
+    void* alloc(MemTag tag, size_t bytes, MemPlace place) {
+        const uint8_t t = (uint8_t)tag;
+        MemUsage& u = usage[t];
+        if (bytes > budgets[t] || u.used() > budgets[t] - bytes) {
+            u.refused++;
+            LOG_WARN("Memory: %u bytes for %s would pass its %u KB budget\n", (unsigned)bytes,
+                     MEM_POLICIES[t].name, (unsigned)(budgets[t] / 1024));
+            return nullptr;
+        }
+
+        bool internal = place == MemPlace::Internal || place == MemPlace::Dma;
+        Header* h = (Header*)rawAlloc(sizeof(Header) + bytes, place);
+        if (!h && place == MemPlace::PreferPsram &&
+            heapFree(true) >= bytes + MEM_INTERNAL_RESERVE_KB * 1024u) {
+            h = (Header*)rawAlloc(sizeof(Header) + bytes, MemPlace::Internal);
+            internal = true;
+            if (h) {
+                u.fallbacks++;
+                LOG_WARN("Memory: no PSRAM for %u bytes of %s, using internal RAM\n",
+                         (unsigned)bytes, MEM_POLICIES[t].name);
+            }
+        }
+        if (!h) {
+            LOG_WARN("Memory: %u bytes for %s not available\n", (unsigned)bytes, MEM_POLICIES[t].name);
+            return nullptr;
+        }
+
+        h->bytes = (uint32_t)bytes;
+        h->tag = t;
+        h->internal = internal;
+        h->magic = MAGIC;
+        add(u, (uint32_t)bytes, internal);
+        u.allocs++;
+        return h + 1;
+    }
+
+    void release(void* p) {
+        if (!p) return;
+        Header* h = (Header*)p - 1;
+        if (h->magic != MAGIC || h->tag >= MEM_TAG_COUNT) {
+            LOG_ERROR("Memory: freeing a block memAlloc() didn't return\n");
+            return;
+        }
+        MemUsage& u = usage[h->tag];
+        (h->internal ? u.internal : u.psram) -= h->bytes;
+        u.allocs--;
+        h->magic = 0;
+#ifdef ARDUINO
+        heap_caps_free(h);
+#else
+        free(h);
+#endif
+    }
+
+    // Memory allocated elsewhere, counted against the tag's budget but
+    // never refused
+    void note(MemTag tag, uint32_t bytes, bool internal) {
+        const uint8_t t = (uint8_t)tag;
+        MemUsage& u = usage[t];
+        add(u, bytes, internal);
+        if (u.used() > budgets[t]) {
+            u.refused++;
+            LOG_WARN("Memory: %s uses %u KB, over its %u KB budget\n", MEM_POLICIES[t].name,
+                     (unsigned)(u.used() / 1024), (unsigned)(budgets[t] / 1024));
+        }
+    }
+
+    uint32_t internalUsed() const {
+        uint32_t sum = 0;
+        for (const MemUsage& u : usage) sum += u.internal;
+        return sum;
+    }
+
+    // Tags that went over their budget at some point
+    uint8_t overBudget() const {
+        uint8_t count = 0;
+        for (const MemUsage& u : usage) count += u.refused > 0;
+        return count;
+    }
+
+    // Heap as the chip sees it; 0 on host, where there's only one
+    static uint32_t heapFree(bool internal) {
+#ifdef ARDUINO
+        return heap_caps_get_free_size(internal ? MALLOC_CAP_INTERNAL : MALLOC_CAP_SPIRAM);
+#else
+        (void)internal;
+        return 0;
+#endif
+    }
+
+    static uint32_t heapTotal(bool internal) {
+#ifdef ARDUINO
+        return heap_caps_get_total_size(internal ? MALLOC_CAP_INTERNAL : MALLOC_CAP_SPIRAM);
+#else
+        (void)internal;
+        return 0;
+#endif
+    }
+
+    void logReport() const {
+        LOG_INFO("Memory: internal %u/%u KB free, PSRAM %u/%u KB free\n",
+                 (unsigned)(heapFree(true) / 1024), (unsigned)(heapTotal(true) / 1024),
+                 (unsigned)(heapFree(false) / 1024), (unsigned)(heapTotal(false) / 1024));
+        for (uint8_t i = 0; i < MEM_TAG_COUNT; i++) {
+            const MemUsage& u = usage[i];
+            LOG_INFO("  %-9s %6u KB internal %6u KB PSRAM, peak %6u of %6u KB, %u refused, "
+                     "%u fallbacks\n", MEM_POLICIES[i].name, (unsigned)(u.internal / 1024),
+                     (unsigned)(u.psram / 1024), (unsigned)(u.peak / 1024),
+                     (unsigned)(budgets[i] / 1024), (unsigned)u.refused, (unsigned)u.fallbacks);
+        }
+    }
+
+private:
+    static constexpr uint16_t MAGIC = 0x4D4D;
+
+    // Ahead of every block; 16 bytes keep the block as aligned as the heap's
+    struct Header {
+        uint32_t bytes;
+        uint8_t tag;
+        uint8_t internal;
+        uint16_t magic;
+        uint32_t reserved[2];
+    };
+    static_assert(sizeof(Header) == 16, "block header size");
+
+    static void add(MemUsage& u, uint32_t bytes, bool internal) {
+        (internal ? u.internal : u.psram) += bytes;
+        if (u.used() > u.peak) u.peak = u.used();
+    }
+
+    static void* rawAlloc(size_t bytes, MemPlace place) {
+#ifdef ARDUINO
+        switch (place) {
+            case MemPlace::Internal:
+                return heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            case MemPlace::Dma:
+                return heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+            case MemPlace::Psram:
+            case MemPlace::PreferPsram:
+                return heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        }
+        return nullptr;
+#else
+        (void)place;
+        return malloc(bytes);
+#endif
+    }
+};
+
+inline MemoryMap& memoryMap() {
+    static MemoryMap map;
+    return map;
+}
+
+// Allocates for tag where its policy says
+inline void* memAlloc(MemTag tag, size_t bytes) {
+    return memoryMap().alloc(tag, bytes, MEM_POLICIES[(uint8_t)tag].place);
+}
+
+// Allocates for tag in a place other than its policy's
+inline void* memAlloc(MemTag tag, size_t bytes, MemPlace place) {
+    return memoryMap().alloc(tag, bytes, place);
+}
+
+inline void memFree(void* p) { memoryMap().release(p); }
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <Arduino.h>
+#include <cstdint>
+
+// MIDI runs over the USB-CDC serial port (use a serial-to-MIDI bridge on the
+// host). Output is off by default since debug logging shares the port.
+#ifndef MIDI_OUT_ENABLED
+#define MIDI_OUT_ENABLED 0
+#endif
+
+// MIDI status bytes
+constexpr uint8_t MIDI_NOTE_OFF      = 0x80;
+constexpr uint8_t MIDI_NOTE_ON       = 0x90;
+constexpr uint8_t MIDI_SONG_POSITION = 0xF2;
+constexpr uint8_t MIDI_CLOCK         = 0xF8;
+constexpr uint8_t MIDI_START         = 0xFA;
+constexpr uint8_t MIDI_CONTINUE      = 0xFB;
+constexpr uint8_t MIDI_STOP          = 0xFC;
+
+constexpr uint8_t MIDI_PPQN = 24;
+constexpr uint8_t MIDI_DRUM_CHANNEL = 9;  // Channel 10, zero-based
+
+// GM drum notes mapped to tracks: kick, snare, closed hat, open hat, then
+// clap, toms, cymbals and percussion for larger engine configurations
+constexpr uint8_t MIDI_TRACK_NOTES[16] = {36, 38, 42, 46, 39, 45, 48, 49,
+                                          51, 37, 56, 41, 43, 47, 50, 44};
+
+enum class MidiMessageType : uint8_t {
+    None,
+    Clock,
+    Start,
+    Continue,
+    Stop,
+    SongPosition,
+    NoteOn,
+    NoteOff
+};
+
+struct MidiMessage {
+    MidiMessageType type = MidiMessageType::None;
+    uint8_t channel = 0;
+    uint8_t data1 = 0;       // Note number
+    uint8_t data2 = 0;       // Velocity
+    uint16_t value = 0;      // Song position in 16th notes
+};
+
+// Byte-stream parser. Handles running status, real-time bytes interleaved
+// inside other messages, and skips SysEx and any message we don't use.
+class MidiParser {
+public:
+    MidiMessage parse(uint8_t byte) {
+        MidiMessage msg;
+
+        // Real-time messages can appear anywhere and don't touch running status
+        if (byte >= 0xF8) {
+            switch (byte) {
+                case MIDI_CLOCK:    msg.type = MidiMessageType::Clock; break;
+                case MIDI_START:    msg.type = MidiMessageType::Start; break;
+                case MIDI_CONTINUE: msg.type = MidiMessageType::Continue; break;
+                case MIDI_STOP:     msg.type = MidiMessageType::Stop; break;
+                default: break;
+            }
+            return msg;
+        }
+
+        if (byte & 0x80) {
+            status = byte;
+            dataCount = 0;
+            // System common messages cancel running status
+            if (byte >= 0xF0 && byte != MIDI_SONG_POSITION) {
+                status = 0;
+            }
+            return msg;
+        }
+
+        // Data byte with no status (e.g. inside SysEx): ignore
+        if (status == 0) return msg;
+
+        data[dataCount++] = byte;
+        if (dataCount < expectedDataBytes(status)) return msg;
+        dataCount = 0;
+
+        uint8_t kind = status & 0xF0;
+        if (status == MIDI_SONG_POSITION) {
+            msg.type = MidiMessageType::SongPosition;
+            msg.value = data[0] | (data[1] << 7);
+            status = 0;
+        } else if (kind == MIDI_NOTE_ON || kind == MIDI_NOTE_OFF) {
+            // Note-on with velocity 0 is a note-off
+            bool on = (kind == MIDI_NOTE_ON) && data[1] > 0;
+            msg.type = on ? MidiMessageType::NoteOn : MidiMessageType::NoteOff;
+            msg.channel = status & 0x0F;
+            msg.data1 = data[0];
+            msg.data2 = data[1];
+        }
+        return msg;
+    }
+
+private:
+    uint8_t status = 0;
+    uint8_t data[2] = {0, 0};
+    uint8_t dataCount = 0;
+
+    static uint8_t expectedDataBytes(uint8_t status) {
+        switch (status & 0xF0) {
+            case 0xC0:
+            case 0xD0:
+                return 1;  // Program change, channel pressure
+            case 0xF0:
+                return 2;  // Song position (only system common we keep)
+            default:
+                return 2;
+        }
+    }
+};
+
+// Message generator. Always sends full status bytes so a receiver that
+// joins mid-stream resyncs immediately.
+class MidiOut {
+public:
+    explicit MidiOut(Print& port) : port(port) {}
+
+    void sendClock()    { port.write(MIDI_CLOCK); }
+    void sendStart()    { port.write(MIDI_START); }
+    void sendContinue() { port.write(MIDI_CONTINUE); }
+    void sendStop()     { port.write(MIDI_STOP); }
+
+    void sendSongPosition(uint16_t sixteenths) {
+        uint8_t msg[3] = {MIDI_SONG_POSITION,
+                          (uint8_t)(sixteenths & 0x7F),
+                          (uint8_t)((sixteenths >> 7) & 0x7F)};
+        port.write(msg, 3);
+    }
+
+    void sendNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
+        uint8_t msg[3] = {(uint8_t)(MIDI_NOTE_ON | (channel & 0x0F)),
+                          (uint8_t)(note & 0x7F),
+                          (uint8_t)(velocity & 0x7F)};
+        port.write(msg, 3);
+    }
+
+    void sendNoteOff(uint8_t channel, uint8_t note) {
+        sendNoteOn(channel, note, 0);
+    }
+
+private:
+    Print& port;
+};
+
+// Recovers a steady tempo from 24 PPQN clock ticks timestamped on arrival.
+// The ticks are only seen when loop() gets around to reading serial, so the
+// raw intervals carry several ms of jitter. A second-order PLL tracks both
+// phase and period; the period estimate is what drives stepIntervalMs.
+class MidiClockSync {
+public:
+    static constexpr float PHASE_GAIN = 0.125f;
+    static constexpr float PERIOD_GAIN = 0.004f;
+    static constexpr uint8_t ACQUIRE_TICKS = 12;       // Plain averaging before locking
+    static constexpr float MIN_PERIOD_US = 60e6f / (300 * MIDI_PPQN);  // 300 BPM
+    static constexpr float MAX_PERIOD_US = 60e6f / (20 * MIDI_PPQN);   // 20 BPM
+
+    void reset() {
+        ticks = 0;
+        locked = false;
+    }
+
+    void onTick(uint32_t nowUs) {
+        if (ticks == 0) {
+            firstTickUs = nowUs;
+            predictedUs = 0.0f;
+            ticks = 1;
+            return;
+        }
+
+        uint32_t sinceFirst = nowUs - firstTickUs;
+
+        // Clock stalled (source stopped sending): start acquiring again
+        if (locked && sinceFirst - predictedUs > 4.0f * periodUs) {
+            reset();
+            onTick(nowUs);
+            return;
+        }
+
+        if (ticks < ACQUIRE_TICKS) {
+            // Mean interval so far is a good enough starting estimate
+            periodUs = (float)sinceFirst / ticks;
+            predictedUs = (float)sinceFirst;
+            ticks++;
+            if (ticks == ACQUIRE_TICKS) locked = true;
+            return;
+        }
+
+        // Phase is kept relative to the first tick so float precision holds
+        // for hours of playback at typical tempos
+        predictedUs += periodUs;
+        float error = (float)sinceFirst - predictedUs;
+        predictedUs += error * PHASE_GAIN;
+        periodUs += error * PERIOD_GAIN;
+
+        if (periodUs < MIN_PERIOD_US) periodUs = MIN_PERIOD_US;
+        if (periodUs > MAX_PERIOD_US) periodUs = MAX_PERIOD_US;
+
+        // Rebase to keep the float offsets small
+        if (predictedUs > 1e6f) {
+            uint32_t shift = (uint32_t)predictedUs;
+            firstTickUs += shift;
+            predictedUs -= shift;
+        }
+    }
+
+    bool isLocked() const { return locked; }
+
+    float getTickPeriodUs() const { return periodUs; }
+
+    // Smoothed time of the latest tick, with the arrival jitter filtered out
+    uint32_t getFilteredTickUs() const {
+        return firstTickUs + (uint32_t)predictedUs;
+    }
+
+    float getBPM() const {
+        return 60e6f / (periodUs * MIDI_PPQN);
+    }
+
+private:
+    uint32_t ticks = 0;
+    uint32_t firstTickUs = 0;
+    float predictedUs = 0.0f;
+    float periodUs = 60e6f / (120 * MIDI_PPQN);
+    bool locked = false;
+};
+
+// Schedules outgoing clock ticks while the internal clock is master.
+// Ticks are anchored to each sequencer step, so the slave never drifts
+// from our step grid even though steps are timed in milliseconds.
+class MidiClockOut {
+public:
+    static constexpr uint8_t TICKS_PER_STEP = MIDI_PPQN / 4;  // 16th notes
+
+    void onStep(uint32_t nowUs) {
+        stepStartUs = nowUs;
+        tickIndex = 0;
+    }
+
+    void stop() { tickIndex = TICKS_PER_STEP; }
+
+    // Returns true when a tick is due; call repeatedly until it returns false
+    bool poll(uint32_t nowUs, uint32_t stepIntervalUs) {
+        uint32_t dueUs;
+        if (!nextDueUs(stepIntervalUs, dueUs) || (int32_t)(nowUs - dueUs) < 0) return false;
+        tickIndex++;
+        return true;
+    }
+
+    // When the next tick of this step is due; false once all are sent.
+    // Ticks divide the step on the same microsecond grid the sequencer
+    // runs on, so the gap into the next step matches the others.
+    bool nextDueUs(uint32_t stepIntervalUs, uint32_t& dueUs) const {
+        if (tickIndex >= TICKS_PER_STEP) return false;
+        dueUs = stepStartUs + stepIntervalUs * tickIndex / TICKS_PER_STEP;
+        return true;
+    }
+
+private:
+    uint32_t stepStartUs = 0;
+    uint8_t tickIndex = TICKS_PER_STEP;
+};
+
+#endif
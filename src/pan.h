@@ -0,0 +1,117 @@
+#ifndef PAN_H
+#define PAN_H
+
+// Per-track pan for a stereo output. M5Unified's speaker task is the mix
+// bus: it sums every channel into the output, stereo channels in stereo
+// when the output is stereo. So each slot keeps an interleaved stereo
+// render of what it plays with its track's pan applied, and plays that.
+// A pan change re-renders in place, a chunk at a time between deadlines.
+//
+// Mono sources are panned with the constant-power law below (-3 dB each
+// side at centre). Stereo sources are kept as mid and side and balanced:
+// unity at centre, the far side fading out with the same law.
+//
+// The Cardputer's own speaker is mono, so stereo goes to an external I2S
+// DAC or codec: build with -DSTEREO_OUTPUT=1 and its pins, e.g.
+// -DSTEREO_I2S_BCK=5 -DSTEREO_I2S_WS=6 -DSTEREO_I2S_DOUT=7.
+
+#include <cstddef>
+#include <cstdint>
+#include "wav.h"
+
+#ifndef STEREO_OUTPUT
+#define STEREO_OUTPUT 0
+#endif
+
+#ifndef STEREO_I2S_BCK
+#define STEREO_I2S_BCK -1
+#endif
+#ifndef STEREO_I2S_WS
+#define STEREO_I2S_WS -1
+#endif
+#ifndef STEREO_I2S_DOUT
+#define STEREO_I2S_DOUT -1
+#endif
+
+#if STEREO_OUTPUT && (STEREO_I2S_BCK < 0 || STEREO_I2S_WS < 0 || STEREO_I2S_DOUT < 0)
+#error "STEREO_OUTPUT needs the DAC's STEREO_I2S_BCK, STEREO_I2S_WS and STEREO_I2S_DOUT pins"
+#endif
+
+constexpr bool STEREO = STEREO_OUTPUT != 0;
+constexpr int8_t PAN_MAX = 8;                // -8 hard left, 0 centre, 8 hard right
+constexpr size_t PAN_CHUNK_FRAMES = 8192;    // Re-rendered per loop pass
+
+// Q15 gains, 32768 = unity
+struct PanGains {
+    uint16_t left;
+    uint16_t right;
+};
+
+// cos and sin of (pan + 8) / 16 * 90 degrees
+constexpr PanGains PAN_LAW[2 * PAN_MAX + 1] = {
+    {32768,     0},  // -8
+    {32610,  3212},  // -7
+    {32138,  6393},  // -6
+    {31357,  9512},  // -5
+    {30274, 12540},  // -4
+    {28899, 15447},  // -3
+    {27246, 18205},  // -2
+    {25330, 20788},  // -1
+    {23170, 23170},  //  0
+    {20788, 25330},  // +1
+    {18205, 27246},  // +2
+    {15447, 28899},  // +3
+    {12540, 30274},  // +4
+    { 9512, 31357},  // +5
+    { 6393, 32138},  // +6
+    { 3212, 32610},  // +7
+    {    0, 32768},  // +8
+};
+
+constexpr int8_t panClamp(int pan) {
+    return (int8_t)(pan < -PAN_MAX ? -PAN_MAX : pan > PAN_MAX ? PAN_MAX : pan);
+}
+
+constexpr PanGains panGains(int8_t pan) {
+    return PAN_LAW[panClamp(pan) + PAN_MAX];
+}
+
+// The law scaled to unity at centre, for sources that are already stereo
+constexpr uint16_t panBalanceGain(uint16_t gain) {
+    return (uint16_t)(gain >= PAN_LAW[PAN_MAX].left ? 32768u
+                      : (uint32_t)gain * 32768u / PAN_LAW[PAN_MAX].left);
+}
+
+constexpr PanGains panBalance(int8_t pan) {
+    return {panBalanceGain(panGains(pan).left), panBalanceGain(panGains(pan).right)};
+}
+
+static_assert(panBalance(0).left == 32768 && panBalance(0).right == 32768, "balance is unity at centre");
+
+// Mono source to interleaved stereo. Branch-free in fixed groups of 8 so
+// GCC vectorizes it on host; no clamp is needed with gains up to unity.
+inline void panMono(const int16_t* __restrict in, int16_t* __restrict out, size_t frames,
+                    PanGains gains) {
+    const int32_t gl = gains.left, gr = gains.right;
+    wavForEach8(frames, [&](size_t i) {
+        const int32_t s = in[i];
+        out[2 * i] = (int16_t)((s * gl) >> 15);
+        out[2 * i + 1] = (int16_t)((s * gr) >> 15);
+    });
+}
+
+// Mid and side to interleaved stereo: left = mid + side, right = mid - side
+inline void panMidSide(const int16_t* __restrict mid, const int16_t* __restrict side,
+                       int16_t* __restrict out, size_t frames, PanGains gains) {
+    const int32_t gl = gains.left, gr = gains.right;
+    wavForEach8(frames, [&](size_t i) {
+        int32_t l = mid[i] + side[i];
+        int32_t r = mid[i] - side[i];
+        l = l < -32768 ? -32768 : (l > 32767 ? 32767 : l);
+        r = r < -32768 ? -32768 : (r > 32767 ? 32767 : r);
+        out[2 * i] = (int16_t)((l * gl) >> 15);
+        out[2 * i + 1] = (int16_t)((r * gr) >> 15);
+    });
+}
+
+#endif
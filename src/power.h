@@ -0,0 +1,262 @@
+#ifndef POWER_H
+#define POWER_H
+
+// Event-driven main loop and power management. Instead of polling flat
+// out, loop() declares its next deadlines each cycle and blocks until the
+// earliest one, or until another task wakes it (MIDI input).
+//
+// Hard deadlines (steps, micro-timed triggers, MIDI clock out) are never
+// slept up to: the task wakes wakeMarginUs early and spins the rest, so
+// timer and light-sleep wake-up latency can't make a step late. Soft
+// deadlines (keyboard scan, display refresh) are simply slept towards.
+//
+// Each state has a clock and sleep profile. While playing the CPU stays at
+// full speed and light sleep is off, since the speaker's I2S DMA must keep
+// running. Stopped, the clock drops between cycles and light sleep is
+// allowed while nothing is sounding; after a while without input the
+// keyboard is scanned less often. A thermal cap lowers the top clock when
+// the chip runs hot.
+
+#include <Arduino.h>
+#include <cstdint>
+#include "trace.h"
+
+#ifdef ARDUINO
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+enum class PowerState : uint8_t { Playing, Stopped, Idle };
+constexpr uint8_t POWER_STATE_COUNT = 3;
+
+struct PowerProfile {
+    const char* name;
+    uint16_t maxMhz;        // Clock while the loop is working
+    uint16_t minMhz;        // Clock while blocked (with DFS)
+    bool lightSleep;        // Automatic light sleep while blocked
+    uint32_t scanUs;        // Keyboard poll period
+    uint32_t wakeMarginUs;  // Wake this early for a hard deadline, then spin
+};
+
+constexpr PowerProfile POWER_PROFILES[POWER_STATE_COUNT] = {
+    {"playing", 240, 240, false, 2000, 200},
+    {"stopped", 240, 80, true, 5000, 2000},
+    {"idle", 160, 80, true, 20000, 2000},
+};
+
+constexpr uint32_t POWER_IDLE_AFTER_MS = 30000;   // Stopped without input
+constexpr uint32_t POWER_LATE_US = 500;           // Hard deadline counted as missed
+constexpr uint32_t POWER_THERMAL_CHECK_MS = 5000;
+constexpr float POWER_THERMAL_LIMIT_C = 75.0f;
+constexpr float POWER_THERMAL_RESUME_C = 65.0f;
+constexpr uint16_t POWER_THERMAL_MHZ = 160;       // Top clock while hot
+
+// How to wait for the next deadline: block until sleepUntilUs, then, if
+// spin, busy-wait until spinUntilUs (the hard deadline itself)
+struct PowerPlan {
+    uint32_t sleepUntilUs;
+    uint32_t spinUntilUs;
+    bool spin;
+};
+
+struct PowerStats {
+    uint64_t totalUs = 0;
+    uint64_t blockedUs = 0;    // CPU free to idle or light sleep
+    uint64_t spinUs = 0;       // Busy-waiting the last stretch before a hard deadline
+    uint32_t wakeups = 0;
+    uint32_t hardDeadlines = 0;
+    uint32_t lateCount = 0;    // Reached more than POWER_LATE_US late
+    uint32_t lateMaxUs = 0;
+    uint64_t lateSumUs = 0;
+};
+
+class PowerManager {
+public:
+    PowerStats stats[POWER_STATE_COUNT];
+    bool pmSupported = false;  // esp_pm DFS and light sleep in this build
+    bool throttled = false;    // Thermal cap in effect
+    bool sleepAllowed = false; // Light sleep currently enabled
+    uint16_t activeMhz = 240;  // Clock the loop works at
+
+    void begin() {
+#ifdef ARDUINO
+        task = xTaskGetCurrentTaskHandle();
+        esp_timer_create_args_t args = {};
+        args.callback = [](void* arg) { xTaskNotifyGive((TaskHandle_t)arg); };
+        args.arg = task;
+        args.name = "wake";
+        esp_timer_create(&args, &timer);
+
+        // Fails with ESP_ERR_NOT_SUPPORTED when the core is built without
+        // CONFIG_PM_ENABLE; then the clock is only set per state
+        pmSupported = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "loop", &workLock) == ESP_OK;
+        if (pmSupported) {
+            esp_pm_lock_acquire(workLock);
+        } else {
+            LOG_WARN("No power management in this build, fixed clock per state\n");
+        }
+#endif
+        applyProfile();
+        cycleStartUs = micros();
+    }
+
+    PowerState state() const { return current; }
+    const PowerProfile& profile() const { return POWER_PROFILES[(uint8_t)current]; }
+
+    // Switches profile. allowSleep is false while anything needs the
+    // clocks running through a sleep (sound playing, USB host attached).
+    void setState(PowerState state, bool allowSleep) {
+        bool sleep = POWER_PROFILES[(uint8_t)state].lightSleep && allowSleep;
+        if (state == current && sleep == sleepAllowed) return;
+        current = state;
+        sleepAllowed = sleep;
+        applyProfile();
+    }
+
+    // Chip temperature, sampled every POWER_THERMAL_CHECK_MS
+    void updateThermal(float celsius) {
+        bool hot = throttled ? celsius > POWER_THERMAL_RESUME_C : celsius > POWER_THERMAL_LIMIT_C;
+        if (hot == throttled) return;
+        throttled = hot;
+        LOG_INFO("Thermal cap %s at %.1f C\n", hot ? "on" : "off", celsius);
+        applyProfile();
+    }
+
+    void hardDeadline(uint32_t tUs) {
+        if (!hasHard || (int32_t)(tUs - hardUs) < 0) hardUs = tUs;
+        hasHard = true;
+    }
+
+    void softDeadline(uint32_t tUs) {
+        if (!hasSoft || (int32_t)(tUs - softUs) < 0) softUs = tUs;
+        hasSoft = true;
+    }
+
+    // Whether work taking costUs, started now, ends before the wake-up
+    // for the next hard deadline declared so far
+    bool fits(uint32_t nowUs, uint32_t costUs) const {
+        if (!hasHard) return true;
+        return (int32_t)(hardUs - profile().wakeMarginUs - nowUs) >= (int32_t)costUs;
+    }
+
+    PowerPlan plan(uint32_t nowUs) const {
+        PowerPlan p = {nowUs + profile().scanUs, 0, false};
+        if (hasHard) {
+            p = {hardUs - profile().wakeMarginUs, hardUs, true};
+        }
+        if (hasSoft && (!hasHard || (int32_t)(softUs - p.sleepUntilUs) < 0)) {
+            p = {softUs, 0, false};
+        }
+        if ((int32_t)(p.sleepUntilUs - nowUs) < 0) p.sleepUntilUs = nowUs;
+        return p;
+    }
+
+    // Books one cycle: work since the last wait, then blocked from
+    // blockStartUs to blockEndUs and spinning until endUs
+    void finishWait(const PowerPlan& p, uint32_t blockStartUs, uint32_t blockEndUs, uint32_t endUs) {
+        PowerStats& s = stats[(uint8_t)current];
+        s.totalUs += endUs - cycleStartUs;
+        s.blockedUs += blockEndUs - blockStartUs;
+        s.spinUs += endUs - blockEndUs;
+        s.wakeups++;
+
+        // Woken early by an event: the deadline is planned again next cycle
+        if (p.spin && (int32_t)(blockEndUs - p.sleepUntilUs) >= 0) {
+            int32_t late = (int32_t)(endUs - p.spinUntilUs);
+            uint32_t lateUs = late > 0 ? (uint32_t)late : 0;
+            s.hardDeadlines++;
+            s.lateSumUs += lateUs;
+            if (lateUs > s.lateMaxUs) s.lateMaxUs = lateUs;
+            if (lateUs > POWER_LATE_US) s.lateCount++;
+        }
+
+        hasHard = hasSoft = false;
+        cycleStartUs = endUs;
+    }
+
+    // Blocks until the next deadline or wake()
+    void wait() {
+        uint32_t start = micros();
+        PowerPlan p = plan(start);
+        TRACE(TraceEvent::SleepBegin, (uint16_t)current);
+        int32_t sleepUs = (int32_t)(p.sleepUntilUs - start);
+#ifdef ARDUINO
+        if (sleepUs > 0) {
+            if (pmSupported) esp_pm_lock_release(workLock);
+            esp_timer_start_once(timer, sleepUs);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            esp_timer_stop(timer);
+            if (pmSupported) esp_pm_lock_acquire(workLock);
+        }
+#else
+        if (sleepUs > 0) delayMicroseconds(sleepUs);
+#endif
+        uint32_t blockEnd = micros();
+        if (p.spin && (int32_t)(blockEnd - p.sleepUntilUs) >= 0) {
+            while ((int32_t)(micros() - p.spinUntilUs) < 0) {
+            }
+        }
+        uint32_t end = micros();
+        int32_t late = p.spin ? (int32_t)(end - p.spinUntilUs) : 0;
+        TRACE(TraceEvent::SleepEnd, late > 0 ? (uint16_t)(late < 0xFFFF ? late : 0xFFFF) : 0);
+        (void)late;
+        finishWait(p, start, blockEnd, end);
+    }
+
+    // Ends the current wait early; safe from other tasks
+    void wake() {
+#ifdef ARDUINO
+        if (task) xTaskNotifyGive(task);
+#endif
+    }
+
+    void logReport() const {
+        LOG_INFO("Power: %s%s\n", pmSupported ? "DFS" : "fixed clock per state",
+                 throttled ? ", thermal cap" : "");
+        for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+            const PowerStats& s = stats[i];
+            const PowerProfile& prof = POWER_PROFILES[i];
+            if (s.totalUs == 0) continue;
+            double seconds = s.totalUs / 1e6;
+            LOG_INFO("  %-8s %8.1f s  %3u/%3u MHz  sleep %-3s  cpu idle %5.1f%%  spin %4.1f%%  "
+                     "%6.0f wakeups/s  late max %u us, %u of %u over %u us\n",
+                     prof.name, seconds, prof.maxMhz, prof.minMhz, prof.lightSleep ? "yes" : "no",
+                     100.0 * s.blockedUs / s.totalUs, 100.0 * s.spinUs / s.totalUs,
+                     s.wakeups / seconds, (unsigned)s.lateMaxUs, (unsigned)s.lateCount,
+                     (unsigned)s.hardDeadlines, (unsigned)POWER_LATE_US);
+        }
+    }
+
+private:
+    PowerState current = PowerState::Stopped;
+    uint32_t hardUs = 0;
+    uint32_t softUs = 0;
+    bool hasHard = false;
+    bool hasSoft = false;
+    uint32_t cycleStartUs = 0;
+#ifdef ARDUINO
+    TaskHandle_t task = nullptr;
+    esp_timer_handle_t timer = nullptr;
+    esp_pm_lock_handle_t workLock = nullptr;
+#endif
+
+    void applyProfile() {
+        const PowerProfile& prof = profile();
+        activeMhz = throttled && prof.maxMhz > POWER_THERMAL_MHZ ? POWER_THERMAL_MHZ : prof.maxMhz;
+        uint16_t minMhz = prof.minMhz < activeMhz ? prof.minMhz : activeMhz;
+#ifdef ARDUINO
+        if (pmSupported) {
+            esp_pm_config_esp32s3_t config = {(int)activeMhz, (int)minMhz, sleepAllowed};
+            esp_pm_configure(&config);
+        } else {
+            setCpuFrequencyMhz(activeMhz);
+        }
+#else
+        (void)minMhz;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+// Attack prefetch. The speaker task mixes voices straight out of their
+// sample buffers in PSRAM, so the first block of every hit is read from
+// cold cache lines, and several hits on one step stack the misses up.
+// Triggers are seen a mixer block before they are due, the first
+// ATTACK_FRAMES of each is copied into internal SRAM then, and the hit
+// plays that copy with the rest of the sample queued behind it on the
+// same channel. Lines count samples: in a stereo build they hold half as
+// many interleaved frames.
+
+#include <Arduino.h>
+#include <cstdint>
+#include <cstring>
+#include "memory.h"
+#include "trace.h"
+
+constexpr uint16_t ATTACK_FRAMES = 512;  // 23 ms at 22.05 kHz, 1 KB per line
+
+struct AttackLine {
+    const int16_t* source = nullptr;  // Sample data the line is a copy of
+    uint16_t frames = 0;
+    int16_t* data = nullptr;
+};
+
+struct PrefetchStats {
+    uint32_t prefetches = 0;   // Attacks copied ahead of their trigger
+    uint32_t hits = 0;         // Triggers that found their attack copied
+    uint32_t misses = 0;       // Triggers played straight from PSRAM
+    uint32_t lateTails = 0;    // Tails queued after the attack had run out
+    uint64_t copyCycles = 0;   // CPU cycles spent copying attacks
+};
+
+// Two lines per channel: the attack playing now and the next one
+template <uint8_t CHANNELS>
+class AttackCache {
+public:
+    PrefetchStats stats;
+
+    // Lines in internal RAM; false if it can't be had
+    bool begin() {
+        if (pool) return true;
+        pool = (int16_t*)memAlloc(MemTag::Attack, POOL_BYTES);
+        if (!pool) {
+            LOG_WARN("No internal RAM for attack prefetch\n");
+            return false;
+        }
+        for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+            for (uint8_t i = 0; i < 2; i++) {
+                lines[ch][i].data = pool + (ch * 2 + i) * ATTACK_FRAMES;
+            }
+            playing[ch] = 0;
+            ready[ch] = NONE;
+        }
+        return true;
+    }
+
+    bool enabled() const { return pool != nullptr; }
+
+    // Copies the attack of the next hit on a channel. Cheap to repeat for
+    // the same source; a different source replaces an unplayed copy.
+    void prefetch(uint8_t channel, const int16_t* source, size_t length) {
+        if (!pool || channel >= CHANNELS) return;
+        if (ready[channel] != NONE && lines[channel][ready[channel]].source == source) return;
+
+        const uint8_t i = playing[channel] ^ 1;
+        AttackLine& line = lines[channel][i];
+        const uint32_t start = cycleCount();
+        line.frames = length < ATTACK_FRAMES ? (uint16_t)length : ATTACK_FRAMES;
+        memcpy(line.data, source, line.frames * sizeof(int16_t));
+        line.source = source;
+        stats.copyCycles += cycleCount() - start;
+        stats.prefetches++;
+        ready[channel] = i;
+    }
+
+    // The copied attack of source for a hit starting now, nullptr if it
+    // wasn't prefetched
+    const AttackLine* take(uint8_t channel, const int16_t* source) {
+        if (!pool || channel >= CHANNELS) return nullptr;
+        const uint8_t i = ready[channel];
+        if (i == NONE || lines[channel][i].source != source) {
+            stats.misses++;
+            return nullptr;
+        }
+        playing[channel] = i;
+        ready[channel] = NONE;
+        stats.hits++;
+        return &lines[channel][i];
+    }
+
+    // Forgets every copy, e.g. when sample memory is freed and may be
+    // reused for another sample at the same address
+    void invalidate() {
+        for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+            lines[ch][0].source = nullptr;
+            lines[ch][1].source = nullptr;
+            ready[ch] = NONE;
+        }
+    }
+
+    void logReport() const {
+        const uint32_t copies = stats.prefetches ? stats.prefetches : 1;
+        LOG_INFO("Attack prefetch: %u hits, %u misses, %u late tails; %u cycles per %u-frame "
+                 "attack read from PSRAM off the mixer\n",
+                 (unsigned)stats.hits, (unsigned)stats.misses, (unsigned)stats.lateTails,
+                 (unsigned)(stats.copyCycles / copies), (unsigned)ATTACK_FRAMES);
+    }
+
+private:
+    static constexpr uint8_t NONE = 0xFF;
+    static constexpr size_t POOL_BYTES = (size_t)CHANNELS * 2 * ATTACK_FRAMES * sizeof(int16_t);
+
+    int16_t* pool = nullptr;
+    AttackLine lines[CHANNELS][2];
+    uint8_t playing[CHANNELS] = {0};
+    uint8_t ready[CHANNELS] = {0};
+
+    static uint32_t cycleCount() {
+#ifdef ARDUINO
+        return ESP.getCycleCount();
+#else
+        return 0;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+// Live recording of pad hits into the pattern. A hit is placed on the
+// sequencer's microsecond timeline, moved back by the measured input-to-
+// audio latency, snapped towards the nearest step by the quantize
+// strength and written into the step and its micro-timing lane.
+//
+// Latency is what the player hears late plus what the keyboard reports
+// late: they line up key presses with clicks that left the speaker
+// latencyUs after the step began. It starts as an estimate from the
+// output buffering and is replaced by tapping along with playback
+// (calibration), which measures the whole loop. Offsets alias past half a
+// step, so calibrate at a moderate tempo.
+
+#include <cmath>
+#include <cstdint>
+#include "sequencer.h"
+
+constexpr uint8_t RECORD_CAL_TAPS = 8;
+constexpr uint32_t RECORD_MAX_LATENCY_US = 200000;
+
+class Recorder {
+public:
+    bool armed = false;
+    uint8_t strength = 100;    // Quantize strength in percent, 0 keeps timing as played
+    uint32_t latencyUs = 0;    // Subtracted from every hit
+    bool calibrating = false;
+    uint8_t calTaps = 0;
+
+    // Records a hit on track at hitUs (when the key was seen). Returns
+    // the step written, or -1 when not recording.
+    template <typename Config>
+    int8_t recordHit(Sequencer<Config>& seq, uint8_t track, uint32_t hitUs) {
+        if (!armed || !seq.playback.isPlaying || track >= Config::tracks) return -1;
+
+        const uint8_t length = seq.playback.patternLength;
+        float pos = seq.positionAt(hitUs - latencyUs);
+        int32_t nearest = (int32_t)floorf(pos + 0.5f);
+        float residual = (pos - nearest) * (100 - strength) / 100.0f;  // Steps, [-0.5, 0.5)
+        int8_t micro = (int8_t)lroundf(residual * MICRO_PER_STEP);
+        uint8_t step = (uint8_t)(((nearest % length) + length) % length);
+
+        seq.pattern.setStep(track, step, true);
+        seq.pattern.setMicro(track, step, micro);
+
+        // Snapped forward onto the step about to start: the live hit has
+        // already sounded, so don't play it again on this pass
+        if (nearest > seq.playback.currentStep && micro >= 0) {
+            seq.skipOnNextStep |= (typename Config::TrackMask)1 << track;
+        }
+        return step;
+    }
+
+    void cycleStrength() {
+        strength = strength == 100 ? 75 : strength == 75 ? 50 : strength == 50 ? 0 : 100;
+    }
+
+    void startCalibration() {
+        calibrating = true;
+        calTaps = 0;
+    }
+
+    // One tap along with playback during calibration. Returns true when
+    // enough taps are in and latencyUs has been updated.
+    template <typename Config>
+    bool calibrationTap(const Sequencer<Config>& seq, uint32_t hitUs) {
+        if (!calibrating || !seq.playback.isPlaying) return false;
+
+        // Distance from the nearest step start, uncompensated
+        float pos = seq.positionAt(hitUs);
+        float offset = pos - floorf(pos + 0.5f);
+        calOffsets[calTaps++] = (int32_t)(offset * seq.playback.stepIntervalUs);
+        if (calTaps < RECORD_CAL_TAPS) return false;
+
+        // Median, so one fumbled tap doesn't skew it
+        int32_t sorted[RECORD_CAL_TAPS];
+        for (uint8_t i = 0; i < RECORD_CAL_TAPS; i++) {
+            int32_t v = calOffsets[i];
+            uint8_t j = i;
+            for (; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+            sorted[j] = v;
+        }
+        int32_t median = (sorted[RECORD_CAL_TAPS / 2 - 1] + sorted[RECORD_CAL_TAPS / 2]) / 2;
+        latencyUs = median < 0 ? 0 : (uint32_t)median;
+        if (latencyUs > RECORD_MAX_LATENCY_US) latencyUs = RECORD_MAX_LATENCY_US;
+        calibrating = false;
+        return true;
+    }
+
+private:
+    int32_t calOffsets[RECORD_CAL_TAPS] = {0};
+};
+
+#endif
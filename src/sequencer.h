@@ -1,19 +1,28 @@
 #ifndef SEQUENCER_H
 #define SEQUENCER_H
 
+#include <Arduino.h>
 #include <cstdint>
+#include "engine.h"
 
 // Constants
-constexpr uint8_t NUM_INSTRUMENTS = 4;
-constexpr uint8_t MAX_STEPS = 8;
 constexpr uint8_t MIN_STEPS = 1;
 constexpr uint16_t DEFAULT_BPM = 120;
 constexpr uint16_t MIN_BPM = 60;
 constexpr uint16_t MAX_BPM = 240;
+constexpr uint8_t CLOCKS_PER_STEP = 6;  // 24 PPQN external clock, 16th note steps
+constexpr int8_t MICRO_PER_STEP = 96;   // Micro-timing resolution
+constexpr int8_t MICRO_MIN = -MICRO_PER_STEP / 2;
+constexpr int8_t MICRO_MAX = MICRO_PER_STEP / 2 - 1;
 
-// Pattern data: each byte holds 8 steps for one instrument
+// Pattern data: one step mask per instrument, plus a micro-timing lane
+// offsetting each step by up to half a step either way
+template <typename Config>
 struct Pattern {
-    uint8_t steps[NUM_INSTRUMENTS];  // Each bit = one step (0-7)
+    using StepMask = typename Config::StepMask;
+
+    StepMask steps[Config::tracks];  // Each bit = one step
+    int8_t micro[Config::tracks][Config::steps];  // 1/MICRO_PER_STEP of a step
 
     bool getStep(uint8_t instrument, uint8_t step) const {
         return (steps[instrument] >> step) & 0x01;
@@ -21,19 +30,32 @@ struct Pattern {
 
     void setStep(uint8_t instrument, uint8_t step, bool value) {
         if (value) {
-            steps[instrument] |= (1 << step);
+            steps[instrument] |= (StepMask)1 << step;
         } else {
-            steps[instrument] &= ~(1 << step);
+            steps[instrument] &= ~((StepMask)1 << step);
         }
+        micro[instrument][step] = 0;
     }
 
     void toggleStep(uint8_t instrument, uint8_t step) {
-        steps[instrument] ^= (1 << step);
+        steps[instrument] ^= (StepMask)1 << step;
+        micro[instrument][step] = 0;
+    }
+
+    int8_t getMicro(uint8_t instrument, uint8_t step) const {
+        return micro[instrument][step];
+    }
+
+    void setMicro(uint8_t instrument, uint8_t step, int8_t offset) {
+        if (offset < MICRO_MIN) offset = MICRO_MIN;
+        if (offset > MICRO_MAX) offset = MICRO_MAX;
+        micro[instrument][step] = offset;
     }
 
     void clear() {
-        for (int i = 0; i < NUM_INSTRUMENTS; i++) {
+        for (uint8_t i = 0; i < Config::tracks; i++) {
             steps[i] = 0;
+            for (uint8_t s = 0; s < Config::steps; s++) micro[i][s] = 0;
         }
     }
 };
@@ -42,15 +64,75 @@ struct Pattern {
 struct PlaybackState {
     bool isPlaying = false;
     uint8_t currentStep = 0;
-    uint8_t patternLength = MAX_STEPS;  // 1-8
+    uint8_t patternLength = Engine::steps;  // 1 to the engine's step count
+    uint32_t stepCount = 0;       // Steps since start, for positions within loops
     uint16_t bpm = DEFAULT_BPM;
-    uint32_t lastStepTimeMs = 0;
+    uint32_t stepStartUs = 0;     // When currentStep began
+    uint32_t stepIntervalUs = 125000;
     uint32_t stepIntervalMs = 125;
+    bool externalClock = false;  // Steps driven by incoming MIDI clock
+    uint8_t clockTicks = 0;      // Ticks since last step (external clock)
 
     void updateInterval() {
-        // 16th notes: 60000 / (bpm * 4) = 15000 / bpm
-        stepIntervalMs = 15000 / bpm;
+        // 16th notes: 60000000 / (bpm * 4) = 15000000 / bpm
+        stepIntervalUs = 15000000 / bpm;
+        stepIntervalMs = stepIntervalUs / 1000;
+    }
+};
+
+// Step triggers waiting for their micro-timing offset to come due. A step
+// queues at most two per track (its own late hit, the next step's early one).
+template <uint8_t CAPACITY>
+class TriggerQueue {
+public:
+
+    void clear() { count = 0; }
+
+    void push(uint32_t dueUs, uint8_t track, uint8_t step) {
+        if (count < CAPACITY) items[count++] = {dueUs, track, step};
+    }
+
+    // Calls fn(track, step) for every trigger due at nowUs
+    template <typename Fn>
+    void fireDue(uint32_t nowUs, Fn fn) {
+        for (uint8_t i = 0; i < count;) {
+            if ((int32_t)(nowUs - items[i].dueUs) >= 0) {
+                Item item = items[i];
+                items[i] = items[--count];
+                fn(item.track, item.step);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // Calls fn(track, step) for every trigger due by untilUs, leaving
+    // them queued
+    template <typename Fn>
+    void forEachDueBy(uint32_t untilUs, Fn fn) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if ((int32_t)(untilUs - items[i].dueUs) >= 0) fn(items[i].track, items[i].step);
+        }
+    }
+
+    uint8_t size() const { return count; }
+
+    // Earliest due time; false when the queue is empty
+    bool nextDueUs(uint32_t& dueUs) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (i == 0 || (int32_t)(items[i].dueUs - dueUs) < 0) dueUs = items[i].dueUs;
+        }
+        return count > 0;
     }
+
+private:
+    struct Item {
+        uint32_t dueUs;
+        uint8_t track;
+        uint8_t step;
+    };
+    Item items[CAPACITY];
+    uint8_t count = 0;
 };
 
 // Cursor for editing
@@ -59,7 +141,7 @@ struct Cursor {
     uint8_t col = 0;  // 0-7 (step)
 
     void moveUp()    { if (row > 0) row--; }
-    void moveDown()  { if (row < NUM_INSTRUMENTS - 1) row++; }
+    void moveDown(uint8_t rows) { if (row < rows - 1) row++; }
     void moveLeft()  { if (col > 0) col--; }
     void moveRight(uint8_t maxCol) { if (col < maxCol - 1) col++; }
 
@@ -69,51 +151,182 @@ struct Cursor {
 };
 
 // Main sequencer class
+template <typename Config>
 class Sequencer {
 public:
-    Pattern pattern;
+    using TrackMask = typename Config::TrackMask;
+
+    Pattern<Config> pattern;
     PlaybackState playback;
     Cursor cursor;
-    uint8_t trackSamples[NUM_INSTRUMENTS] = {0, 1, 2, 3};  // Which sample each track uses
+    uint8_t trackSamples[Config::tracks];  // Which sample each track uses
+    int32_t trackFiles[Config::tracks];    // Browser entry loaded into it, -1 if unknown
+    int8_t trackPans[Config::tracks];      // Stereo position, see pan.h
+    TriggerQueue<2 * Config::tracks> triggers;
+    TrackMask skipOnNextStep = 0;  // Track bits not to trigger at the next step start
+
+    Sequencer() { init(); }
 
     void init() {
         pattern.clear();
         playback.isPlaying = false;
         playback.currentStep = 0;
-        playback.patternLength = MAX_STEPS;
+        playback.patternLength = Config::steps;
         playback.bpm = DEFAULT_BPM;
         playback.updateInterval();
         cursor.row = 0;
         cursor.col = 0;
         // Default sample assignment
-        for (int i = 0; i < NUM_INSTRUMENTS; i++) {
+        for (uint8_t i = 0; i < Config::tracks; i++) {
             trackSamples[i] = i;
+            trackFiles[i] = -1;
+            trackPans[i] = 0;
+        }
+    }
+
+    // When the next step starts on the internal clock; false when stopped
+    // or following an external clock
+    bool nextStepDueUs(uint32_t& dueUs) const {
+        if (!playback.isPlaying || playback.externalClock) return false;
+        dueUs = playback.stepStartUs + playback.stepIntervalUs;
+        return true;
+    }
+
+    // Returns true if step changed. Steps advance on a fixed microsecond
+    // grid, so late polls don't push later steps back; after a stall of
+    // more than a step the grid restarts from now.
+    bool update(uint32_t nowUs) {
+        if (!playback.isPlaying || playback.externalClock) return false;
+
+        uint32_t elapsed = nowUs - playback.stepStartUs;
+        if (elapsed >= playback.stepIntervalUs) {
+            playback.stepStartUs = elapsed < 2 * playback.stepIntervalUs
+                ? playback.stepStartUs + playback.stepIntervalUs
+                : nowUs;
+            playback.currentStep = (playback.currentStep + 1) % playback.patternLength;
+            playback.stepCount++;
+            return true;
         }
+        return false;
     }
 
-    // Returns true if step changed
-    bool update(uint32_t currentTimeMs) {
-        if (!playback.isPlaying) return false;
+    // External clock tick. Returns true if step changed
+    bool clockTick(uint32_t nowUs) {
+        if (!playback.isPlaying || !playback.externalClock) return false;
 
-        if (currentTimeMs - playback.lastStepTimeMs >= playback.stepIntervalMs) {
-            playback.lastStepTimeMs = currentTimeMs;
+        if (++playback.clockTicks >= CLOCKS_PER_STEP) {
+            playback.clockTicks = 0;
+            playback.stepStartUs = nowUs;
             playback.currentStep = (playback.currentStep + 1) % playback.patternLength;
+            playback.stepCount++;
             return true;
         }
         return false;
     }
 
+    // Queues the triggers owed from the start of the current step: its own
+    // hits that are on time or late, and the next step's early hits
+    void scheduleStep() {
+        const uint8_t step = playback.currentStep;
+        const uint8_t next = (step + 1) % playback.patternLength;
+        const uint32_t start = playback.stepStartUs;
+        for (uint8_t track = 0; track < Config::tracks; track++) {
+            int8_t micro = pattern.getMicro(track, step);
+            bool skip = skipOnNextStep & ((TrackMask)1 << track);
+            if (pattern.getStep(track, step) && micro >= 0 && !skip) {
+                triggers.push(start + microOffsetUs(micro), track, step);
+            }
+            micro = pattern.getMicro(track, next);
+            if (pattern.getStep(track, next) && micro < 0) {
+                triggers.push(start + playback.stepIntervalUs + microOffsetUs(micro), track, next);
+            }
+        }
+        skipOnNextStep = 0;
+    }
+
+    // Calls fn(track, stepNumber) for the triggers that will fire within
+    // aheadUs: queued ones, and on the internal clock the next step's
+    // on-time and late hits (its own early ones are already queued)
+    template <typename Fn>
+    void forEachUpcoming(uint32_t nowUs, uint32_t aheadUs, Fn fn) const {
+        const uint32_t untilUs = nowUs + aheadUs;
+        triggers.forEachDueBy(untilUs, [&](uint8_t track, uint8_t step) {
+            fn(track, stepNumber(step));
+        });
+
+        uint32_t startUs;
+        if (!nextStepDueUs(startUs) || (int32_t)(untilUs - startUs) < 0) return;
+        const uint8_t next = (playback.currentStep + 1) % playback.patternLength;
+        for (uint8_t track = 0; track < Config::tracks; track++) {
+            int8_t micro = pattern.getMicro(track, next);
+            if (!pattern.getStep(track, next) || micro < 0) continue;
+            if (skipOnNextStep & ((TrackMask)1 << track)) continue;
+            if ((int32_t)(untilUs - (startUs + microOffsetUs(micro))) >= 0) {
+                fn(track, playback.stepCount + 1);
+            }
+        }
+    }
+
+    // Pattern position at time t in steps from step 0 (may be negative
+    // or past the end just around the wrap; callers take it modulo length)
+    float positionAt(uint32_t tUs) const {
+        int32_t sinceStep = (int32_t)(tUs - playback.stepStartUs);
+        return playback.currentStep + (float)sinceStep / playback.stepIntervalUs;
+    }
+
+    // Running step count of a queued trigger's step: the current step, or
+    // the next one for its early hits
+    uint32_t stepNumber(uint8_t step) const {
+        return step == playback.currentStep ? playback.stepCount : playback.stepCount + 1;
+    }
+
+    // Offset from the step start at which a step's trigger fires
+    int32_t microOffsetUs(int8_t micro) const {
+        return (int32_t)playback.stepIntervalUs * micro / MICRO_PER_STEP;
+    }
+
+    // Start following an external clock from a song position (in 16th notes).
+    // The first tick after start plays the step at that position.
+    void startExternal(uint16_t songPosition) {
+        playback.externalClock = true;
+        playback.isPlaying = true;
+        triggers.clear();
+        uint8_t step = songPosition % playback.patternLength;
+        playback.currentStep = (step + playback.patternLength - 1) % playback.patternLength;
+        playback.stepCount = (uint32_t)songPosition - 1;  // Wraps to songPosition on the first tick
+        playback.clockTicks = CLOCKS_PER_STEP - 1;
+    }
+
+    // Tempo recovered from the external clock (tick period in microseconds)
+    void setExternalTempo(float tickPeriodUs) {
+        playback.stepIntervalUs = (uint32_t)(tickPeriodUs * CLOCKS_PER_STEP + 0.5f);
+        playback.stepIntervalMs = (playback.stepIntervalUs + 500) / 1000;
+        playback.bpm = (uint16_t)(60e6f / (tickPeriodUs * CLOCKS_PER_STEP * 4) + 0.5f);
+    }
+
+    // Back to the internal clock at the nearest valid tempo
+    void useInternalClock() {
+        if (!playback.externalClock) return;
+        playback.externalClock = false;
+        setBPM(playback.bpm);
+    }
+
     void togglePlay() {
+        useInternalClock();
         playback.isPlaying = !playback.isPlaying;
+        triggers.clear();
         if (playback.isPlaying) {
             playback.currentStep = 0;  // Reset to start
-            playback.lastStepTimeMs = millis();
+            playback.stepCount = 0;
+            playback.stepStartUs = micros();
         }
     }
 
     void stop() {
         playback.isPlaying = false;
         playback.currentStep = 0;
+        playback.stepCount = 0;
+        triggers.clear();
     }
 
     void setBPM(uint16_t newBpm) {
@@ -129,7 +342,7 @@ public:
 
     void setPatternLength(uint8_t length) {
         if (length < MIN_STEPS) length = MIN_STEPS;
-        if (length > MAX_STEPS) length = MAX_STEPS;
+        if (length > Config::steps) length = Config::steps;
         playback.patternLength = length;
         // Clamp cursor and playhead
         cursor.clampToLength(length);
@@ -142,18 +355,47 @@ public:
         setPatternLength(playback.patternLength + delta);
     }
 
-    void setTrackSample(uint8_t track, uint8_t sampleIndex) {
-        if (track < NUM_INSTRUMENTS) {
+    // A track's sample slot and the browser entry loaded into it only
+    // change together, so sample cycling continues from what is loaded
+    void setTrackSample(uint8_t track, uint8_t sampleIndex, int32_t fileIndex) {
+        if (track < Config::tracks) {
             trackSamples[track] = sampleIndex;
+            trackFiles[track] = fileIndex;
         }
     }
 
     uint8_t getTrackSample(uint8_t track) const {
-        if (track < NUM_INSTRUMENTS) {
+        if (track < Config::tracks) {
             return trackSamples[track];
         }
         return 0;
     }
+
+    // Browser entries are numbered per folder: once the browser opens
+    // another one, the stored entries no longer name the loaded files
+    void forgetTrackFiles() {
+        for (uint8_t i = 0; i < Config::tracks; i++) trackFiles[i] = -1;
+    }
+
+    int32_t getTrackFile(uint8_t track) const {
+        if (track < Config::tracks) {
+            return trackFiles[track];
+        }
+        return -1;
+    }
+
+    void setTrackPan(uint8_t track, int8_t pan) {
+        if (track < Config::tracks) {
+            trackPans[track] = pan;
+        }
+    }
+
+    int8_t getTrackPan(uint8_t track) const {
+        if (track < Config::tracks) {
+            return trackPans[track];
+        }
+        return 0;
+    }
 };
 
 #endif
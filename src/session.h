@@ -0,0 +1,223 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// Session recording for deterministic replay. Everything that reaches the
+// firmware from outside is logged from boot: keyboard state whenever it
+// changes, and every MIDI byte (clock ticks included), each with the time
+// since the previous record. Replaying the log against the same SD card
+// contents on host (bench/replay.cpp) runs the same code on the same
+// inputs at the same times.
+//
+// File: "SES1", version, tracks, steps, reserved; then records of a
+// LEB128 delta in microseconds, a kind byte and its payload:
+//
+//   Keys  flags (enter, del), count and value_first of each key held,
+//         count and characters of the typed word
+//   Midi  one byte
+//   End   none; marks how long the session ran (scripted sessions; a
+//         recording just stops)
+//
+// A clock tick costs 3 bytes at 120 BPM, a key change 5-8.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <cstdint>
+#include <cstring>
+#include "memory.h"
+#include "trace.h"
+
+#ifndef SESSION_RECORD
+#define SESSION_RECORD 0
+#endif
+
+constexpr uint8_t SESSION_MAGIC[4] = {'S', 'E', 'S', '1'};
+constexpr uint8_t SESSION_VERSION = 1;
+constexpr uint8_t SESSION_HEADER_BYTES = 8;
+constexpr uint8_t SESSION_MAX_KEYS = 8;      // Keys per state record
+constexpr size_t SESSION_BUFFER_BYTES = 65536;
+constexpr size_t SESSION_FLUSH_BYTES = 4096;  // Written to SD in chunks of this
+
+enum class SessionKind : uint8_t { End, Keys, Midi };
+
+enum SessionKeyFlags : uint8_t {
+    SESSION_KEY_ENTER = 1 << 0,
+    SESSION_KEY_DEL = 1 << 1
+};
+
+// Keyboard state as input.h reads it
+struct SessionKeys {
+    uint8_t flags = 0;
+    uint8_t keyCount = 0;
+    char keys[SESSION_MAX_KEYS];   // value_first of each key held
+    uint8_t wordCount = 0;
+    char word[SESSION_MAX_KEYS];   // Typed characters (shift applied)
+};
+
+struct SessionRecord {
+    uint32_t timeUs;  // Since the session started
+    SessionKind kind;
+    SessionKeys keys;
+    uint8_t midi;
+};
+
+// Parses a session held in memory
+class SessionReader {
+public:
+    uint8_t tracks = 0;
+    uint8_t steps = 0;
+
+    bool begin(const uint8_t* bytes, size_t length) {
+        data = bytes;
+        size = length;
+        pos = SESSION_HEADER_BYTES;
+        timeUs = 0;
+        if (length < SESSION_HEADER_BYTES || memcmp(bytes, SESSION_MAGIC, 4) != 0 ||
+            bytes[4] != SESSION_VERSION) {
+            return false;
+        }
+        tracks = bytes[5];
+        steps = bytes[6];
+        return true;
+    }
+
+    // Next record; false at the end or on a truncated one
+    bool next(SessionRecord& rec) {
+        uint32_t delta = 0;
+        for (uint8_t shift = 0; shift < 35; shift += 7) {
+            if (pos >= size) return false;
+            uint8_t b = data[pos++];
+            delta |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        if (pos >= size) return false;
+        timeUs += delta;
+        rec.timeUs = timeUs;
+        rec.kind = (SessionKind)data[pos++];
+        switch (rec.kind) {
+            case SessionKind::Keys:
+                return readKeys(rec.keys);
+            case SessionKind::Midi:
+                if (pos >= size) return false;
+                rec.midi = data[pos++];
+                return true;
+            case SessionKind::End:
+                return true;
+        }
+        return false;
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    uint32_t timeUs = 0;
+
+    bool readChars(uint8_t& count, char* out) {
+        if (pos >= size) return false;
+        count = data[pos++];
+        if (count > SESSION_MAX_KEYS || pos + count > size) return false;
+        memcpy(out, data + pos, count);
+        pos += count;
+        return true;
+    }
+
+    bool readKeys(SessionKeys& keys) {
+        if (pos >= size) return false;
+        keys.flags = data[pos++];
+        return readChars(keys.keyCount, keys.keys) && readChars(keys.wordCount, keys.word);
+    }
+};
+
+// Logs into a PSRAM buffer and appends it to a file on SD in chunks,
+// written between deadlines by the caller
+class SessionRecorder {
+public:
+    bool begin(const char* filePath, uint8_t tracks, uint8_t steps) {
+        strncpy(path, filePath, sizeof(path) - 1);
+        buffer = (uint8_t*)memAlloc(MemTag::Session, SESSION_BUFFER_BYTES);
+        if (!buffer) {
+            LOG_WARN("No memory for session recording\n");
+            return false;
+        }
+        File file = SD.open(path, FILE_WRITE);
+        if (!file) {
+            LOG_WARN("Can't create %s\n", path);
+            memFree(buffer);
+            buffer = nullptr;
+            return false;
+        }
+        const uint8_t header[SESSION_HEADER_BYTES] = {
+            SESSION_MAGIC[0], SESSION_MAGIC[1], SESSION_MAGIC[2], SESSION_MAGIC[3],
+            SESSION_VERSION, tracks, steps, 0
+        };
+        file.write(header, sizeof(header));
+        file.close();
+        used = 0;
+        lastUs = micros();
+        LOG_INFO("Recording session to %s\n", path);
+        return true;
+    }
+
+    bool active() const { return buffer != nullptr; }
+
+    void keys(const SessionKeys& k, uint32_t nowUs) {
+        if (!reserve(4 + k.keyCount + k.wordCount, nowUs)) return;
+        put((uint8_t)SessionKind::Keys);
+        put(k.flags);
+        put(k.keyCount);
+        for (uint8_t i = 0; i < k.keyCount; i++) put((uint8_t)k.keys[i]);
+        put(k.wordCount);
+        for (uint8_t i = 0; i < k.wordCount; i++) put((uint8_t)k.word[i]);
+    }
+
+    void midi(uint8_t byte, uint32_t nowUs) {
+        if (!reserve(2, nowUs)) return;
+        put((uint8_t)SessionKind::Midi);
+        put(byte);
+    }
+
+    // Bytes waiting to be written
+    size_t pending() const { return used; }
+
+    // Appends the buffer to the file. Records never straddle a flush, so
+    // the file can be replayed as it stands after any of them.
+    bool flush() {
+        if (!buffer || used == 0) return true;
+        File file = SD.open(path, FILE_APPEND);
+        if (!file) return false;
+        bool ok = file.write(buffer, used) == used;
+        file.close();
+        used = 0;
+        return ok;
+    }
+
+private:
+    char path[32] = {0};
+    uint8_t* buffer = nullptr;
+    size_t used = 0;
+    uint32_t lastUs = 0;
+    bool full = false;
+
+    void put(uint8_t b) { buffer[used++] = b; }
+
+    // Room for a record of up to bytes after its delta, which is written
+    bool reserve(size_t bytes, uint32_t nowUs) {
+        if (!buffer) return false;
+        if (used + 5 + bytes > SESSION_BUFFER_BYTES) {
+            if (!full) LOG_WARN("Session buffer full, events dropped until it's saved\n");
+            full = true;
+            return false;
+        }
+        full = false;
+        uint32_t delta = nowUs - lastUs;
+        lastUs = nowUs;
+        do {
+            uint8_t b = delta & 0x7F;
+            delta >>= 7;
+            put(delta ? (b | 0x80) : b);
+        } while (delta);
+        return true;
+    }
+};
+
+#endif
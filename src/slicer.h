@@ -0,0 +1,281 @@
+#ifndef SLICER_H
+#define SLICER_H
+
+// Slice mode for loops. When a long sample is loaded its transients are
+// found once by spectral-flux onset detection and stored in a slice
+// table: where each hit starts and which 16th-note step of the loop it
+// falls on. In slice mode a step plays only the slice that starts on it,
+// so the loop follows any tempo by being re-triggered on the grid, with
+// no DSP while playing.
+//
+// Onset detection: Hann-windowed 512-point FFTs every 128 frames, log
+// magnitudes, and the summed positive change between frames (spectral
+// flux). The flux is normalised to its maximum, and a frame is an onset
+// where it's the local maximum and clears the local mean by a margin.
+// Each onset is then placed to the sample on the strongest energy rise
+// near the frame and moved back to a quiet point, so slices start clean.
+
+#include <Arduino.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "memory.h"
+#include "trace.h"
+
+constexpr uint16_t ONSET_FRAME = 512;  // FFT size
+constexpr uint16_t ONSET_HOP = 128;
+constexpr uint16_t ONSET_BINS = ONSET_FRAME / 2 + 1;
+constexpr uint16_t ONSET_BLOCK = 32;   // Energy block for placing an onset
+constexpr float ONSET_COMPRESSION = 10.0f;  // log(1 + c|X|) magnitudes
+
+constexpr uint8_t SLICE_MAX = 32;
+constexpr uint8_t SLICE_MAX_LOOP_STEPS = 64;
+constexpr uint32_t SLICE_MIN_LOOP_MS = 1000;   // Shorter samples are one-shots
+constexpr uint32_t SLICE_MAX_LOOP_MS = 16000;  // Longer ones aren't analysed
+constexpr float SLICE_MIN_BPM = 90.0f;  // Loop length is read as steps at 90-180 BPM
+
+// How a step plays a sample
+enum class SampleMode : uint8_t {
+    OneShot,  // The whole sample at its own rate
+    Slice,    // The slice starting on this step of the loop, if any
+    Stretch   // The whole loop, time-stretched to the current tempo
+};
+
+// In-place radix-2 FFT of n complex values, n a power of two. cosTable
+// and sinTable hold cos/sin(2 pi k / n) for k < n / 2.
+inline void fftRadix2(float* re, float* im, uint16_t n, const float* cosTable, const float* sinTable) {
+    for (uint16_t i = 1, j = 0; i < n; i++) {
+        uint16_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (uint16_t len = 2; len <= n; len <<= 1) {
+        const uint16_t half = len / 2, stride = n / len;
+        for (uint16_t i = 0; i < n; i += len) {
+            for (uint16_t k = 0; k < half; k++) {
+                const float wr = cosTable[k * stride], wi = -sinTable[k * stride];
+                const uint16_t a = i + k, b = a + half;
+                const float tr = re[b] * wr - im[b] * wi;
+                const float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+struct SliceTable {
+    uint32_t frames = 0;     // Length of the analysed sample
+    uint8_t loopSteps = 0;   // Loop length in steps; 0 if not a loop
+    float bpm = 0;           // Tempo the loop was played at
+    uint8_t count = 0;
+    uint32_t start[SLICE_MAX];  // First frame of each slice, ascending
+    uint8_t step[SLICE_MAX];    // Loop step each slice plays on
+
+    bool isLoop() const { return loopSteps > 0; }
+
+    // Slice starting on a step of the running step count; -1 if none
+    int8_t sliceAt(uint32_t stepNumber) const {
+        if (!isLoop()) return -1;
+        const uint8_t s = stepNumber % loopSteps;
+        for (uint8_t i = 0; i < count; i++) {
+            if (step[i] == s) return i;
+        }
+        return -1;
+    }
+
+    uint32_t end(uint8_t i) const { return i + 1 < count ? start[i + 1] : frames; }
+};
+
+struct OnsetParams {
+    float delta = 0.03f;         // Margin over the local mean (flux max = 1)
+    uint16_t peakMs = 30;        // An onset is the flux maximum within +-this
+    uint16_t meanBeforeMs = 100; // Local mean window
+    uint16_t meanAfterMs = 70;
+    uint16_t minGapMs = 30;      // Later onsets closer than this are dropped
+};
+
+class Slicer {
+public:
+    OnsetParams params;
+
+    // Steps a loop of this length spans: the power of two that puts its
+    // tempo in SLICE_MIN_BPM up to twice that
+    static uint8_t loopStepsFor(size_t frames, uint32_t sampleRate) {
+        const float seconds = (float)frames / sampleRate;
+        uint8_t steps = 4;
+        while (steps < SLICE_MAX_LOOP_STEPS && 15.0f * steps / seconds < SLICE_MIN_BPM) steps *= 2;
+        return steps;
+    }
+
+    // Writes up to maxOnsets onset frames, ascending. Returns the count,
+    // 0 when the work buffers can't be allocated.
+    uint16_t detectOnsets(const int16_t* samples, size_t length, uint32_t sampleRate,
+                          uint32_t* onsets, uint16_t maxOnsets) {
+        const uint32_t frameCount = (length + ONSET_HOP - 1) / ONSET_HOP;
+        if (frameCount < 3) return 0;
+
+        // FFT buffers in internal RAM, the flux curve wherever it fits
+        float* work = (float*)memAlloc(MemTag::Analysis,
+                                       (3 * ONSET_FRAME + ONSET_BINS + ONSET_FRAME) * sizeof(float));
+        float* flux = (float*)memAlloc(MemTag::Analysis, frameCount * sizeof(float),
+                                       MemPlace::PreferPsram);
+        if (!work || !flux) {
+            LOG_WARN("No memory for onset detection\n");
+            memFree(work);
+            memFree(flux);
+            return 0;
+        }
+        float* re = work;
+        float* im = re + ONSET_FRAME;
+        float* window = im + ONSET_FRAME;
+        float* prev = window + ONSET_FRAME;
+        float* cosTable = prev + ONSET_BINS;
+        float* sinTable = cosTable + ONSET_FRAME / 2;
+        for (uint16_t i = 0; i < ONSET_FRAME; i++) {
+            window[i] = (0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / ONSET_FRAME)) / 32768.0f;
+        }
+        for (uint16_t k = 0; k < ONSET_FRAME / 2; k++) {
+            cosTable[k] = cosf(2.0f * (float)M_PI * k / ONSET_FRAME);
+            sinTable[k] = sinf(2.0f * (float)M_PI * k / ONSET_FRAME);
+        }
+
+        // Flux of frame t, centred on sample t * ONSET_HOP
+        float fluxMax = 0;
+        for (uint32_t t = 0; t < frameCount; t++) {
+            const int32_t first = (int32_t)(t * ONSET_HOP) - ONSET_FRAME / 2;
+            for (uint16_t i = 0; i < ONSET_FRAME; i++) {
+                const int32_t s = first + i;
+                re[i] = s >= 0 && (size_t)s < length ? samples[s] * window[i] : 0.0f;
+                im[i] = 0;
+            }
+            fftRadix2(re, im, ONSET_FRAME, cosTable, sinTable);
+            // Frame 0 is compared against silence, so a hit on the very
+            // first sample is found too
+            float sum = 0;
+            for (uint16_t k = 0; k < ONSET_BINS; k++) {
+                const float mag = logf(1.0f + ONSET_COMPRESSION * sqrtf(re[k] * re[k] + im[k] * im[k]));
+                const float last = t > 0 ? prev[k] : 0.0f;
+                if (mag > last) sum += mag - last;
+                prev[k] = mag;
+            }
+            flux[t] = sum;
+            if (sum > fluxMax) fluxMax = sum;
+        }
+        memFree(work);
+
+        uint16_t count = fluxMax > 0 ? pickPeaks(flux, frameCount, fluxMax, sampleRate,
+                                                 samples, length, onsets, maxOnsets) : 0;
+        memFree(flux);
+        return count;
+    }
+
+    // Fills table for a freshly loaded sample. Samples outside the loop
+    // length range get an empty table; returns whether it's a loop.
+    bool analyze(const int16_t* samples, size_t length, uint32_t sampleRate, SliceTable& table) {
+        table.frames = length;
+        table.loopSteps = 0;
+        table.bpm = 0;
+        table.count = 0;
+        const uint32_t ms = (uint32_t)((uint64_t)length * 1000 / sampleRate);
+        if (ms < SLICE_MIN_LOOP_MS || ms > SLICE_MAX_LOOP_MS) return false;
+
+        table.loopSteps = loopStepsFor(length, sampleRate);
+        table.bpm = 15.0f * table.loopSteps * sampleRate / length;
+
+        uint32_t onsets[2 * SLICE_MAX];
+        const uint16_t found = detectOnsets(samples, length, sampleRate, onsets, 2 * SLICE_MAX);
+
+        // The loop always starts a slice on step 0; other onsets take
+        // the nearest step that's still free
+        table.start[0] = 0;
+        table.step[0] = 0;
+        table.count = 1;
+        for (uint16_t i = 0; i < found && table.count < SLICE_MAX; i++) {
+            const uint32_t s = (uint32_t)(((uint64_t)onsets[i] * table.loopSteps * 2 + length) / (2 * length));
+            if (s == 0 || s >= table.loopSteps || s <= table.step[table.count - 1]) continue;
+            table.start[table.count] = onsets[i];
+            table.step[table.count] = (uint8_t)s;
+            table.count++;
+        }
+        LOG_INFO("Loop: %u steps at %.1f BPM, %u onsets, %u slices\n", table.loopSteps,
+                 table.bpm, found, table.count);
+        return true;
+    }
+
+private:
+    uint16_t pickPeaks(const float* flux, uint32_t frameCount, float fluxMax, uint32_t sampleRate,
+                       const int16_t* samples, size_t length, uint32_t* onsets, uint16_t maxOnsets) {
+        const float framesPerMs = (float)sampleRate / ONSET_HOP / 1000.0f;
+        const int32_t peak = (int32_t)(params.peakMs * framesPerMs + 0.5f);
+        const int32_t before = (int32_t)(params.meanBeforeMs * framesPerMs + 0.5f);
+        const int32_t after = (int32_t)(params.meanAfterMs * framesPerMs + 0.5f);
+        const uint32_t minGap = (uint32_t)((uint64_t)params.minGapMs * sampleRate / 1000);
+        const float threshold = params.delta * fluxMax;
+
+        uint16_t count = 0;
+        for (int32_t t = 0; t < (int32_t)frameCount && count < maxOnsets; t++) {
+            const float f = flux[t];
+            if (f < threshold) continue;
+
+            bool isMax = true;
+            for (int32_t j = t - peak; j <= t + peak && isMax; j++) {
+                if (j >= 0 && j < (int32_t)frameCount && j != t) {
+                    isMax = j < t ? flux[j] < f : flux[j] <= f;
+                }
+            }
+            if (!isMax) continue;
+
+            float sum = 0;
+            int32_t n = 0;
+            for (int32_t j = t - before; j <= t + after; j++) {
+                if (j >= 0 && j < (int32_t)frameCount) {
+                    sum += flux[j];
+                    n++;
+                }
+            }
+            if (f < sum / n + threshold) continue;
+
+            const uint32_t at = placeOnset(samples, length, (uint32_t)t * ONSET_HOP);
+            if (count > 0 && at < onsets[count - 1] + minGap) continue;
+            onsets[count++] = at;
+        }
+        return count;
+    }
+
+    // The sample where the energy rises most within a frame of the
+    // detection centre, moved back to the quietest sample just before it
+    static uint32_t placeOnset(const int16_t* samples, size_t length, uint32_t centre) {
+        const int32_t from = (int32_t)centre - ONSET_FRAME / 2;
+        int64_t lastEnergy = 0, bestRise = -1;
+        uint32_t best = centre < length ? centre : length - 1;
+        for (int32_t b = from - ONSET_BLOCK; b < (int32_t)centre + ONSET_FRAME / 2; b += ONSET_BLOCK) {
+            // Blocks before the start count as silence
+            int64_t energy = 0;
+            if (b + ONSET_BLOCK > (int32_t)length) break;
+            for (int32_t i = b < 0 ? -b : 0; i < ONSET_BLOCK; i++) {
+                energy += (int32_t)samples[b + i] * samples[b + i];
+            }
+            if (b >= from && energy - lastEnergy > bestRise) {
+                bestRise = energy - lastEnergy;
+                best = b < 0 ? 0 : b;
+            }
+            lastEnergy = energy;
+        }
+
+        uint32_t quiet = best;
+        const uint32_t stop = best > ONSET_BLOCK ? best - ONSET_BLOCK : 0;
+        for (uint32_t i = best; i > stop; i--) {
+            if (abs(samples[i - 1]) < abs(samples[quiet])) quiet = i - 1;
+        }
+        return quiet < length ? quiet : length - 1;
+    }
+};
+
+#endif
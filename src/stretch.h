@@ -0,0 +1,150 @@
+#ifndef STRETCH_H
+#define STRETCH_H
+
+// WSOLA time-stretch, for loops slicing can't handle (pads, vocals,
+// anything without clear hits). The whole loop is rendered at the new
+// length ahead of time, a chunk per loop pass between deadlines, and the
+// render is then played like any other sample.
+//
+// 20 ms Hann frames are overlap-added every 10 ms of output. Each frame
+// is read from around where the tempo ratio puts it, shifted by up to
+// 5 ms to the position that best continues the previous frame
+// (cross-correlation on every 4th sample, coarse then fine), so pitch is
+// kept and there are no phase cancellations at the joins.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint16_t WSOLA_FRAME_DIVIDER = 50;  // Frame length: 1/50 s
+constexpr uint16_t WSOLA_MAX_FRAME = 1024;    // Up to 48 kHz
+constexpr uint8_t WSOLA_CORR_STRIDE = 4;      // Correlate every 4th sample
+
+class WsolaStretcher {
+public:
+    // Search range is +-frame / toleranceDivider; 0 is plain overlap-add
+    uint8_t toleranceDivider = 4;
+
+    // Output length for a tempo change from fromBpm to toBpm
+    static size_t stretchedLength(size_t frames, float fromBpm, float toBpm) {
+        return (size_t)((double)frames * fromBpm / toBpm + 0.5);
+    }
+
+    void begin(const int16_t* input, size_t inputLength, int16_t* output, size_t outputLength,
+               uint32_t sampleRate) {
+        in = input;
+        inLength = inputLength;
+        out = output;
+        outLength = outputLength;
+        outPos = 0;
+        frameIndex = 0;
+
+        frame = (uint16_t)(sampleRate / WSOLA_FRAME_DIVIDER) & ~1u;
+        if (frame > WSOLA_MAX_FRAME) frame = WSOLA_MAX_FRAME;
+        if (frame < 16) frame = 16;
+        hop = frame / 2;
+        tolerance = toleranceDivider ? frame / toleranceDivider : 0;
+        analysisHop = outLength ? (double)hop * inLength / outLength : 0;
+
+        // Q15 periodic Hann; the two halves are built to sum to exactly 1
+        for (uint16_t n = 0; n < hop; n++) {
+            window[n] = (uint16_t)(32768.0f * (0.5f - 0.5f * cosf(2.0f * (float)M_PI * n / frame)) + 0.5f);
+            window[n + hop] = 32768 - window[n];
+        }
+
+        // The first half-frame plays unfaded, as if a previous frame
+        // had covered it
+        for (uint16_t n = 0; n < hop; n++) {
+            overlap[n] = (int32_t)(32768 - window[n]) * at(n);
+        }
+        prevPos = -(int32_t)hop;
+    }
+
+    bool done() const { return outPos >= outLength; }
+
+    // Renders at least maxFrames more output frames (whole hops) unless
+    // finished. Returns true once the output is complete.
+    bool process(size_t maxFrames) {
+        size_t rendered = 0;
+        while (!done() && rendered < maxFrames) {
+            const int32_t ideal = (int32_t)(frameIndex * analysisHop + 0.5);
+            const int32_t pos = frameIndex > 0 && tolerance > 0 ? bestMatch(prevPos + hop, ideal) : ideal;
+
+            const size_t count = outLength - outPos < hop ? outLength - outPos : hop;
+            for (uint16_t n = 0; n < count; n++) {
+                int32_t v = (overlap[n] + (int32_t)window[n] * at(pos + n)) >> 15;
+                out[outPos + n] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+                overlap[n] = (int32_t)window[n + hop] * at(pos + hop + n);
+            }
+            outPos += count;
+            rendered += count;
+            prevPos = pos;
+            frameIndex++;
+        }
+        return done();
+    }
+
+private:
+    const int16_t* in = nullptr;
+    size_t inLength = 0;
+    int16_t* out = nullptr;
+    size_t outLength = 0;
+    size_t outPos = 0;
+    uint32_t frameIndex = 0;
+    uint16_t frame = 0;
+    uint16_t hop = 0;
+    uint16_t tolerance = 0;
+    double analysisHop = 0;
+    int32_t prevPos = 0;
+    uint16_t window[WSOLA_MAX_FRAME];
+    int32_t overlap[WSOLA_MAX_FRAME / 2];
+
+    int32_t at(int32_t i) const {
+        return i >= 0 && (size_t)i < inLength ? in[i] : 0;
+    }
+
+    // Similarity of the frame at candidate to the natural continuation
+    int64_t correlation(int32_t natural, int32_t candidate) const {
+        int32_t n = frame;
+        if ((int32_t)inLength - natural < n) n = (int32_t)inLength - natural;
+        if ((int32_t)inLength - candidate < n) n = (int32_t)inLength - candidate;
+        const int16_t* a = in + natural;
+        const int16_t* b = in + candidate;
+        int64_t sum = 0;
+        for (int32_t i = 0; i < n; i += WSOLA_CORR_STRIDE) {
+            sum += (int32_t)(a[i] >> 4) * (b[i] >> 4);
+        }
+        return sum;
+    }
+
+    // Read position within +-tolerance of ideal that best continues the
+    // previous frame
+    int32_t bestMatch(int32_t natural, int32_t ideal) const {
+        if (natural < 0 || natural + hop >= (int32_t)inLength) return ideal;
+        int32_t lo = ideal - tolerance, hi = ideal + tolerance;
+        if (lo < 0) lo = 0;
+        if (hi > (int32_t)inLength - hop) hi = (int32_t)inLength - hop;
+        if (hi < lo) return ideal;
+
+        int32_t best = lo;
+        int64_t bestScore = correlation(natural, lo);
+        for (int32_t c = lo + 2; c <= hi; c += 2) {
+            const int64_t score = correlation(natural, c);
+            if (score > bestScore) {
+                bestScore = score;
+                best = c;
+            }
+        }
+        for (int32_t c = best - 1; c <= best + 1; c += 2) {
+            if (c < lo || c > hi) continue;
+            const int64_t score = correlation(natural, c);
+            if (score > bestScore) {
+                bestScore = score;
+                best = c;
+            }
+        }
+        return best;
+    }
+};
+
+#endif
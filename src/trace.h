@@ -0,0 +1,177 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstdint>
+
+// Compile-time log levels. Anything above LOG_LEVEL compiles to nothing,
+// arguments included, so hot-path logging costs nothing in release builds.
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#if defined(MIDI_OUT_ENABLED) && MIDI_OUT_ENABLED
+#define LOG_LEVEL LOG_LEVEL_NONE  // Serial carries MIDI
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#define LOG_AT(level, ...) \
+    do { if (LOG_LEVEL >= (level)) Serial.printf(__VA_ARGS__); } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// Binary event tracing. Off by default; build with -DTRACE_ENABLED=1 and
+// decode the serial capture with tools/trace_decode.py.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0
+#endif
+
+// The drain writes to Serial, which carries MIDI out
+#if TRACE_ENABLED && defined(MIDI_OUT_ENABLED) && MIDI_OUT_ENABLED
+#error "TRACE_ENABLED and MIDI_OUT_ENABLED both use Serial; build with one of them"
+#endif
+
+// Event IDs. Keep in sync with EVENT_NAMES in tools/trace_decode.py
+enum class TraceEvent : uint16_t {
+    Dropped = 0,        // arg: records lost since last report
+    Input = 1,          // arg: InputEvent
+    Step = 2,           // arg: step index
+    SampleTrigger = 3,  // arg: sample index << 8 | channel
+    LoadBegin = 4,      // arg: sample slot
+    LoadEnd = 5,        // arg: sample slot
+    DrawBegin = 6,
+    DrawEnd = 7,
+    MidiClock = 8,
+    MidiStart = 9,      // arg: song position
+    MidiStop = 10,
+    SleepBegin = 11,    // arg: PowerState
+    SleepEnd = 12       // arg: lateness past a hard deadline in us
+};
+
+struct TraceRecord {
+    uint32_t timestampUs;
+    uint16_t event;
+    uint16_t arg;
+};
+
+// Bounded multi-producer, single-consumer ring. Each slot carries a
+// sequence number so producers never block and never take a lock; when
+// the ring is full the record is counted as dropped instead.
+class TraceBuffer {
+public:
+    static constexpr uint32_t CAPACITY = 1024;  // Power of two
+    static constexpr uint8_t SYNC0 = 0xA5;
+    static constexpr uint8_t SYNC1 = 0x5A;
+
+    TraceBuffer() {
+        for (uint32_t i = 0; i < CAPACITY; i++) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    void push(TraceEvent event, uint16_t arg, uint32_t timestampUs) {
+        uint32_t pos = writePos.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.record = {timestampUs, (uint16_t)event, arg};
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = writePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side: only the drain task calls this
+    bool pop(TraceRecord& out) {
+        Slot& slot = slots[readPos & (CAPACITY - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != readPos + 1) {
+            return false;
+        }
+        out = slot.record;
+        slot.seq.store(readPos + CAPACITY, std::memory_order_release);
+        readPos++;
+        return true;
+    }
+
+    uint32_t takeDropped() {
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Frame: 0xA5 0x5A, then the record little-endian (8 bytes)
+    static void writeFrame(Print& port, const TraceRecord& rec) {
+        uint8_t frame[10] = {
+            SYNC0, SYNC1,
+            (uint8_t)rec.timestampUs, (uint8_t)(rec.timestampUs >> 8),
+            (uint8_t)(rec.timestampUs >> 16), (uint8_t)(rec.timestampUs >> 24),
+            (uint8_t)rec.event, (uint8_t)(rec.event >> 8),
+            (uint8_t)rec.arg, (uint8_t)(rec.arg >> 8)
+        };
+        port.write(frame, sizeof(frame));
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        TraceRecord record;
+    };
+
+    Slot slots[CAPACITY];
+    std::atomic<uint32_t> writePos{0};
+    uint32_t readPos = 0;
+    std::atomic<uint32_t> dropped{0};
+};
+
+#if TRACE_ENABLED
+
+inline TraceBuffer& traceBuffer() {
+    static TraceBuffer buffer;
+    return buffer;
+}
+
+#define TRACE(event, arg) traceBuffer().push((event), (uint16_t)(arg), micros())
+
+// Drains the ring to serial from a low-priority task on the core that
+// doesn't run loop(), so tracing never waits on the UART/USB.
+inline void traceStartDrainTask() {
+    xTaskCreatePinnedToCore([](void*) {
+        TraceRecord rec;
+        while (true) {
+            uint32_t lost = traceBuffer().takeDropped();
+            if (lost > 0) {
+                TraceBuffer::writeFrame(Serial, {micros(), (uint16_t)TraceEvent::Dropped,
+                                                 (uint16_t)(lost > 0xFFFF ? 0xFFFF : lost)});
+            }
+            while (traceBuffer().pop(rec)) {
+                TraceBuffer::writeFrame(Serial, rec);
+            }
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }, "trace", 3072, nullptr, tskIDLE_PRIORITY + 1, nullptr, 0);
+}
+
+#else
+
+#define TRACE(event, arg) do { } while (0)
+
+inline void traceStartDrainTask() {}
+
+#endif
+
+#endif
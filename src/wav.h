@@ -0,0 +1,386 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <cstdint>
+#include <cstring>
+
+// WAV format tags
+constexpr uint16_t WAV_FORMAT_PCM = 0x0001;
+constexpr uint16_t WAV_FORMAT_FLOAT = 0x0003;
+constexpr uint16_t WAV_FORMAT_IMA_ADPCM = 0x0011;
+constexpr uint16_t WAV_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// Streaming buffer. Also bounds the ADPCM block size (2048 is the largest
+// common encoder setting, used for 44.1 kHz stereo).
+constexpr size_t WAV_CHUNK_BYTES = 2048;
+
+// Longest file accepted, in frames: far more than fits in PSRAM, and small
+// enough that a sample's buffer size in bytes fits a 32-bit size_t
+constexpr uint32_t WAV_MAX_FRAMES = 1u << 24;
+
+// Canonical 44-byte header layout (RIFF + fmt chunk), for writers
+struct WavHeader {
+    char riff[4];
+    uint32_t fileSize;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmtSize;
+    uint16_t audioFormat;
+    uint16_t numChannels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t bitsPerSample;
+};
+
+struct WavInfo {
+    uint16_t format = 0;          // WAV_FORMAT_*, EXTENSIBLE resolved
+    uint16_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint16_t bitsPerSample = 0;
+    uint16_t blockAlign = 0;
+    uint16_t samplesPerBlock = 0; // ADPCM only
+    uint32_t dataOffset = 0;
+    uint32_t dataSize = 0;
+    size_t frames = 0;            // Output length in mono samples
+};
+
+// Runs fn over [0, frames) in fixed groups of 8 plus a scalar tail. The
+// constant inner trip count lets GCC vectorize the converters at -O2 on
+// host and unroll them into straight-line loads/stores on Xtensa.
+template <typename Fn>
+inline void wavForEach8(size_t frames, Fn fn) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        for (size_t j = 0; j < 8; j++) fn(i + j);
+    }
+    for (; i < frames; i++) fn(i);
+}
+
+inline int16_t wavClampFloat(float v) {
+    v = v < -32768.0f ? -32768.0f : v;
+    v = v > 32767.0f ? 32767.0f : v;
+    return (int16_t)v;
+}
+
+// Sample converters: interleaved input -> mono int16, stereo averaged.
+// For stereo input, side (if given) gets half the difference, so left
+// and right are mid + side and mid - side.
+
+inline void wavConvertU8(const uint8_t* __restrict in, int16_t* __restrict out,
+                         size_t frames, uint16_t channels, int16_t* __restrict side = nullptr) {
+    if (channels == 1) {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = (int16_t)((in[i] - 128) << 8);
+        });
+    } else {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = (int16_t)((in[2 * i] + in[2 * i + 1] - 256) << 7);
+        });
+        if (side) wavForEach8(frames, [&](size_t i) {
+            side[i] = (int16_t)((in[2 * i] - in[2 * i + 1]) << 7);
+        });
+    }
+}
+
+inline void wavConvertS16(const uint8_t* __restrict in, int16_t* __restrict out,
+                          size_t frames, uint16_t channels, int16_t* __restrict side = nullptr) {
+    if (channels == 1) {
+        memcpy(out, in, frames * 2);
+    } else {
+        const int16_t* __restrict s = (const int16_t*)in;
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = (int16_t)((s[2 * i] + s[2 * i + 1]) >> 1);
+        });
+        if (side) wavForEach8(frames, [&](size_t i) {
+            side[i] = (int16_t)((s[2 * i] - s[2 * i + 1]) >> 1);
+        });
+    }
+}
+
+inline void wavConvertS24(const uint8_t* __restrict in, int16_t* __restrict out,
+                          size_t frames, uint16_t channels, int16_t* __restrict side = nullptr) {
+    // Keep the top 16 bits of each 24-bit little-endian sample
+    if (channels == 1) {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = (int16_t)(in[3 * i + 1] | (in[3 * i + 2] << 8));
+        });
+    } else {
+        wavForEach8(frames, [&](size_t i) {
+            int16_t l = (int16_t)(in[6 * i + 1] | (in[6 * i + 2] << 8));
+            int16_t r = (int16_t)(in[6 * i + 4] | (in[6 * i + 5] << 8));
+            out[i] = (int16_t)((l + r) >> 1);
+        });
+        if (side) wavForEach8(frames, [&](size_t i) {
+            int16_t l = (int16_t)(in[6 * i + 1] | (in[6 * i + 2] << 8));
+            int16_t r = (int16_t)(in[6 * i + 4] | (in[6 * i + 5] << 8));
+            side[i] = (int16_t)((l - r) >> 1);
+        });
+    }
+}
+
+inline void wavConvertS32(const uint8_t* __restrict in, int16_t* __restrict out,
+                          size_t frames, uint16_t channels, int16_t* __restrict side = nullptr) {
+    const int32_t* __restrict s = (const int32_t*)in;
+    if (channels == 1) {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = (int16_t)(s[i] >> 16);
+        });
+    } else {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = (int16_t)(((s[2 * i] >> 16) + (s[2 * i + 1] >> 16)) >> 1);
+        });
+        if (side) wavForEach8(frames, [&](size_t i) {
+            side[i] = (int16_t)(((s[2 * i] >> 16) - (s[2 * i + 1] >> 16)) >> 1);
+        });
+    }
+}
+
+inline void wavConvertF32(const uint8_t* __restrict in, int16_t* __restrict out,
+                          size_t frames, uint16_t channels, int16_t* __restrict side = nullptr) {
+    const float* __restrict f = (const float*)in;
+    if (channels == 1) {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = wavClampFloat(f[i] * 32767.0f);
+        });
+    } else {
+        wavForEach8(frames, [&](size_t i) {
+            out[i] = wavClampFloat((f[2 * i] + f[2 * i + 1]) * (32767.0f * 0.5f));
+        });
+        if (side) wavForEach8(frames, [&](size_t i) {
+            side[i] = wavClampFloat((f[2 * i] - f[2 * i + 1]) * (32767.0f * 0.5f));
+        });
+    }
+}
+
+// IMA ADPCM (Microsoft/DVI block layout)
+constexpr int16_t IMA_STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+constexpr int8_t IMA_INDEX_TABLE[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+struct ImaState {
+    int32_t predictor;
+    int32_t index;
+
+    int16_t decode(uint8_t nibble) {
+        int32_t step = IMA_STEP_TABLE[index];
+        int32_t diff = step >> 3;
+        if (nibble & 1) diff += step >> 2;
+        if (nibble & 2) diff += step >> 1;
+        if (nibble & 4) diff += step;
+        predictor += (nibble & 8) ? -diff : diff;
+        if (predictor > 32767) predictor = 32767;
+        if (predictor < -32768) predictor = -32768;
+        index += IMA_INDEX_TABLE[nibble];
+        if (index < 0) index = 0;
+        if (index > 88) index = 88;
+        return (int16_t)predictor;
+    }
+};
+
+// Decodes one block to mono (and side, for stereo, if given), stopping
+// after maxFrames (normally the block's samplesPerBlock). Returns frames
+// written.
+inline size_t wavDecodeImaBlock(const uint8_t* block, size_t blockBytes, int16_t* out,
+                                uint16_t channels, size_t maxFrames, int16_t* side = nullptr) {
+    if (blockBytes < 4u * channels || maxFrames == 0) return 0;
+
+    ImaState state[2] = {{0, 0}, {0, 0}};
+    for (uint16_t c = 0; c < channels; c++) {
+        state[c].predictor = (int16_t)(block[4 * c] | (block[4 * c + 1] << 8));
+        state[c].index = block[4 * c + 2] > 88 ? 88 : block[4 * c + 2];
+    }
+    const uint8_t* data = block + 4 * channels;
+    size_t dataBytes = blockBytes - 4 * channels;
+
+    if (channels == 1) {
+        out[0] = (int16_t)state[0].predictor;
+        size_t n = 1;
+        for (size_t i = 0; i < dataBytes && n < maxFrames; i++) {
+            out[n++] = state[0].decode(data[i] & 0x0F);
+            if (n < maxFrames) out[n++] = state[0].decode(data[i] >> 4);
+        }
+        return n;
+    }
+
+    // Stereo: channels alternate in 4-byte groups of 8 samples each
+    out[0] = (int16_t)((state[0].predictor + state[1].predictor) >> 1);
+    if (side) side[0] = (int16_t)((state[0].predictor - state[1].predictor) >> 1);
+    int16_t left[8];
+    size_t n = 1;
+    for (size_t g = 0; g + 8 <= dataBytes && n < maxFrames; g += 8) {
+        for (int i = 0; i < 4; i++) {
+            left[2 * i] = state[0].decode(data[g + i] & 0x0F);
+            left[2 * i + 1] = state[0].decode(data[g + i] >> 4);
+        }
+        for (int i = 0; i < 4 && n < maxFrames; i++) {
+            int16_t r[2] = {state[1].decode(data[g + 4 + i] & 0x0F),
+                            state[1].decode(data[g + 4 + i] >> 4)};
+            for (int j = 0; j < 2 && n < maxFrames; j++, n++) {
+                out[n] = (int16_t)((left[2 * i + j] + r[j]) >> 1);
+                if (side) side[n] = (int16_t)((left[2 * i + j] - r[j]) >> 1);
+            }
+        }
+    }
+    return n;
+}
+
+// Streams a WAV from any Source with read(uint8_t*, size_t), seek(uint32_t),
+// position() and size() (fs::File on target, the SD stub on host) into a mono
+// int16 buffer, plus a side buffer for stereo files when asked. Only a
+// fixed WAV_CHUNK_BYTES buffer is used along the way.
+class WavDecoder {
+public:
+    template <typename Source>
+    bool readInfo(Source& src, WavInfo& info) {
+        uint8_t riff[12];
+        if (src.read(riff, 12) != 12 ||
+            memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+            return false;
+        }
+
+        // Sizes come from the file: none may run past its end
+        const uint32_t fileSize = src.size();
+        bool haveFmt = false;
+        uint8_t chunk[8];
+        while (src.read(chunk, 8) == 8) {
+            uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t)chunk[7] << 24);
+            const uint32_t left = fileSize - src.position();
+
+            if (memcmp(chunk, "data", 4) == 0) {
+                // Writers that stopped early leave a larger size behind
+                if (!haveFmt) return false;
+                info.dataOffset = src.position();
+                info.dataSize = size < left ? size : left;
+                return computeFrames(info);
+            }
+            if (size > left) return false;
+            uint32_t next = src.position() + size + (size & 1);  // Chunks are word aligned
+
+            if (memcmp(chunk, "fmt ", 4) == 0) {
+                uint8_t fmt[40] = {0};
+                size_t n = size < sizeof(fmt) ? size : sizeof(fmt);
+                if (n < 16 || src.read(fmt, n) != n) return false;
+                info.format = fmt[0] | (fmt[1] << 8);
+                info.channels = fmt[2] | (fmt[3] << 8);
+                info.sampleRate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t)fmt[7] << 24);
+                info.blockAlign = fmt[12] | (fmt[13] << 8);
+                info.bitsPerSample = fmt[14] | (fmt[15] << 8);
+                if (n >= 20) info.samplesPerBlock = fmt[18] | (fmt[19] << 8);
+                if (info.format == WAV_FORMAT_EXTENSIBLE && n >= 26) {
+                    info.format = fmt[24] | (fmt[25] << 8);  // SubFormat GUID starts with the tag
+                }
+                haveFmt = true;
+            }
+            if (next > fileSize) break;  // Odd-sized last chunk without its pad byte
+            src.seek(next);
+        }
+        return false;
+    }
+
+    // Decodes up to maxFrames mono samples from the data chunk into out,
+    // and for a stereo file the side channel into side if it's given.
+    // Returns the number of frames written.
+    template <typename Source>
+    size_t decode(Source& src, const WavInfo& info, int16_t* out, size_t maxFrames,
+                  int16_t* side = nullptr) {
+        if (info.channels != 2) side = nullptr;
+        src.seek(info.dataOffset);
+        size_t written = 0;
+        uint32_t remaining = info.dataSize;
+
+        if (info.format == WAV_FORMAT_IMA_ADPCM) {
+            while (remaining > 0 && written < maxFrames) {
+                size_t want = remaining < info.blockAlign ? remaining : info.blockAlign;
+                size_t got = src.read(buffer, want);
+                if (got == 0) break;
+                remaining -= got;
+                size_t room = maxFrames - written;
+                written += wavDecodeImaBlock(buffer, got, out + written, info.channels,
+                                             room < info.samplesPerBlock ? room : info.samplesPerBlock,
+                                             side ? side + written : nullptr);
+            }
+            return written;
+        }
+
+        size_t frameBytes = (info.bitsPerSample / 8) * info.channels;
+
+        // Mono 16-bit needs no conversion: read straight into the destination
+        if (info.format == WAV_FORMAT_PCM && info.bitsPerSample == 16 && info.channels == 1) {
+            size_t bytes = remaining < maxFrames * 2 ? remaining : maxFrames * 2;
+            return src.read((uint8_t*)out, bytes) / 2;
+        }
+
+        size_t chunkFrames = WAV_CHUNK_BYTES / frameBytes;
+        while (remaining >= frameBytes && written < maxFrames) {
+            size_t frames = remaining / frameBytes;
+            if (frames > chunkFrames) frames = chunkFrames;
+            if (frames > maxFrames - written) frames = maxFrames - written;
+            size_t got = src.read(buffer, frames * frameBytes) / frameBytes;
+            if (got == 0) break;
+            convert(info, buffer, out + written, got, side ? side + written : nullptr);
+            written += got;
+            remaining -= got * frameBytes;
+        }
+        return written;
+    }
+
+private:
+    alignas(4) uint8_t buffer[WAV_CHUNK_BYTES];
+
+    static bool computeFrames(WavInfo& info) {
+        if (info.channels < 1 || info.channels > 2) return false;
+
+        if (info.format == WAV_FORMAT_IMA_ADPCM) {
+            if (info.bitsPerSample != 4 || info.blockAlign < 4 * info.channels ||
+                info.blockAlign > WAV_CHUNK_BYTES) {
+                return false;
+            }
+            if (info.samplesPerBlock == 0) {
+                info.samplesPerBlock = (info.blockAlign - 4 * info.channels) * 2 / info.channels + 1;
+            }
+            uint32_t blocks = info.dataSize / info.blockAlign;
+            uint32_t tail = info.dataSize % info.blockAlign;
+            info.frames = (size_t)blocks * info.samplesPerBlock;
+            if (tail > 4u * info.channels) {
+                info.frames += (tail - 4 * info.channels) * 2 / info.channels + 1;
+            }
+            return info.frames <= WAV_MAX_FRAMES;
+        }
+
+        bool pcm = info.format == WAV_FORMAT_PCM &&
+                   (info.bitsPerSample == 8 || info.bitsPerSample == 16 ||
+                    info.bitsPerSample == 24 || info.bitsPerSample == 32);
+        bool flt = info.format == WAV_FORMAT_FLOAT && info.bitsPerSample == 32;
+        if (!pcm && !flt) return false;
+
+        info.frames = info.dataSize / ((info.bitsPerSample / 8) * info.channels);
+        return info.frames <= WAV_MAX_FRAMES;
+    }
+
+    static void convert(const WavInfo& info, const uint8_t* in, int16_t* out, size_t frames,
+                        int16_t* side) {
+        if (info.format == WAV_FORMAT_FLOAT) {
+            wavConvertF32(in, out, frames, info.channels, side);
+            return;
+        }
+        switch (info.bitsPerSample) {
+            case 8:  wavConvertU8(in, out, frames, info.channels, side); break;
+            case 16: wavConvertS16(in, out, frames, info.channels, side); break;
+            case 24: wavConvertS24(in, out, frames, info.channels, side); break;
+            case 32: wavConvertS32(in, out, frames, info.channels, side); break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+// Min/max/RMS overview of a sample for on-screen thumbnails. Built once
+// when the sample is loaded, so drawing reads a few hundred bytes instead
+// of the sample itself. Level 0 has WAVE_BINS bins over the whole sample,
+// each further level halves the count; a thumbnail draws from the
+// smallest level that still has a bin per pixel.
+//
+// Pyramids are persisted under WAVE_CACHE_DIR so the browser can show
+// files that aren't loaded. Cache files are named by a hash of the sample
+// path and keyed on its size.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <cmath>
+#include <cstdint>
+
+constexpr uint16_t WAVE_BINS = 128;
+constexpr uint8_t WAVE_LEVELS = 5;  // 128, 64, 32, 16, 8 bins
+constexpr uint16_t WAVE_TOTAL_BINS = 2 * WAVE_BINS - (2 * WAVE_BINS >> WAVE_LEVELS);
+constexpr uint32_t WAVE_CACHE_MAGIC = 0x314D4657;  // "WFM1"
+#define WAVE_CACHE_DIR "/.thumbs"
+
+struct WaveCacheHeader {
+    uint32_t magic;
+    uint32_t sourceSize;  // Size of the WAV file the pyramid was built from
+    uint32_t frames;
+    uint16_t bins;
+    uint16_t levels;
+};
+
+// Min, max and sum of squares of one bin. Written as a plain reduction,
+// which GCC vectorizes directly (min/max/sum lanes combined after the
+// loop). Values are reduced to 8 bits first, which is all a thumbnail can
+// show, and keeps the squares summing in 32 bits for bins of up to 2^18
+// samples.
+inline void waveReduce(const int16_t* __restrict in, size_t n,
+                       int8_t& outMin, int8_t& outMax, uint32_t& outSumSq) {
+    int32_t lo = 127, hi = -128;
+    uint32_t sq = 0;
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = in[i] >> 8;
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+        sq += (uint32_t)(v * v);
+    }
+    outMin = (int8_t)lo;
+    outMax = (int8_t)hi;
+    outSumSq = sq;
+}
+
+struct WaveformPyramid {
+    uint32_t frames = 0;  // 0 until built or loaded
+    int8_t minv[WAVE_TOTAL_BINS];
+    int8_t maxv[WAVE_TOTAL_BINS];
+    uint8_t rms[WAVE_TOTAL_BINS];  // 0-128
+
+    static constexpr uint16_t levelOffset(uint8_t level) {
+        return 2 * WAVE_BINS - (2 * WAVE_BINS >> level);
+    }
+
+    static constexpr uint16_t levelBins(uint8_t level) { return WAVE_BINS >> level; }
+
+    bool valid() const { return frames > 0; }
+
+    void build(const int16_t* samples, size_t length) {
+        frames = length;
+        if (length == 0) return;
+
+        for (uint16_t b = 0; b < WAVE_BINS; b++) {
+            size_t start = length * b / WAVE_BINS;
+            size_t end = length * (b + 1) / WAVE_BINS;
+            if (end == start) {
+                // Fewer samples than bins: repeat the previous one
+                minv[b] = b ? minv[b - 1] : 0;
+                maxv[b] = b ? maxv[b - 1] : 0;
+                rms[b] = b ? rms[b - 1] : 0;
+                continue;
+            }
+            uint32_t sumSq;
+            waveReduce(samples + start, end - start, minv[b], maxv[b], sumSq);
+            rms[b] = (uint8_t)sqrtf((float)sumSq / (end - start));
+        }
+
+        // Each level merges pairs of bins from the one below
+        for (uint8_t level = 1; level < WAVE_LEVELS; level++) {
+            const uint16_t src = levelOffset(level - 1);
+            const uint16_t dst = levelOffset(level);
+            for (uint16_t b = 0; b < levelBins(level); b++) {
+                uint16_t l = src + 2 * b, r = l + 1;
+                minv[dst + b] = minv[l] < minv[r] ? minv[l] : minv[r];
+                maxv[dst + b] = maxv[l] > maxv[r] ? maxv[l] : maxv[r];
+                rms[dst + b] = (uint8_t)sqrtf((rms[l] * rms[l] + rms[r] * rms[r]) * 0.5f);
+            }
+        }
+    }
+
+    // Smallest level with at least one bin per pixel (level 0 if wider)
+    static uint8_t levelForWidth(uint16_t width) {
+        for (uint8_t level = WAVE_LEVELS - 1; level > 0; level--) {
+            if (levelBins(level) >= width) return level;
+        }
+        return 0;
+    }
+
+    static void cachePath(char* out, size_t size, const char* source) {
+        uint32_t hash = 2166136261u;  // FNV-1a
+        for (const char* p = source; *p; p++) hash = (hash ^ (uint8_t)*p) * 16777619u;
+        snprintf(out, size, WAVE_CACHE_DIR "/%08x.wfm", (unsigned)hash);
+    }
+
+    bool save(const char* source, uint32_t sourceSize) const {
+        if (!valid()) return false;
+        char path[32];
+        cachePath(path, sizeof(path), source);
+        if (!SD.exists(WAVE_CACHE_DIR)) SD.mkdir(WAVE_CACHE_DIR);
+
+        File file = SD.open(path, FILE_WRITE);
+        if (!file) return false;
+        WaveCacheHeader header = {WAVE_CACHE_MAGIC, sourceSize, frames, WAVE_BINS, WAVE_LEVELS};
+        bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                  file.write((const uint8_t*)minv, sizeof(minv)) == sizeof(minv) &&
+                  file.write((const uint8_t*)maxv, sizeof(maxv)) == sizeof(maxv) &&
+                  file.write(rms, sizeof(rms)) == sizeof(rms);
+        file.close();
+        return ok;
+    }
+
+    // Loads the cached pyramid for source; false if missing or stale
+    bool load(const char* source, uint32_t sourceSize) {
+        char path[32];
+        cachePath(path, sizeof(path), source);
+        File file = SD.open(path, FILE_READ);
+        if (!file) return false;
+
+        WaveCacheHeader header;
+        bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                  header.magic == WAVE_CACHE_MAGIC && header.sourceSize == sourceSize &&
+                  header.bins == WAVE_BINS && header.levels == WAVE_LEVELS &&
+                  file.read((uint8_t*)minv, sizeof(minv)) == sizeof(minv) &&
+                  file.read((uint8_t*)maxv, sizeof(maxv)) == sizeof(maxv) &&
+                  file.read(rms, sizeof(rms)) == sizeof(rms);
+        file.close();
+        frames = ok ? header.frames : 0;
+        return ok;
+    }
+
+    // True if the cache already holds this pyramid for a file of sourceSize
+    bool isCached(const char* source, uint32_t sourceSize) const {
+        char path[32];
+        cachePath(path, sizeof(path), source);
+        File file = SD.open(path, FILE_READ);
+        if (!file) return false;
+        WaveCacheHeader header;
+        bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                  header.magic == WAVE_CACHE_MAGIC && header.sourceSize == sourceSize &&
+                  header.frames == frames;
+        file.close();
+        return ok;
+    }
+};
+
+#endif
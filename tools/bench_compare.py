@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Compare benchmark JSON against a stored baseline and flag regressions.
+
+Usage:
+    bench_compare.py bench/baseline/native.json current.json [--threshold 10]
+    bench_compare.py bench/baseline/native.json current.json --update
+
+Exits with status 1 when any case is slower than the baseline by more than
+the threshold (percent, on ns_per_iter). Cases present in only one file
+are listed but don't fail the comparison. --update overwrites the baseline
+with the current results.
+
+Replay results (bench/replay.cpp) also carry hashes of what each session
+drew and played; any difference there fails too, whatever the timings.
+"""
+
+import argparse
+import json
+import shutil
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        text = f.read()
+    # Target output is captured from the serial monitor; skip anything
+    # before the JSON object
+    start = text.find("{")
+    if start < 0:
+        sys.exit("%s: no JSON found" % path)
+    data = json.loads(text[start:text.rfind("}") + 1])
+    return data.get("platform", "?"), {r["name"]: r for r in data["results"]}, data.get("hashes")
+
+
+def compare_hashes(base, cur):
+    """Number of sessions whose output differs from the baseline."""
+    mismatches = 0
+    for session in sorted(set(base) | set(cur)):
+        if session not in base or session not in cur:
+            print("%-32s %s" % (session, "new" if session in cur else "missing"))
+            continue
+        changed = [k for k in sorted(base[session]) if base[session][k] != cur[session].get(k)]
+        if changed:
+            print("%-32s OUTPUT CHANGED: %s" % (session, ", ".join(changed)))
+            mismatches += 1
+    return mismatches
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default 10)")
+    parser.add_argument("--update", action="store_true",
+                        help="replace the baseline with the current results")
+    args = parser.parse_args()
+
+    base_platform, base, base_hashes = load(args.baseline)
+    cur_platform, cur, cur_hashes = load(args.current)
+    if base_platform != cur_platform:
+        print("warning: comparing %s baseline against %s results" % (base_platform, cur_platform))
+
+    regressions = 0
+    print("%-32s %14s %14s %9s" % ("case", "baseline ns", "current ns", "change"))
+    for name in sorted(set(base) | set(cur)):
+        if name not in base:
+            print("%-32s %14s %14.1f %9s" % (name, "-", cur[name]["ns_per_iter"], "new"))
+            continue
+        if name not in cur:
+            print("%-32s %14.1f %14s %9s" % (name, base[name]["ns_per_iter"], "-", "missing"))
+            continue
+        b = base[name]["ns_per_iter"]
+        c = cur[name]["ns_per_iter"]
+        change = (c - b) / b * 100.0 if b > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-32s %14.1f %14.1f %+8.1f%%%s" % (name, b, c, change, flag))
+
+    mismatches = 0
+    if base_hashes is not None and cur_hashes is not None:
+        mismatches = compare_hashes(base_hashes, cur_hashes)
+
+    if args.update:
+        shutil.copyfile(args.current, args.baseline)
+        print("baseline updated")
+        return 0
+
+    if regressions:
+        print("%d case(s) regressed by more than %.0f%%" % (regressions, args.threshold))
+    if mismatches:
+        print("%d session(s) drew or played something different" % mismatches)
+    return 1 if regressions or mismatches else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Write session logs for bench/replay.cpp from scripts, and read them back.
+
+Usage:
+    session_tool.py encode bench/sessions/edit_play.txt -o edit_play.ses
+    session_tool.py decode session.ses           # recording from the SD card
+
+A script is one event per line, times in milliseconds since setup() ended
+(decimals allowed), in any order; # starts a comment:
+
+    tracks 4 8                  engine the session is for (default 4 8)
+    100 key p                   hold keys until the next key line
+    130 up                      release every key
+    500 tap ; 40                press, release after 40 ms (default 30)
+    600 key enter               also space, del, tab, 0x<hex>; else a character
+    900 midi 99 24 7f           raw MIDI bytes (hex)
+    1000 clock 120 8            24 PPQN clock at 120 BPM for 8 beats
+    9000 end                    stop replaying here
+
+decode prints a log in the same form, one line per record, so it can be
+edited and encoded again. The format is described in src/session.h.
+"""
+
+import argparse
+import sys
+
+MAGIC = b"SES1"
+VERSION = 1
+KIND_END, KIND_KEYS, KIND_MIDI = 0, 1, 2
+KEY_ENTER, KEY_DEL = 1, 2
+MAX_KEYS = 8  # Keep in sync with SESSION_MAX_KEYS in src/session.h
+
+# What the Cardputer keyboard reports for keys that don't type anything
+SPECIAL_KEYS = {"enter": 0x28, "del": 0x2A, "tab": 0x2B}
+SPECIAL_NAMES = {v: k for k, v in SPECIAL_KEYS.items()}
+
+
+def leb128(value):
+    out = bytearray()
+    while True:
+        b = value & 0x7F
+        value >>= 7
+        out.append(b | 0x80 if value else b)
+        if not value:
+            return bytes(out)
+
+
+def keys_record(tokens):
+    flags, keys, word = 0, [], []
+    for t in tokens:
+        if t in SPECIAL_KEYS:
+            keys.append(SPECIAL_KEYS[t])
+            flags |= {"enter": KEY_ENTER, "del": KEY_DEL}.get(t, 0)
+        elif t.startswith("0x"):
+            keys.append(int(t, 16))
+        else:
+            c = " " if t == "space" else t
+            if len(c) != 1:
+                raise ValueError("unknown key %r" % t)
+            keys.append(ord(c))
+            word.append(ord(c))
+    if len(keys) > MAX_KEYS:
+        raise ValueError("more than %d keys held" % MAX_KEYS)
+    return bytes([KIND_KEYS, flags, len(keys)] + keys + [len(word)] + word)
+
+
+def encode(text):
+    tracks, steps = 4, 8
+    events = []  # (time_us, order, record body)
+    for number, line in enumerate(text.splitlines(), 1):
+        line = line.split("#", 1)[0].split()
+        if not line:
+            continue
+        try:
+            if line[0] == "tracks":
+                tracks, steps = int(line[1]), int(line[2])
+                continue
+            us = int(round(float(line[0]) * 1000))
+            op, args = line[1], line[2:]
+            if op == "key":
+                events.append((us, number, keys_record(args)))
+            elif op == "up":
+                events.append((us, number, keys_record([])))
+            elif op == "tap":
+                hold = float(args[1]) if len(args) > 1 else 30.0
+                events.append((us, number, keys_record(args[:1])))
+                events.append((us + int(hold * 1000), number, keys_record([])))
+            elif op == "midi":
+                for b in args:
+                    events.append((us, number, bytes([KIND_MIDI, int(b, 16)])))
+            elif op == "clock":
+                bpm, beats = float(args[0]), int(args[1])
+                for tick in range(beats * 24):
+                    at = us + int(round(tick * 60e6 / bpm / 24))
+                    events.append((at, number, bytes([KIND_MIDI, 0xF8])))
+            elif op == "end":
+                events.append((us, number, bytes([KIND_END])))
+            else:
+                raise ValueError("unknown event %r" % op)
+        except (IndexError, ValueError) as e:
+            sys.exit("line %d: %s" % (number, e))
+
+    out = bytearray(MAGIC + bytes([VERSION, tracks, steps, 0]))
+    last = 0
+    for at, _, body in sorted(events, key=lambda e: (e[0], e[1])):
+        out += leb128(at - last) + body
+        last = at
+    return bytes(out)
+
+
+def decode(data):
+    if data[:4] != MAGIC or data[4] != VERSION:
+        sys.exit("not a version %d session" % VERSION)
+    lines = ["tracks %d %d" % (data[5], data[6])]
+    pos, now = 8, 0
+    while pos < len(data):
+        delta, shift = 0, 0
+        while pos < len(data):
+            b = data[pos]
+            pos += 1
+            delta |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        if pos >= len(data):
+            break
+        now += delta
+        kind = data[pos]
+        pos += 1
+        stamp = "%.3f" % (now / 1000.0)
+        if kind == KIND_KEYS:
+            count = data[pos + 1]
+            keys = data[pos + 2:pos + 2 + count]
+            pos += 2 + count
+            pos += 1 + data[pos]  # Typed word: the keys again, shift applied
+            tokens = []
+            for k in keys:
+                if k in SPECIAL_NAMES:
+                    tokens.append(SPECIAL_NAMES[k])
+                elif k == 0x20:
+                    tokens.append("space")
+                elif 0x20 < k < 0x7F and k != ord("#"):
+                    tokens.append(chr(k))
+                else:
+                    tokens.append("0x%02x" % k)
+            lines.append("%s key %s" % (stamp, " ".join(tokens)) if tokens else "%s up" % stamp)
+        elif kind == KIND_MIDI:
+            lines.append("%s midi %02x" % (stamp, data[pos]))
+            pos += 1
+        elif kind == KIND_END:
+            lines.append("%s end" % stamp)
+        else:
+            sys.exit("bad record kind %d at byte %d" % (kind, pos - 1))
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=["encode", "decode"])
+    parser.add_argument("input")
+    parser.add_argument("-o", "--output", help="output file (default stdout)")
+    args = parser.parse_args()
+
+    if args.command == "encode":
+        with open(args.input) as f:
+            result = encode(f.read())
+        if args.output:
+            with open(args.output, "wb") as f:
+                f.write(result)
+        else:
+            sys.stdout.buffer.write(result)
+    else:
+        with open(args.input, "rb") as f:
+            result = decode(f.read())
+        if args.output:
+            with open(args.output, "w") as f:
+                f.write(result)
+        else:
+            sys.stdout.write(result)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Build each engine configuration and compare firmware code size and RAM.
+
+Usage:
+    size_report.py                          # the three grid sizes
+    size_report.py -e m5cardputer-adv -e cardputer-16x32
+    size_report.py --json sizes.json        # also write the numbers out
+
+Runs `pio run -e <env>` for every environment and reads the RAM/Flash
+summary PlatformIO prints at the end of a build. RAM is static data and bss
+only; samples live in PSRAM and are allocated at runtime, so they don't
+show up here. Deltas are against the first environment listed.
+"""
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+
+DEFAULT_ENVS = ["m5cardputer-adv", "cardputer-8x16", "cardputer-16x32"]
+
+# RAM:   [=         ]  12.3% (used 40404 bytes from 327680 bytes)
+SIZE_LINE = re.compile(r"^(RAM|Flash):\s+\[.*\]\s+[\d.]+%\s+\(used (\d+) bytes from (\d+) bytes\)")
+
+
+def build(env):
+    proc = subprocess.run(["pio", "run", "-e", env], stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    if proc.returncode != 0:
+        sys.stderr.write(proc.stdout)
+        sys.exit("%s: build failed" % env)
+    sizes = {}
+    for line in proc.stdout.splitlines():
+        m = SIZE_LINE.match(line.strip())
+        if m:
+            sizes[m.group(1).lower()] = {"used": int(m.group(2)), "total": int(m.group(3))}
+    if "ram" not in sizes or "flash" not in sizes:
+        sys.exit("%s: no size summary in build output" % env)
+    return sizes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("-e", "--env", action="append", help="PlatformIO environment (repeatable)")
+    parser.add_argument("--json", help="write results to this file")
+    args = parser.parse_args()
+
+    envs = args.env or DEFAULT_ENVS
+    results = [(env, build(env)) for env in envs]
+
+    base = results[0][1]
+    print("%-20s %12s %10s %12s %10s" % ("env", "flash", "delta", "ram", "delta"))
+    for env, sizes in results:
+        flash, ram = sizes["flash"]["used"], sizes["ram"]["used"]
+        print("%-20s %12d %+10d %12d %+10d" % (env, flash, flash - base["flash"]["used"],
+                                             ram, ram - base["ram"]["used"]))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({env: sizes for env, sizes in results}, f, indent=2)
+            f.write("\n")
+
+
+if __name__ == "__main__":
+    main()
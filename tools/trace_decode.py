@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Decode the binary trace stream from a TRACE_ENABLED build into a timeline.
+
+Usage:
+    trace_decode.py capture.bin               # raw serial capture
+    trace_decode.py --port /dev/ttyACM0       # live, needs pyserial
+    trace_decode.py capture.bin --summary     # span/interval stats only
+
+Frames are 0xA5 0x5A followed by timestamp_us (u32), event (u16) and
+arg (u16), all little-endian. Text log lines on the same port are skipped.
+"""
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+SYNC = b"\xa5\x5a"
+FRAME_SIZE = 10
+
+# Keep in sync with TraceEvent in src/trace.h
+EVENT_NAMES = {
+    0: "Dropped",
+    1: "Input",
+    2: "Step",
+    3: "SampleTrigger",
+    4: "LoadBegin",
+    5: "LoadEnd",
+    6: "DrawBegin",
+    7: "DrawEnd",
+    8: "MidiClock",
+    9: "MidiStart",
+    10: "MidiStop",
+    11: "SleepBegin",
+    12: "SleepEnd",
+}
+
+# Begin/end pairs reported as durations
+SPANS = {4: ("Load", 5), 6: ("Draw", 7), 11: ("Sleep", 12)}
+
+# Keep in sync with PowerState in src/power.h
+POWER_STATES = ["Playing", "Stopped", "Idle"]
+
+# Keep in sync with InputEvent in src/input.h
+INPUT_NAMES = [
+    "None", "Up", "Down", "Left", "Right", "Toggle", "PlayPause", "BPMUp",
+    "BPMDown", "Clear", "LengthUp", "LengthDown", "SampleNext", "SamplePrev",
+    "Pad", "Record", "Quantize", "Calibrate", "Browse", "Back", "Select", "Char",
+    "Backspace", "PowerReport", "Mode",
+]
+
+
+def parse_frames(data):
+    """Yield (timestamp_us, event, arg) for every frame found in data."""
+    pos = 0
+    while True:
+        pos = data.find(SYNC, pos)
+        if pos < 0 or pos + FRAME_SIZE > len(data):
+            return
+        ts, event, arg = struct.unpack_from("<IHH", data, pos + 2)
+        if event in EVENT_NAMES:
+            yield ts, event, arg
+            pos += FRAME_SIZE
+        else:
+            pos += 1  # False sync inside another frame or text
+
+
+def describe(event, arg):
+    if event == 1:
+        return INPUT_NAMES[arg] if arg < len(INPUT_NAMES) else str(arg)
+    if event == 3:
+        return "sample=%d ch=%d" % (arg >> 8, arg & 0xFF)
+    if event in (2, 4, 5, 9):
+        return str(arg)
+    if event == 11:
+        return POWER_STATES[arg] if arg < len(POWER_STATES) else str(arg)
+    if event == 12:
+        return "late %d us" % arg if arg else ""
+    if event == 0:
+        return "%d records lost" % arg
+    return ""
+
+
+def unwrap(frames):
+    """Extend the 32-bit microsecond timestamps past their 71 minute wrap."""
+    offset = 0
+    last = None
+    for ts, event, arg in frames:
+        if last is not None and ts < last and last - ts > 0x80000000:
+            offset += 1 << 32
+        last = ts
+        yield ts + offset, event, arg
+
+
+def print_timeline(frames):
+    start = prev = None
+    for ts, event, arg in frames:
+        if start is None:
+            start = prev = ts
+        print("%12.3f ms  +%9.3f  %-14s %s" % (
+            (ts - start) / 1000.0, (ts - prev) / 1000.0,
+            EVENT_NAMES[event], describe(event, arg)))
+        prev = ts
+
+
+def print_summary(frames):
+    open_spans = {}
+    durations = defaultdict(list)
+    last_step = None
+    step_intervals = []
+    counts = defaultdict(int)
+
+    for ts, event, arg in frames:
+        counts[EVENT_NAMES[event]] += 1
+        if event in SPANS:
+            open_spans[SPANS[event][1]] = (SPANS[event][0], ts)
+        elif event in open_spans:
+            name, begin = open_spans.pop(event)
+            durations[name].append(ts - begin)
+        if event == 2:
+            if last_step is not None:
+                step_intervals.append(ts - last_step)
+            last_step = ts
+
+    print("Event counts:")
+    for name in sorted(counts):
+        print("  %-14s %d" % (name, counts[name]))
+
+    def stats(label, values):
+        if not values:
+            return
+        values = sorted(values)
+        print("  %-14s n=%-6d mean=%9.3f ms  p50=%9.3f ms  max=%9.3f ms" % (
+            label, len(values), sum(values) / len(values) / 1000.0,
+            values[len(values) // 2] / 1000.0, values[-1] / 1000.0))
+
+    print("Durations:")
+    for name in sorted(durations):
+        stats(name, durations[name])
+    stats("Step interval", step_intervals)
+
+
+def port_frames(port, baud):
+    try:
+        import serial
+    except ImportError:
+        sys.exit("pyserial is required for --port")
+    buf = b""
+    with serial.Serial(port, baud, timeout=0.1) as ser:
+        while True:
+            buf += ser.read(4096)
+            for frame in parse_frames(buf):
+                yield frame
+            # Keep a possible partial frame at the end
+            tail = buf.rfind(SYNC)
+            buf = buf[tail:] if tail >= 0 and len(buf) - tail < FRAME_SIZE else b""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture file")
+    parser.add_argument("--port", help="read live from a serial port")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--summary", action="store_true", help="print stats only")
+    args = parser.parse_args()
+
+    if args.port:
+        print_timeline(unwrap(port_frames(args.port, args.baud)))
+        return
+    if not args.capture:
+        parser.error("give a capture file or --port")
+
+    with open(args.capture, "rb") as f:
+        frames = list(unwrap(parse_frames(f.read())))
+    if not args.summary:
+        print_timeline(frames)
+    print_summary(frames)
+
+
+if __name__ == "__main__":
+    main()